@@ -53,6 +53,7 @@ extern "C"
 #define ESPACE -3
 #define EREJECT -4
 #define ETIMEOUT -5
+#define EPENDING -6
 
 #define EXPORT_SYMBOL __attribute__((visibility("default")))
 
@@ -108,9 +109,11 @@ typedef int http_message_result_e;
 #define RESULT_307 307
 #define RESULT_401 401
 #define RESULT_403 403
+#define RESULT_413 413
 #define RESULT_414 414
 #define RESULT_416 416
 #define RESULT_500 500
+#define RESULT_503 503
 #define RESULT_505 505
 #define RESULT_511 511
 #endif
@@ -186,6 +189,7 @@ EXPORT_SYMBOL void httpclient_appendops(const httpclient_ops_t *ops);
  *  ECONTINUE for content available and more in future (exception if the
  *   content is empty, the connector needs to be called again).
  *  EINCOMPLETE for content not ready and need to be called again.
+ *  EPENDING for content computed by another job, see httpmessage_suspend.
  */
 typedef int (*http_connector_t)(void *arg, http_message_t *request, http_message_t *response);
 #define CONNECTOR_SERVER		0
@@ -195,6 +199,13 @@ typedef int (*http_connector_t)(void *arg, http_message_t *request, http_message
 #define CONNECTOR_DOCUMENT		5
 #define CONNECTOR_ERROR			10
 #define CONNECTOR_COMPLETE		0x8000
+/**
+ * flag to add to the priority of a connector which may block its thread.
+ * Without VTHREAD, the connector runs on a worker of the server
+ * (see HTTPSERVER_WORKERS) and the loop continues with the other clients.
+ * When all the workers are busy, the call waits its turn into a queue.
+ */
+#define CONNECTOR_BLOCKING		0x4000
 
 /**
  * @brief callback to manage a sender module context
@@ -233,6 +244,19 @@ typedef struct http_server_config_s
 	const char *versionstr;
 	/** the keepalive timeout in seconds **/
 	int keepalive;
+	/** the maximum number of requests queued on a connection when the version
+	 * contains HTTP_PIPELINE, 0 for the default value **/
+	int pipeline;
+	/** the soft limit in bytes of the memory used by the buffers of the process,
+	 * and the hard limit of the memory used by the buffers of this server, 0 for unlimited.
+	 * With VTHREAD_TYPE=fork the hard limit is the one of each client process **/
+	size_t memorysoft;
+	size_t memoryhard;
+	/** the high and low watermarks in bytes of the output waiting the socket on a
+	 * connection: over the high one the connector is not called again until the
+	 * output drains under the low one, 0 for the default values **/
+	size_t sendhigh;
+	size_t sendlow;
 } http_server_config_t;
 
 /**
@@ -292,6 +316,28 @@ EXPORT_SYMBOL const char * httpserver_INFO(http_server_t *server, const char *ke
 
 EXPORT_SYMBOL size_t httpserver_INFO2(http_server_t *server, const char *key, const char **value);
 
+/**
+ * @brief get the memory used by the buffers of a server
+ *
+ * The memory of a server is the one of its clients and its sessions.
+ * Over the soft limit of the configuration, the pool of chunks is emptied.
+ * Over the hard limit, the client using the most of the memory answers
+ * its current request with 413 (while its content is receiving) or 503
+ * and is closed, the new requests are rejected with 503 and the idle
+ * connections are closed.
+ * With the forked clients, the counters are the ones of the current process
+ * and the hard limit applies to each client process: the server never
+ * sees the memory of its clients.
+ *
+ * @param server the server object generated by httpserver_create,
+ *  or NULL for all the buffers of the process
+ * @param role the name of the buffers ("sockdata", "header", "content"...),
+ *  "pool" for the free chunks of the process, or NULL for all buffers
+ *
+ * @return the number of bytes
+ */
+EXPORT_SYMBOL size_t httpserver_memory(http_server_t *server, const char *role);
+
 /**
  * @brief add a HTTP method to manage
  *
@@ -322,11 +368,68 @@ EXPORT_SYMBOL const httpclient_ops_t * httpserver_changeprotocol(http_server_t *
  * @param server the server object generated by httpserver_create
  * @param func the callback to callback
  * @param data the first parameter to send to the callback
- * @param priority the level to order the connectors
+ * @param priority the level to order the connectors, with CONNECTOR_BLOCKING
+ *  for a connector which may block (file, database...)
  * @param name the name of the module which add the connector
  */
 EXPORT_SYMBOL void httpserver_addconnector(http_server_t *server, http_connector_t func, void *data, int priority, const char *name);
 
+/**
+ * @brief add a callback for a part of the URI space
+ *
+ * The callback is called only for the requests with an URI starting
+ * with prefix and a method of the list. The prefixes are stored into
+ * a trie, the callbacks of the other routes are not called.
+ * The trie is built by httpserver_connect, for the server and the virtual
+ * servers created by httpserver_dup: the routes are added before it.
+ *
+ * @param server the server object generated by httpserver_create
+ * @param methods the names separated by ',' of methods already available, or NULL for all
+ * @param prefix the beginning of the URI (a '*' at the end is ignored), the string is not copied
+ * @param func the callback to callback
+ * @param data the first parameter to send to the callback
+ * @param priority the level to order the connectors
+ * @param name the name of the module which add the connector
+ */
+EXPORT_SYMBOL void httpserver_addroute(http_server_t *server, const char *methods, const char *prefix, http_connector_t func, void *data, int priority, const char *name);
+
+/**
+ * @brief keep the responses of the server in memory
+ *
+ * The complete "200 OK" responses to GET and HEAD are stored with
+ * their header, and the next identical requests receive the copy
+ * without calling the other connectors. The key of a response is the
+ * method, the host, the URI with the query and the values of the
+ * selected headers.
+ * The cache is in the memory of the process: with VTHREAD_TYPE=fork
+ * each client process has its own copy, so a response stored while
+ * serving one connection is not seen by the other connections.
+ * This function is available only with HTTPCACHE.
+ *
+ * @param server the server object generated by httpserver_create
+ * @param size the maximum memory used by the responses, the oldest ones are evicted
+ * @param ttl the seconds before the response becomes stale
+ * @param headers the names of the request's headers of the key separated by ',', or NULL
+ * @return ESUCCESS or EREJECT if the cache already exists
+ */
+EXPORT_SYMBOL int httpserver_addcache(http_server_t *server, size_t size, int ttl, const char *headers);
+
+/**
+ * @brief compress the responses for the clients which accept it
+ *
+ * The content of the "200 OK" responses is compressed with gzip or
+ * deflate following Accept-Encoding, and it is sent with the chunked
+ * transfer coding. The types already compressed (images, audio, video,
+ * archives) are sent as they are.
+ * This function is available only with HTTPENCODING.
+ *
+ * @param server the server object generated by httpserver_create
+ * @param level the zlib level from 1 (faster) to 9 (smaller), or -1 for the default
+ * @param minsize the minimum Content-Length to compress, the streamed contents are always compressed
+ * @return ESUCCESS or EREJECT if the encoding already exists
+ */
+EXPORT_SYMBOL int httpserver_addencoding(http_server_t *server, int level, size_t minsize);
+
 /**
  * @brief restart the connectors from client with other server's connectors
  *
@@ -340,6 +443,10 @@ EXPORT_SYMBOL int httpserver_reloadclient(http_server_t *server, http_client_t *
 /**
  * @brief add a module for client
  *
+ * The context of the module is created before the first reception on
+ * the connection, the module may install the receiver of the connection.
+ * A connection closed without data doesn't create any context.
+ *
  * @param server the server object generated by httpserver_create
  * @param mod the module description
  */
@@ -474,6 +581,10 @@ EXPORT_SYMBOL int httpmessage_appendheader(http_message_t *message, const char *
  * @param content the data of the content
  * @param length the length of the bitstream of the content
  *
+ * With a NULL content and a length of -1, the length remains unknown and
+ * the content is streamed with httpmessage_appendcontent. On a persistent
+ * HTTP/1.1 connection it is sent with "Transfer-Encoding: chunked".
+ *
  * @return the space available into the chunk of content
  */
 EXPORT_SYMBOL int httpmessage_addcontent(http_message_t *message, const char *type, const char *content, int length);
@@ -481,14 +592,97 @@ EXPORT_SYMBOL int httpmessage_addcontent(http_message_t *message, const char *ty
 /**
  * @brief append data to content of the response message before sending
  *
+ * The content buffer is limited, the appended length may be shorter than
+ * the given one and the rest has to be appended on the next call of the
+ * connector. A length up to httpmessage_sendwindow() is always appended.
+ *
  * @param message the response message to update
  * @param content the data of the content
  * @param length the length of the bitstream of the content
  *
- * @return the space available into the chunk of content
+ * @return the length appended, EREJECT on error
  */
 EXPORT_SYMBOL int httpmessage_appendcontent(http_message_t *message, const char *content, int length);
 
+/**
+ * @brief returns the length of content that the connection accepts now
+ *
+ * The output that the socket does not take is kept by the client. Over the
+ * high watermark (see http_server_config_t) the connector is not called
+ * again until the output drains under the low watermark. A connector which
+ * streams a large content may append up to this length on each call.
+ *
+ * @param message the response message
+ *
+ * @return the length in bytes before the high watermark and in the free space
+ * of the content buffer, 0 if the producer has to wait
+ */
+EXPORT_SYMBOL size_t httpmessage_sendwindow(http_message_t *message);
+
+/**
+ * @brief set the validators of the response
+ *
+ * The ETag and Last-Modified headers are added to the response.
+ * A conditional GET or HEAD request (If-None-Match, If-Modified-Since)
+ * which matches receives "304 Not Modified" without content. The connector
+ * may check the result and return ESUCCESS without building the content.
+ *
+ * @param request the request message
+ * @param response the response message to update
+ * @param etag the entity tag with its quotes ("W/" first for a weak one), or NULL
+ * @param etaglen the length of etag or -1
+ * @param mtime the last modification time of the document, or 0
+ *
+ * @return ESUCCESS if the content is not modified, EREJECT otherwise
+ */
+EXPORT_SYMBOL int httpmessage_validator(http_message_t *request, http_message_t *response, const char *etag, ssize_t etaglen, time_t mtime);
+
+struct hash_s;
+/**
+ * @brief set a strong ETag computed from the content
+ *
+ * The content is hashed while it is added to the response. The ETag
+ * is set only if the content is complete before the header
+ * (the connector returns ESUCCESS), and it is checked as the ETag of
+ * httpmessage_validator.
+ *
+ * @param message the response message to update
+ * @param hash the hash to use (see ouistiti/hash.h)
+ *
+ * @return ESUCCESS or EREJECT if the header is already sent
+ */
+EXPORT_SYMBOL int httpmessage_etag(http_message_t *message, const struct hash_s *hash);
+
+/**
+ * @brief select the next part of the document to send
+ *
+ * The first call reads the Range header of a GET request and sets
+ * "206 Partial Content" with Content-Range, or the multipart/byteranges
+ * type for several ranges, and the Content-Length. Without Range the whole
+ * document is the only part. The validators and the Content-Type of the
+ * document must be set before (If-Range, see httpmessage_validator).
+ *
+ * The data of the part is appended with httpmessage_appendcontent, the
+ * delimiter of a multipart part is already into the content. A connector
+ * which sends the file by itself (sendfile) returns ECONTINUE to send this
+ * delimiter, and calls httpclient_flush before its own sending.
+ *
+ * A complete content of the response is cut by the library, the connectors
+ * which build the content in memory do not need this function.
+ *
+ * @param request the request message
+ * @param response the response message to update
+ * @param size the length of the whole document
+ * @param offset the offset of the part into the document
+ * @param length the length of the part
+ *
+ * @return ECONTINUE if the part has to be sent and the function called again,
+ * ESUCCESS when all the parts are sent,
+ * EREJECT if no range is satisfiable ("416 Range Not Satisfiable"), the connector
+ * returns ESUCCESS without content.
+ */
+EXPORT_SYMBOL int httpmessage_range(http_message_t *request, http_message_t *response, size_t size, off_t *offset, size_t *length);
+
 /**
  * @brief returns the content of the request message
  *
@@ -496,6 +690,10 @@ EXPORT_SYMBOL int httpmessage_appendcontent(http_message_t *message, const char
  * @param contentpart the data of the content
  * @param contentlenght the rest size of the content to read
  *
+ * A chunked content is given chunk by chunk without the framing,
+ * contentlenght is the rest of the current chunk and stays over 0
+ * until the last chunk is received.
+ *
  * @return the length of data pop into contentpart
  */
 EXPORT_SYMBOL int httpmessage_content(http_message_t *message, const char **contentpart, size_t *contentlenght);
@@ -525,6 +723,32 @@ EXPORT_SYMBOL int httpmessage_keepalive(http_message_t *message);
  */
 EXPORT_SYMBOL int httpmessage_lock(http_message_t *message);
 
+typedef struct http_message_pending_s http_message_pending_t;
+/**
+ * @brief suspend the response until the end of a job
+ *
+ * the connector gives the handle to the job and returns EPENDING.
+ * The connector is not called again before httpmessage_resume,
+ * and the client waits without polling.
+ *
+ * @param message the response message to suspend
+ *
+ * @return the handle to resume the response, or NULL on error
+ */
+EXPORT_SYMBOL http_message_pending_t *httpmessage_suspend(http_message_t *message);
+
+/**
+ * @brief wake up the client of a suspended response
+ *
+ * this function may be called from any thread, one time for each handle.
+ * The job must not use the message, the connector is called again
+ * to complete the response. If the connector suspended the request on its
+ * first call, it may return EREJECT to pass it to the next connectors.
+ *
+ * @param pending the handle returned by httpmessage_suspend
+ */
+EXPORT_SYMBOL void httpmessage_resume(http_message_pending_t *pending);
+
 /**
  * @brief return the protection of the message
  *
@@ -586,6 +810,35 @@ EXPORT_SYMBOL const char * httpmessage_SERVER(http_message_t *message, const cha
 EXPORT_SYMBOL const char * httpmessage_REQUEST(http_message_t *message, const char *key);
 EXPORT_SYMBOL size_t httpmessage_REQUEST2(http_message_t *message, const char *key, const char **value);
 
+typedef enum
+{
+	HTTPMESSAGE_URI,
+	HTTPMESSAGE_QUERY,
+	HTTPMESSAGE_SCHEME,
+	HTTPMESSAGE_VERSION,
+	HTTPMESSAGE_METHOD,
+	HTTPMESSAGE_RESULT,
+	HTTPMESSAGE_CONTENT,
+	HTTPMESSAGE_CONTENTTYPE,
+	HTTPMESSAGE_REMOTEADDR,
+	HTTPMESSAGE_REMOTEHOST,
+	HTTPMESSAGE_REMOTEPORT,
+	HTTPMESSAGE_PORT,
+	HTTPMESSAGE_ADDR,
+	HTTPMESSAGE_REQUESTS,
+} http_message_request_e;
+
+/**
+ * @brief get value for an attribut of the request without the key comparison
+ *
+ * @param message the request message received
+ * @param id the attribut (same as the keys of httpmessage_REQUEST2)
+ * @param value the pointer to store the value
+ *
+ * @return the length of the value
+ */
+EXPORT_SYMBOL size_t httpmessage_REQUEST_ID(http_message_t *message, http_message_request_e id, const char **value);
+
 /**
  * @brief get/set value for the session used by the request
  *
@@ -616,7 +869,9 @@ EXPORT_SYMBOL size_t httpmessage_SESSION2(http_message_t *message, const char *k
 /**
  * @brief get value from query parameters and/or POST form data
  *
- * the value are stored by mod with the same function.
+ * the value is URL-decoded and null terminated. If the key is
+ * present several times, the last one is returned (POST data
+ * overwrites the query of the URI).
  *
  * @param message the request message received
  * @param key the name of the attribute
@@ -781,6 +1036,30 @@ EXPORT_SYMBOL http_recv_t httpclient_addreceiver(http_client_t *client, http_rec
 EXPORT_SYMBOL http_send_t httpclient_addsender(http_client_t *client, http_send_t func, void *arg);
 
 
+/**
+ * @brief return the memory used by the client
+ *
+ * The size contains the client structure, the socket buffer, the list of
+ * connectors, the list of module contexts (without the contexts themselves)
+ * and the requests in progress.
+ * An idle client gives back the chunk of its socket buffer to the pool
+ * of the library (see MAXCHUNKS_POOL).
+ *
+ * @param client the connection
+ *
+ * @return the number of bytes
+ */
+EXPORT_SYMBOL size_t httpclient_footprint(http_client_t *client);
+
+/**
+ * @brief get the memory accounted to the buffers of a client
+ *
+ * @param client the connection
+ *
+ * @return the number of bytes
+ */
+EXPORT_SYMBOL size_t httpclient_memory(http_client_t *client);
+
 /**
  * @brief shutdown and close the client
  *
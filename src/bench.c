@@ -0,0 +1,164 @@
+/*****************************************************************************
+ * bench.c: benchmark of the request parser
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <x86intrin.h>
+# define BENCH_UNIT "bytes/cycle"
+static unsigned long long bench_clock()
+{
+	return __rdtsc();
+}
+#else
+# define BENCH_UNIT "bytes/ns"
+static unsigned long long bench_clock()
+{
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+}
+#endif
+
+#include "valloc.h"
+#include "vthread.h"
+#include "ouistiti/log.h"
+#include "ouistiti/httpserver.h"
+#include "_httpserver.h"
+#include "_httpmessage.h"
+#include "_buffer.h"
+
+/// the application gives the name of the upgrade
+const char str_upgrade[] = "upgrade";
+
+#define BENCH_LOOPS 20000
+#define BENCH_PLAINSIZE (64 * 1024)
+
+static const char *scanners[] = {"none", "scalar", "sse4.2", "avx2", NULL};
+
+static const char bench_short[] =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"\r\n";
+
+static const char bench_browser[] =
+	"GET /static/javascripts/application/components/dashboard/widgets.min.js?version=20240917&locale=en_US HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.9,fr;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Referer: https://www.example.com/dashboard/overview/statistics/monthly\r\n"
+	"Cookie: session=4f9c2b7e1d3a6f8e0b5c9d2a7e4f1b3c6d8e0a2b4c6d8e0f; theme=dark; tracking=disabled\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+/// the plain bytes are skipped by the scanners
+static const buffer_ranges_t plain_ranges = {
+	BUFFER_RANGES("\r\r\n\n"),
+	.table = {['\r'] = 1, ['\n'] = 1},
+};
+
+static int bench_parse(const char *name, const char *request, size_t length)
+{
+	buffer_t *data = _buffer_create("bench", 0);
+	if (data == NULL)
+		return EREJECT;
+	unsigned long long cycles = 0;
+	for (int i = 0; i < BENCH_LOOPS; i++)
+	{
+		/// the parser consumes the data
+		_buffer_reset(data, 0);
+		_buffer_append(data, request, length);
+		data->offset = data->data;
+		http_message_t *message = _httpmessage_create(NULL, NULL);
+		unsigned long long start = bench_clock();
+		int ret = ECONTINUE;
+		while (ret == ECONTINUE && data->offset < data->data + data->length)
+			ret = _httpmessage_parserequest(message, data);
+		cycles += bench_clock() - start;
+		if (ret == EREJECT || message->uri == NULL)
+		{
+			fprintf(stderr, "bench: %s parsing error\n", name);
+			_httpmessage_destroy(message);
+			_buffer_destroy(data);
+			return EREJECT;
+		}
+		_httpmessage_destroy(message);
+	}
+	printf("\t%-8s %6.3f %s\n", name, (double)length * BENCH_LOOPS / cycles, BENCH_UNIT);
+	_buffer_destroy(data);
+	return ESUCCESS;
+}
+
+static void bench_scan(char *plain, size_t length)
+{
+	size_t total = 0;
+	unsigned long long start = bench_clock();
+	for (int i = 0; i < BENCH_LOOPS / 100; i++)
+	{
+		size_t offset = 0;
+		while (offset < length)
+		{
+			size_t span = _buffer_scan(plain + offset, length - offset, &plain_ranges);
+			offset += (span > 0)? span: 1;
+		}
+		total += offset;
+	}
+	unsigned long long cycles = bench_clock() - start;
+	printf("\t%-8s %6.3f %s\n", "plain", (double)total / cycles, BENCH_UNIT);
+}
+
+int main(int argc, char * const *argv)
+{
+	char *plain = malloc(BENCH_PLAINSIZE);
+	if (plain == NULL)
+		return -1;
+	for (int i = 0; i < BENCH_PLAINSIZE; i++)
+		plain[i] = 'a' + (i % 26);
+	int ret = 0;
+	for (int i = 0; scanners[i] != NULL; i++)
+	{
+		if (_buffer_scanselect(scanners[i]) != ESUCCESS)
+		{
+			printf("%s: not supported\n", scanners[i]);
+			continue;
+		}
+		printf("%s:\n", scanners[i]);
+		bench_scan(plain, BENCH_PLAINSIZE);
+		if (bench_parse("short", STRING_REF(bench_short)) != ESUCCESS)
+			ret = -1;
+		if (bench_parse("browser", STRING_REF(bench_browser)) != ESUCCESS)
+			ret = -1;
+	}
+	free(plain);
+	return ret;
+}
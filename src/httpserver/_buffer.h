@@ -28,6 +28,19 @@
 #ifndef ___BUFFER_H__
 #define ___BUFFER_H__
 
+#ifndef MAXBUFFER_ROLES
+# define MAXBUFFER_ROLES 16
+#endif
+
+typedef struct buffer_account_s buffer_account_t;
+struct buffer_account_s
+{
+	size_t used;
+	size_t limit; /**the hard limit of the memory, 0 for unlimited*/
+	size_t *roles; /**the memory by role, NULL for a client*/
+	buffer_account_t *parent; /**the account of the server of a client*/
+};
+
 typedef struct buffer_s buffer_t;
 struct buffer_s
 {
@@ -37,19 +50,54 @@ struct buffer_s
 	size_t size;
 	size_t length;
 	int maxchunks;
+	int role;
+	buffer_account_t *account;
 };
 
 typedef int (*_buffer_fillcb)(void * cbarg, char *data, size_t size);
 
+/**
+ * the bytes with a meaning for a parser, as pairs of bytes (first, last)
+ * for the vector scanners and as a table for the scalar one.
+ * Both are written into the static data of the parser.
+ */
+typedef struct buffer_ranges_s buffer_ranges_t;
+struct buffer_ranges_s
+{
+	const char *pairs;
+	size_t length;
+	unsigned char table[256];
+};
+#define BUFFER_RANGES(_pairs) .pairs = _pairs, .length = sizeof(_pairs) - 1
+
+size_t _buffer_scan(const char *data, size_t length, const buffer_ranges_t *ranges);
+/**
+ * select the scanner of _buffer_scan by its name ("none", "scalar",
+ * "sse4.2" or "avx2") for the benchmark, EREJECT if the CPU doesn't
+ * support it.
+ */
+int _buffer_scanselect(const char *name);
+
 buffer_t * _buffer_create(const char *name, int maxchunks);
 int _buffer_chunksize(int new);
+int _buffer_release(buffer_t *buffer);
+int _buffer_acquire(buffer_t *buffer);
+size_t _buffer_footprint(const buffer_t *buffer);
+buffer_account_t *_buffer_owner(buffer_account_t *account);
+void _buffer_limits(size_t soft);
+int _buffer_overlimit(const buffer_account_t *account);
+size_t _buffer_memory(const buffer_account_t *account, const char *role);
 
 int _buffer_accept(const buffer_t *buffer, size_t length);
+size_t _buffer_available(const buffer_t *buffer);
 int _buffer_append(buffer_t *buffer, const char *data, size_t length);
+int _buffer_prepend(buffer_t *buffer, const char *data, size_t length);
+int _buffer_extend(buffer_t *buffer, size_t length);
 int _buffer_fill(buffer_t *buffer, _buffer_fillcb cb, void * cbarg);
 
 char *_buffer_pop(buffer_t *buffer, size_t length);
 void _buffer_shrink(buffer_t *buffer);
+buffer_t *_buffer_detach(buffer_t *buffer, const char *name);
 void _buffer_reset(buffer_t *buffer, size_t offset);
 int _buffer_rewindto(buffer_t *buffer, char needle);
 
@@ -61,6 +109,7 @@ int _buffer_full(const buffer_t *buffer);
 int _buffer_filldb(buffer_t *storage, dbentry_t **db, char separator, char fieldsep);
 int _buffer_dbentry(const buffer_t *storage, dbentry_t **db, const char *key, size_t keylen, const char * value, size_t end);
 int _buffer_serializedb(buffer_t *storage, dbentry_t *entry, char separator, char fieldsep);
+int _buffer_indexdb(const buffer_t *storage, dbindex_t *index, char separator, char fieldsep);
 int _buffer_deletedb(buffer_t *storage, dbentry_t *entry, int shrink);
 void _buffer_destroy(buffer_t *buffer);
 
@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * _httpcache.h: HTTP response cache private data
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#ifndef ___HTTPCACHE_H__
+#define ___HTTPCACHE_H__
+
+typedef struct http_cache_s http_cache_t;
+typedef struct http_cache_entry_s http_cache_entry_t;
+typedef struct http_cache_capture_s http_cache_capture_t;
+
+typedef struct buffer_s buffer_t;
+
+void _httpcache_destroy(http_cache_t *cache);
+/**
+ * the entry of a hit is kept by the response until its destruction
+ */
+size_t _httpcache_data(const http_cache_entry_t *entry, const char **data);
+void _httpcache_release(http_cache_entry_t *entry);
+/**
+ * the response of a miss is copied while it is sent
+ * and stored when it is complete.
+ */
+void _httpcache_header(http_message_t *request, http_message_t *response, const buffer_t *header);
+void _httpcache_append(http_message_t *response, const char *data, size_t length);
+void _httpcache_store(http_message_t *response);
+void _httpcache_drop(http_message_t *response);
+
+#endif
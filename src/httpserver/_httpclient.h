@@ -36,16 +36,45 @@
 #define CLIENT_ERROR 0x2000
 #define CLIENT_RESPONSEREADY 0x4000
 #define CLIENT_KEEPALIVE 0x8000
+#define CLIENT_MODULES 0x10000
+#define CLIENT_THROTTLED 0x20000
+#define CLIENT_SHED 0x40000
 #define CLIENT_MACHINEMASK 0x000F
 #define CLIENT_NEW 0x0000
 #define CLIENT_READING 0x0001
 #define CLIENT_WAITING 0x0002
 #define CLIENT_SENDING 0x0003
+#define CLIENT_PENDING 0x0004
 #define CLIENT_EXIT 0x0009
 #define CLIENT_DEAD 0x000A
 
 #define WAIT_TIMER 2 //seconds
 
+#define HTTPCLIENT_NAMELEN 48 /// enough for INET6_ADDRSTRLEN and the port
+#define HTTPCLIENT_HOSTLEN 1025 /// NI_MAXHOST
+
+struct http_client_name_s
+{
+	char data[HTTPCLIENT_NAMELEN];
+	size_t length;
+};
+typedef struct http_client_name_s http_client_name_t;
+
+typedef struct http_client_resolver_s http_client_resolver_t;
+/**
+ * the reverse lookup of the remote address, shared by the client
+ * and the thread of the lookup.
+ */
+struct http_client_resolver_s
+{
+	struct sockaddr_storage addr;
+	http_client_resolver_t *next; /* the next lookup of the queue of the server */
+	int ref;
+	int done; /* the lookup is over, the name is empty if it is unknown */
+	size_t length;
+	char host[HTTPCLIENT_HOSTLEN];
+};
+
 struct http_client_modctx_s
 {
 	void *ctx;
@@ -73,20 +102,32 @@ struct http_client_s
 	http_recv_t client_recv;
 	void *recv_arg;
 
-	http_connector_list_t *callbacks;
+	http_connector_list_t *callbacks; /* the connectors of the client only */
+	http_connector_snapshot_t *connectors; /* the connectors shared with the server */
+	const http_server_route_t *routes; /* the trie of the server which gave the connectors */
 	http_message_t *request;
 	http_message_t *request_queue;
 
 	http_client_modctx_t *modctx; /* list of pointers returned by getctx of each mod */
 
 	buffer_t *sockdata;
+	buffer_t *sockout; /* the responses of pipelined requests gathered for one send */
+	buffer_account_t memory; /* memory used by the buffers of the client */
 #ifdef HTTPCLIENT_DUMPSOCKET
 	int dumpfd;
 #endif
 
+	int wakeup[2]; /* socket pair to resume a suspended response */
+
 	http_server_session_t *session;
 	struct sockaddr_storage addr;
 	unsigned int addr_size;
+	int names; /* the numeric names are rendered */
+	http_client_name_t remote_addr;
+	http_client_name_t remote_port;
+	http_client_name_t local_addr;
+	http_client_name_t local_port;
+	http_client_resolver_t *resolver; /* started on the first use of remote_host */
 	struct http_client_s *next;
 };
 typedef struct http_client_s http_client_t;
@@ -103,9 +144,26 @@ int _httpclient_connect(http_client_t *client, const char *addr, int port);
 void httpclient_disconnect(http_client_t *client);
 int httpclient_addmodule(http_client_t *client, http_server_mod_t *mod);
 void httpclient_freemodules(http_client_t *client);
+void _httpclient_startmodules(http_client_t *client, http_server_t *server);
 void httpclient_freeconnectors(http_client_t *client);
+void _httpclient_addconnectors(http_client_t *client, http_server_t *server);
+const http_connector_list_t *_httpclient_connectors(const http_client_t *client, http_connector_cursor_t *cursor);
+const http_connector_list_t *_httpclient_nextconnector(http_connector_cursor_t *cursor);
 void httpclient_flag(http_client_t *client, int remove, int new);
 
 dbentry_t * httpclient_sessioninfo(http_client_t *client, const char *key);
 
+int _httpclient_wakeup(http_client_t *client);
+int _httpclient_pending(const http_client_t *client);
+size_t _httpclient_pendingout(const http_client_t *client);
+size_t _httpclient_sendwindow(const http_client_t *client);
+void _httpclient_shed(http_client_t *client);
+
+void _httpclient_names(http_client_t *client);
+size_t _httpclient_remotehost(http_client_t *client, const char **value);
+#ifdef USE_PTHREAD
+http_client_resolvers_t *_httpclient_createresolvers(void);
+void _httpclient_destroyresolvers(http_client_resolvers_t *resolvers);
+#endif
+
 #endif
@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * _httpencoding.h: HTTP content coding private data
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+
+#ifndef ___HTTPENCODING_H__
+#define ___HTTPENCODING_H__
+
+typedef struct http_encoding_s http_encoding_t;
+typedef struct http_encoding_stream_s http_encoding_stream_t;
+
+typedef struct buffer_s buffer_t;
+
+void _httpencoding_destroy(http_encoding_t *encoding);
+/**
+ * the coding is selected before the generation of the header,
+ * the Content-Length is removed for the chunked transfer coding.
+ */
+int _httpencoding_header(http_message_t *request, http_message_t *response);
+/**
+ * the content is compressed before to be sent and the returned
+ * buffer is sent in place of it. The end of the stream is sent
+ * before the last chunk.
+ */
+buffer_t *_httpencoding_content(http_message_t *response, buffer_t *content);
+buffer_t *_httpencoding_finish(http_message_t *response);
+void _httpencoding_release(http_message_t *response);
+
+#endif
@@ -39,9 +39,19 @@
 
 #include "dbentry.h"
 #include "_string.h"
+#ifdef HTTPCACHE
+# include "_httpcache.h"
+#endif
+#ifdef HTTPENCODING
+# include "_httpencoding.h"
+#endif
 
 #define HTTPMESSAGE_KEEPALIVE 0x01
 #define HTTPMESSAGE_LOCKED 0x02
+#define HTTPMESSAGE_NOCOPY 0x04
+#define HTTPMESSAGE_CHUNKED 0x08
+#define HTTPMESSAGE_LASTCHUNK 0x10
+#define HTTPMESSAGE_LENGTHSET 0x20
 
 extern const char str_true[];
 extern const char str_get[];
@@ -49,26 +59,127 @@ extern const char str_post[];
 extern const char str_head[];
 extern const char str_form_urlencoded[];
 extern const char str_cookie[];
+extern const char str_setcookie[];
 extern const char str_connection[];
 extern const char str_contenttype[];
 extern const char str_contentlength[];
 
 typedef struct buffer_s buffer_t;
 
+/**
+ * headers used by the library itself are retrieved directly
+ * from their slot in the message without lookup.
+ */
+typedef enum
+{
+	HEADER_CONTENTTYPE,
+	HEADER_CONTENTLENGTH,
+	HEADER_CONNECTION,
+	HEADER_COOKIE,
+	HEADER_STATUS,
+	HEADER_HOST,
+	HEADER_TRANSFERENCODING,
+	HEADER_KNOWN,
+} _http_message_header_e;
+
 typedef struct http_connector_list_s http_connector_list_t;
 struct http_connector_list_s
 {
 	http_connector_t func;
 	void *arg;
 	struct http_connector_list_s *next;
-	struct http_connector_list_s *nextcomplete;
 	const char *name;
 	int priority;
+	const char *prefix; /**the beginning of the URI for a route or NULL*/
+	size_t prefixlen;
+	unsigned int methods; /**the mask of the methods' id for a route or 0*/
+	int route; /**the bit of the route into the trie of the server or -1*/
+	int blocking; /**the connector runs on a worker of the server*/
+	int ahead; /**the connector of the client runs before the shared ones of the same priority*/
 };
-void _httpconnector_add(http_connector_list_t **first,
+http_connector_list_t *_httpconnector_add(http_connector_list_t **first,
 						http_connector_t func, void *funcarg,
 						int priority, const char *name);
 
+typedef struct http_connector_snapshot_s http_connector_snapshot_t;
+/**
+ * copy of the connectors of the server shared by the clients.
+ * The list is never modified, a new snapshot is built for each new
+ * connector of the server.
+ */
+struct http_connector_snapshot_s
+{
+	http_connector_list_t *first;
+	int ref;
+};
+http_connector_snapshot_t *_httpconnector_snapshot(const http_connector_list_t *first);
+http_connector_snapshot_t *_httpconnector_acquire(http_connector_snapshot_t *snapshot);
+void _httpconnector_release(http_connector_snapshot_t *snapshot);
+
+/**
+ * handle of a suspended response, shared by the message and the job.
+ * The job writes on its own copy of the wake up socket of the client.
+ */
+struct http_message_pending_s
+{
+	int fd;
+	int resumed;
+	int ref;
+};
+void _httpmessage_releasepending(http_message_pending_t *pending);
+int _httpmessage_pending(http_message_t *message);
+int _httpmessage_suspended(const http_message_t *message);
+
+typedef struct http_connector_job_s http_connector_job_t;
+/**
+ * call of a blocking connector given to a worker of the server.
+ * The result is kept until the client calls the connector again.
+ */
+struct http_connector_job_s
+{
+	const http_connector_list_t *connector; /**to find the connector into the list*/
+	http_connector_t func;
+	void *arg;
+	http_message_t *request;
+	http_message_t *response;
+	http_message_pending_t *pending;
+	buffer_account_t *account;
+	http_connector_job_t *next; /**the next job waiting a worker*/
+	int ret;
+};
+int _httpconnector_call(const http_connector_list_t *connector, http_message_t *request, http_message_t *response);
+
+#ifndef HTTPMESSAGE_MAXRANGES
+# define HTTPMESSAGE_MAXRANGES 8
+#endif
+typedef struct http_message_ranges_s http_message_ranges_t;
+/**
+ * the parts of the document requested with the Range header.
+ * Without Range, the whole document is the only part.
+ */
+struct http_message_ranges_s
+{
+	struct
+	{
+		off_t start;
+		size_t length;
+	} parts[HTTPMESSAGE_MAXRANGES];
+	int count;
+	int next; /**the part to send after the current one*/
+	int multipart;
+	size_t size; /**the length of the whole document*/
+	unsigned long long total; /**the length of the content of the response*/
+	size_t typeoffset; /**the Content-Type of the document into the headers storage*/
+	size_t typelength;
+	char boundary[24];
+};
+
+struct http_connector_cursor_s
+{
+	const http_connector_list_t *shared;
+	const http_connector_list_t *own;
+};
+
 struct http_message_s
 {
 	http_message_result_e result;
@@ -76,7 +187,22 @@ struct http_message_s
 	http_client_t *client;
 	http_message_t *response;
 	void *connector;
-	http_connector_list_t *complete;
+	int complete; /**the complete connectors have to be called*/
+	http_message_pending_t *pending; /**the connector waits the end of a job*/
+	http_connector_job_t *job; /**the connector runs on a worker*/
+	const http_connector_list_t *resume; /**the connector to call again after a suspension*/
+	const struct hash_s *etaghash; /**the content is hashed for the ETag*/
+	void *etagctx;
+	http_message_ranges_t *ranges; /**the parts of the document to send*/
+#ifdef HTTPCACHE
+	http_cache_entry_t *cached; /**the response is sent from the cache*/
+	size_t cached_offset;
+	http_cache_capture_t *capture; /**the response is copied for the cache*/
+	int parked; /**the response waited the same one for another client*/
+#endif
+#ifdef HTTPENCODING
+	http_encoding_stream_t *encoding; /**the content is compressed*/
+#endif
 	const http_message_method_t *method;
 	enum {
 		PARSE_INIT,
@@ -110,15 +236,26 @@ struct http_message_s
 	buffer_t *header;
 	unsigned long long content_length;
 	unsigned int content_packet;
+	unsigned long long chunk_length; /**rest of the current chunk of a chunked content*/
+	int chunk_state;
 	const char *content_type;
 	buffer_t *uri;
+	char token[16]; /**method or version received in several parts*/
+	size_t tokenlen;
 	http_message_version_e version;
 	buffer_t *headers_storage;
-	dbentry_t *headers;
+	size_t headers_line; /**offset of the current header line into the storage*/
+	dbindex_t headers;
+	short headers_known[HEADER_KNOWN]; /**index + 1 of the first occurrence of the known headers*/
 	buffer_t *query_storage;
-	dbentry_t *queries;
+	dbindex_t queries; /**index of the raw parameters into query_storage*/
+	size_t queries_length; /**length of query_storage when it was indexed*/
+	buffer_t *parameters_storage; /**the parameters already decoded*/
+	buffer_t **parameters_retired; /**the storages decoded before the POST data, kept for their values*/
+	int parameters_nbretired;
+	dbindex_t parameters;
 	buffer_t *cookie_storage;
-	dbentry_t *cookies;
+	dbindex_t cookies;
 	void *private;
 	http_message_t *next;
 	char decodeval;
@@ -128,10 +265,13 @@ struct _http_message_result_s
 {
 	int result;
 	string_t status;
+	string_t line[HTTP11 + 1]; /**the status line for HTTP/1.0 and HTTP/1.1*/
 };
 typedef struct _http_message_result_s _http_message_result_t;
 
-extern const _http_message_result_t *_http_message_result[];
+#define _HTTPMESSAGE_RESULT_CLASSES 5
+#define _HTTPMESSAGE_RESULT_SUBCODES 32
+extern const _http_message_result_t *_http_message_result[_HTTPMESSAGE_RESULT_CLASSES][_HTTPMESSAGE_RESULT_SUBCODES];
 
 typedef struct http_message_method_s http_message_method_t;
 struct http_message_method_s
@@ -154,21 +294,44 @@ typedef enum
 
 http_message_t * _httpmessage_create(http_client_t *client, http_message_t *parent);
 void _httpmessage_destroy(http_message_t *message);
+size_t _httpmessage_footprint(const http_message_t *message);
 int _httpmessage_buildresponse(http_message_t *message, int version, buffer_t *header);
-buffer_t *_httpmessage_buildheader(http_message_t *message);
+int _httpmessage_buildheader(http_message_t *message, buffer_t *header);
+int _httpmessage_chunkencoding(http_message_t *message);
 int _httpmessage_parserequest(http_message_t *message, buffer_t *data);
+int _httpmessage_pinned(const http_message_t *message);
 int _httpmessage_fillheaderdb(http_message_t *message);
+ssize_t _httpmessage_headervalue(const http_message_t *message, _http_message_header_e id, const char **value);
+ssize_t _httpmessage_searchheader(const http_message_t *message, const char *key, const char **value);
 size_t _httpmessage_status(const http_message_t *message, char *status, size_t statuslen);
+const _http_message_result_t *_httpmessage_result(int result);
 int _httpmessage_changestate(http_message_t *message, int new);
 int _httpmessage_state(http_message_t *message, int check);
 int _httpmessage_contentempty(http_message_t *message, int unset);
 int _httpmessage_runconnector(http_message_t *request, http_message_t *response);
+int _httpmessage_conditional(http_message_t *request, http_message_t *response);
+int _httpmessage_partial(http_message_t *request, http_message_t *response);
+#ifdef HTTPCACHE
+int _httpmessage_restore(http_message_t *request, http_message_t *response, const char *header, size_t headerlen, const char *content, size_t contentlen);
+#endif
+int _httpmessage_replaceheader(http_message_t *message, const char *key, const char *value, size_t valuelen);
 
-#define _HTTPMESSAGE_RESULT_DEFINE(_id, _status) &(_http_message_result_t){.result = _id, .status.data = _status, .status.length = sizeof(_status) - 1}
+/**
+ * the table is indexed by the class and the rest of the code,
+ * the status lines are rendered at the compilation.
+ */
+#define _HTTPMESSAGE_RESULT_DEFINE(_id, _status) \
+	[(_id) / 100 - 1][(_id) % 100] = &(_http_message_result_t){ \
+		.result = _id, \
+		.status = STRING_DCL(_status), \
+		.line = { \
+			[HTTP10] = STRING_DCL("HTTP/1.0" _status "\r\n"), \
+			[HTTP11] = STRING_DCL("HTTP/1.1" _status "\r\n"), \
+		}}
 #define _HTTPMESSAGE_RESULT_MAXLEN 40
 
 #ifdef _HTTPMESSAGE_
-const _http_message_result_t *_http_message_result[] =
+const _http_message_result_t *_http_message_result[_HTTPMESSAGE_RESULT_CLASSES][_HTTPMESSAGE_RESULT_SUBCODES] =
 {
 #if defined(RESULT_100)
 	_HTTPMESSAGE_RESULT_DEFINE(RESULT_100, " 100 Continue"),
@@ -292,7 +455,6 @@ const _http_message_result_t *_http_message_result[] =
 #if defined(RESULT_511)
 	_HTTPMESSAGE_RESULT_DEFINE(RESULT_511, " 511 Network Authentication Required"),
 #endif
-	NULL
 };
 
 #endif
@@ -37,12 +37,35 @@
 # include <winsock2.h>
 #endif
 
+#include <stdint.h>
+
 #include "vthread.h"
 #include "dbentry.h"
 #include "_string.h"
+#include "_buffer.h"
+
+#if defined(VTHREAD) && defined(HTTPSERVER_WORKERS)
+/// each client has its own thread, the blocking connectors run on it
+# undef HTTPSERVER_WORKERS
+#endif
+#ifdef HTTPSERVER_WORKERS
+# include "threadpool.h"
+typedef struct http_connector_queue_s http_connector_queue_t;
+http_connector_queue_t *_httpconnector_createqueue(threadpool_t *workers, int nbworkers);
+void _httpconnector_destroyqueue(http_connector_queue_t *queue);
+#endif
+typedef struct http_client_resolvers_s http_client_resolvers_t;
+#ifdef HTTPCACHE
+# include "_httpcache.h"
+#endif
+#ifdef HTTPENCODING
+# include "_httpencoding.h"
+#endif
 
 typedef struct buffer_s buffer_t;
 typedef struct http_connector_list_s http_connector_list_t;
+typedef struct http_connector_snapshot_s http_connector_snapshot_t;
+typedef struct http_connector_cursor_s http_connector_cursor_t;
 typedef struct http_client_modctx_s http_client_modctx_t;
 typedef struct http_message_method_s http_message_method_t;
 typedef struct http_server_session_s http_server_session_t;
@@ -60,6 +83,35 @@ struct httpserver_ops_s
 
 typedef struct http_server_mod_s http_server_mod_t;
 
+#define METHODS_TABLESIZE 32
+typedef struct http_server_methodentry_s http_server_methodentry_t;
+/**
+ * the method name is packed into two words, zero padded,
+ * to be checked with one comparison.
+ */
+struct http_server_methodentry_s
+{
+	uint64_t key[2];
+	size_t length;
+	const http_message_method_t *method;
+};
+
+#define ROUTES_MAX 64
+typedef struct http_server_route_s http_server_route_t;
+/**
+ * node of the radix trie of the URI prefixes. The label is a part
+ * of the prefix of the connector, and routes is the bit mask of
+ * the connectors' routes ending on this node.
+ */
+struct http_server_route_s
+{
+	const char *label;
+	size_t length;
+	uint64_t routes;
+	http_server_route_t *child;
+	http_server_route_t *next;
+};
+
 struct http_server_mod_s
 {
 	void *arg;
@@ -78,6 +130,7 @@ struct http_server_s
 	vthread_t thread;
 	http_client_t *clients;
 	http_connector_list_t *callbacks;
+	http_connector_snapshot_t *connectors;
 	http_server_config_t *config;
 	http_server_mod_t *mod;
 	const httpserver_ops_t *ops;
@@ -90,11 +143,27 @@ struct http_server_s
 	string_t service;
 	http_message_method_t *methods;
 	buffer_t *methods_storage;
+	http_server_methodentry_t methodtable[METHODS_TABLESIZE];
+	http_server_route_t routes;
+	int nbroutes;
 #ifdef USE_POLL
 	struct pollfd *poll_set;
+#endif
+#ifdef HTTPSERVER_WORKERS
+	threadpool_t *workers; /* the threads of the blocking connectors */
+	http_connector_queue_t *jobs; /* the calls of the blocking connectors */
+#endif
+	http_client_resolvers_t *resolvers; /* the thread of the reverse lookups, with USE_PTHREAD */
+#ifdef HTTPCACHE
+	http_cache_t *cache;
+#endif
+#ifdef HTTPENCODING
+	http_encoding_t *encoding;
 #endif
 	fd_set fds[3];
 	int numfds;
+	buffer_account_t memory; /* memory used by the buffers of the clients and the sessions */
+	size_t memoryroles[MAXBUFFER_ROLES];
 	http_server_session_t *sessions;
 	http_server_t *next;
 };
@@ -112,6 +181,8 @@ typedef int (*checksession_t)(void * arg, http_server_session_t*session);
 http_server_session_t *_httpserver_createsession(http_server_t *server, const http_client_t *client);
 http_server_session_t *_httpserver_searchsession(const http_server_t *server, checksession_t cb, void *cbarg);
 void _httpserver_dropsession(http_server_t *server, http_server_session_t *session);
+const http_message_method_t *_httpserver_method(const http_server_t *server, const char *key, size_t keylen);
+uint64_t _httpserver_route(const http_server_route_t *routes, const char *uri, size_t length);
 
 extern const char str_defaultscheme[];
 
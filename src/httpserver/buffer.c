@@ -93,7 +93,325 @@ int _string_empty(const string_t *str)
 	return ! (str->data != NULL && str->data[0] != '\0');
 }
 
+/**
+ * the scanners skip the bytes outside of the ranges.
+ * The ranges are pairs of bytes (first, last) as for pcmpestri,
+ * 8 ranges at most.
+ * The scanner may stop before the first byte inside the ranges,
+ * the caller checks the following bytes one by one.
+ */
+static size_t _buffer_scanbytes(const char *data, size_t length, const buffer_ranges_t *ranges)
+{
+	size_t i = 0;
+	while (i < length && !ranges->table[(unsigned char)data[i]])
+		i++;
+	return i;
+}
+
+/// the byte loop of the parsers, for the benchmark
+static size_t _buffer_scannone(const char *data, size_t length, const buffer_ranges_t *ranges)
+{
+	return 0;
+}
+
+typedef size_t (*_buffer_scanner_t)(const char *data, size_t length, const buffer_ranges_t *ranges);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#ifndef BUFFER_AVX2RANGES
+/**
+ * AVX2 compares the bytes with each range one after the other,
+ * pcmpestri is faster for more ranges.
+ */
+# define BUFFER_AVX2RANGES 3
+#endif
+
+__attribute__((target("sse4.2")))
+static size_t _buffer_scansse42(const char *data, size_t length, const buffer_ranges_t *ranges)
+{
+	size_t rangeslen = ranges->length;
+	char set[16] = {0};
+	memcpy(set, ranges->pairs, (rangeslen < 16)? rangeslen: 16);
+	__m128i mset = _mm_loadu_si128((const __m128i *)set);
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+		int index = _mm_cmpestri(mset, rangeslen, chunk, 16,
+				_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if (index < 16)
+			return i + index;
+	}
+	return i;
+}
+
+/**
+ * a byte is into the range if (byte - first) <= (last - first)
+ * as unsigned values.
+ */
+__attribute__((target("avx2")))
+static size_t _buffer_scanavx2(const char *data, size_t length, const buffer_ranges_t *ranges)
+{
+	if (ranges->length > BUFFER_AVX2RANGES * 2)
+		return _buffer_scansse42(data, length, ranges);
+	const char *pairs = ranges->pairs;
+	__m256i first[BUFFER_AVX2RANGES];
+	__m256i width[BUFFER_AVX2RANGES];
+	size_t nbranges = ranges->length / 2;
+	for (size_t r = 0; r < nbranges; r++)
+	{
+		first[r] = _mm256_set1_epi8(pairs[2 * r]);
+		width[r] = _mm256_set1_epi8((char)(pairs[2 * r + 1] - pairs[2 * r]));
+	}
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i found = _mm256_setzero_si256();
+		for (size_t r = 0; r < nbranges; r++)
+		{
+			__m256i offset = _mm256_sub_epi8(chunk, first[r]);
+			found = _mm256_or_si256(found, _mm256_cmpeq_epi8(_mm256_min_epu8(offset, width[r]), offset));
+		}
+		unsigned int mask = _mm256_movemask_epi8(found);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	/// the tail is shorter than 32 bytes
+	return i + _buffer_scansse42(data + i, length - i, ranges);
+}
+
+static size_t _buffer_scaninit(const char *data, size_t length, const buffer_ranges_t *ranges);
+static _buffer_scanner_t _buffer_scanner = _buffer_scaninit;
+
+static size_t _buffer_scaninit(const char *data, size_t length, const buffer_ranges_t *ranges)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		_buffer_scanner = _buffer_scanavx2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		_buffer_scanner = _buffer_scansse42;
+	else
+		_buffer_scanner = _buffer_scanbytes;
+	return _buffer_scanner(data, length, ranges);
+}
+#else
+static _buffer_scanner_t _buffer_scanner = _buffer_scanbytes;
+#endif
+
+/**
+ * returns a number of bytes without any delimiter.
+ */
+size_t _buffer_scan(const char *data, size_t length, const buffer_ranges_t *ranges)
+{
+	if (length < 16)
+		return 0;
+	return _buffer_scanner(data, length, ranges);
+}
+
+int _buffer_scanselect(const char *name)
+{
+	if (!strcmp(name, "none"))
+		_buffer_scanner = _buffer_scannone;
+	else if (!strcmp(name, "scalar"))
+		_buffer_scanner = _buffer_scanbytes;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	else if (!strcmp(name, "sse4.2") && __builtin_cpu_supports("sse4.2"))
+		_buffer_scanner = _buffer_scansse42;
+	else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+		_buffer_scanner = _buffer_scanavx2;
+#endif
+	else
+		return EREJECT;
+	return ESUCCESS;
+}
+
 static int ChunkSize = HTTPMESSAGE_CHUNKSIZE;
+
+#ifndef MAXCHUNKS_POOL
+# define MAXCHUNKS_POOL 0
+#endif
+/**
+ * the pool keeps the first chunk of the released buffers
+ * to give it to the next created buffer.
+ */
+static struct
+{
+	char *chunks[MAXCHUNKS_POOL + 1];
+	int count;
+#ifdef USE_PTHREAD
+	pthread_mutex_t mutex;
+#endif
+} _buffer_pool = {
+	.count = 0,
+#ifdef USE_PTHREAD
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+#ifdef USE_PTHREAD
+# define _buffer_poollock() pthread_mutex_lock(&_buffer_pool.mutex)
+# define _buffer_poolunlock() pthread_mutex_unlock(&_buffer_pool.mutex)
+#else
+# define _buffer_poollock()
+# define _buffer_poolunlock()
+#endif
+
+/**
+ * the memory of the buffers is accounted by role (the name of the buffer)
+ * and by owner (the client which creates the buffer, and its server).
+ */
+static struct
+{
+	size_t used;
+	size_t soft;
+	struct
+	{
+		const char *name;
+		size_t used;
+	} roles[MAXBUFFER_ROLES];
+	int nbroles;
+} _buffer_memory_s = {
+	.used = 0,
+	.soft = 0,
+	.nbroles = 1,
+	.roles[0].name = "other",
+};
+
+#ifdef USE_PTHREAD
+static __thread buffer_account_t *_buffer_current = NULL;
+#else
+static buffer_account_t *_buffer_current = NULL;
+#endif
+
+/**
+ * set the owner of the next created buffers for the current thread
+ * and returns the previous one.
+ */
+buffer_account_t *_buffer_owner(buffer_account_t *account)
+{
+	buffer_account_t *previous = _buffer_current;
+	_buffer_current = account;
+	return previous;
+}
+
+static int _buffer_role(const char *name)
+{
+	for (int i = 1; i < _buffer_memory_s.nbroles; i++)
+	{
+		if (_buffer_memory_s.roles[i].name == name)
+			return i;
+	}
+	int role = 0;
+	_buffer_poollock();
+	for (int i = 1; i < _buffer_memory_s.nbroles; i++)
+	{
+		if (!strcmp(_buffer_memory_s.roles[i].name, name))
+			role = i;
+	}
+	if (role == 0 && _buffer_memory_s.nbroles < MAXBUFFER_ROLES)
+	{
+		role = _buffer_memory_s.nbroles;
+		_buffer_memory_s.roles[role].name = name;
+		_buffer_memory_s.nbroles++;
+	}
+	_buffer_poolunlock();
+	return role;
+}
+
+static void _buffer_charge(buffer_t *buffer, size_t size)
+{
+	vaccount(&_buffer_memory_s.used, size);
+	vaccount(&_buffer_memory_s.roles[buffer->role].used, size);
+	for (buffer_account_t *account = buffer->account; account != NULL; account = account->parent)
+	{
+		vaccount(&account->used, size);
+		if (account->roles)
+			vaccount(&account->roles[buffer->role], size);
+	}
+}
+
+static void _buffer_trim(void)
+{
+	_buffer_poollock();
+	while (_buffer_pool.count > 0)
+		vfree(_buffer_pool.chunks[--_buffer_pool.count]);
+	_buffer_poolunlock();
+}
+
+/**
+ * the pool is shared by the process, over the soft limit it is emptied.
+ */
+void _buffer_limits(size_t soft)
+{
+	_buffer_memory_s.soft = soft;
+}
+
+/**
+ * over the hard limit of an account (the server), the empty buffers
+ * cannot be acquired again and the server sheds its clients.
+ */
+int _buffer_overlimit(const buffer_account_t *account)
+{
+	for (; account != NULL; account = account->parent)
+	{
+		if (account->limit > 0 && account->used >= account->limit)
+			return 1;
+	}
+	return 0;
+}
+
+size_t _buffer_memory(const buffer_account_t *account, const char *role)
+{
+	if (role == NULL)
+		return (account != NULL)? account->used: _buffer_memory_s.used;
+	if (!strcmp(role, "pool"))
+		return _buffer_pool.count * (ChunkSize + 1);
+	for (int i = 0; i < _buffer_memory_s.nbroles; i++)
+	{
+		if (strcmp(_buffer_memory_s.roles[i].name, role))
+			continue;
+		if (account == NULL)
+			return _buffer_memory_s.roles[i].used;
+		if (account->roles != NULL)
+			return account->roles[i];
+	}
+	return 0;
+}
+
+static char *_buffer_getchunk(void)
+{
+	char *chunk = NULL;
+	_buffer_poollock();
+	if (_buffer_pool.count > 0)
+		chunk = _buffer_pool.chunks[--_buffer_pool.count];
+	_buffer_poolunlock();
+	if (chunk == NULL)
+		chunk = vcalloc(1, ChunkSize + 1);
+	else
+		chunk[0] = '\0';
+	return chunk;
+}
+
+static void _buffer_putchunk(char *chunk, size_t size)
+{
+	if (size == ChunkSize + 1)
+	{
+		_buffer_poollock();
+		if (_buffer_pool.count < MAXCHUNKS_POOL &&
+			(_buffer_memory_s.soft == 0 ||
+			_buffer_memory_s.used + (_buffer_pool.count + 1) * size < _buffer_memory_s.soft))
+		{
+			_buffer_pool.chunks[_buffer_pool.count++] = chunk;
+			chunk = NULL;
+		}
+		_buffer_poolunlock();
+	}
+	if (chunk != NULL)
+		vfree(chunk);
+}
+
 /**
  * the chunksize has to be constant during the life of the application.
  * Two ways are available:
@@ -109,9 +427,9 @@ buffer_t * _buffer_create(const char *name, int maxchunks)
 	/**
 	 * nbchunks is unused here, because is it possible to realloc.
 	 * Embeded version may use the nbchunk with special vcalloc.
-	 * The idea is to create a pool of chunks into the stack.
+	 * The first chunk comes from the pool if it is available.
 	 */
-	buffer->data = vcalloc(1, ChunkSize + 1);
+	buffer->data = _buffer_getchunk();
 	if (buffer->data == NULL)
 	{
 		free(buffer);
@@ -120,16 +438,67 @@ buffer_t * _buffer_create(const char *name, int maxchunks)
 	buffer->maxchunks = maxchunks - 1;
 	buffer->size = ChunkSize + 1;
 	buffer->offset = buffer->data;
+	buffer->role = _buffer_role(name);
+	buffer->account = _buffer_current;
+	_buffer_charge(buffer, buffer->size);
 	return buffer;
 }
 
 int _buffer_chunksize(int new)
 {
-	if (new > 0)
+	if (new > 0 && new != ChunkSize)
+	{
+		/// the chunks of the pool have the previous size
+		_buffer_trim();
 		ChunkSize = new;
+	}
 	return ChunkSize;
 }
 
+/**
+ * give back the memory of an empty buffer.
+ * The buffer keeps its state and it will get a new chunk
+ * with _buffer_acquire.
+ */
+int _buffer_release(buffer_t *buffer)
+{
+	if (buffer->data == NULL)
+		return ESUCCESS;
+	if (buffer->length > (buffer->offset - buffer->data))
+		return EREJECT;
+	/// the extended chunks are available again for the next use, -1 is unlimited
+	if (buffer->maxchunks > -1 && buffer->size > ChunkSize + 1)
+		buffer->maxchunks += (buffer->size - 1) / ChunkSize - 1;
+	_buffer_charge(buffer, -buffer->size);
+	_buffer_putchunk(buffer->data, buffer->size);
+	buffer->data = NULL;
+	buffer->offset = NULL;
+	buffer->size = 0;
+	buffer->length = 0;
+	return ESUCCESS;
+}
+
+int _buffer_acquire(buffer_t *buffer)
+{
+	if (buffer->data != NULL)
+		return ESUCCESS;
+	if (_buffer_overlimit(buffer->account))
+		return EREJECT;
+	buffer->data = _buffer_getchunk();
+	if (buffer->data == NULL)
+		return EREJECT;
+	buffer->size = ChunkSize + 1;
+	buffer->offset = buffer->data;
+	buffer->length = 0;
+	_buffer_charge(buffer, buffer->size);
+	return ESUCCESS;
+}
+
+size_t _buffer_footprint(const buffer_t *buffer)
+{
+	return sizeof(*buffer) + buffer->size;
+}
+
 int _buffer_accept(const buffer_t *buffer, size_t length)
 {
 	if ((buffer->data + buffer->size < buffer->offset + length) &&
@@ -138,6 +507,71 @@ int _buffer_accept(const buffer_t *buffer, size_t length)
 	return ESUCCESS;
 }
 
+/**
+ * the length that _buffer_append takes before to refuse,
+ * (size_t)-1 for an unlimited buffer.
+ */
+size_t _buffer_available(const buffer_t *buffer)
+{
+	if (buffer->maxchunks < 0)
+		return (size_t)-1;
+	size_t available = ChunkSize;
+	if (buffer->data != NULL)
+		available = buffer->size - (buffer->offset - buffer->data) - 1;
+	return available + buffer->maxchunks * ChunkSize;
+}
+
+static int _buffer_grow(buffer_t *buffer, size_t available, size_t length)
+{
+	int nbchunks = ((length - available) / ChunkSize) + 1;
+	if (buffer->maxchunks > -1 && buffer->maxchunks - nbchunks < 0)
+	{
+		err("buffer: %s impossible to exceed to %d chunks", buffer->name, buffer->maxchunks);
+		nbchunks = buffer->maxchunks;
+	}
+	size_t chunksize = ChunkSize * nbchunks;
+
+	if (chunksize == 0)
+	{
+		err("buffer: max chunk: %lu", buffer->size / ChunkSize);
+		return -1;
+	}
+	if (_buffer_memory_s.soft > 0 &&
+		_buffer_memory_s.used + chunksize > _buffer_memory_s.soft)
+		_buffer_trim();
+
+	char *newptr = vrealloc(buffer->data, buffer->size + chunksize);
+	if (newptr == NULL)
+	{
+		buffer->maxchunks = 0;
+		warn("buffer: memory allocation error");
+	}
+	if (buffer->maxchunks == 0)
+	{
+		err("buffer: out memory block: %lu", buffer->size + chunksize);
+		return -1;
+	}
+	if (buffer->maxchunks > 0)
+		buffer->maxchunks -= nbchunks;
+	buffer->size += chunksize;
+	_buffer_charge(buffer, chunksize);
+	if (newptr != buffer->data)
+	{
+		const char *offset = buffer->offset;
+		buffer->offset = newptr + (offset - buffer->data);
+		buffer->data = newptr;
+	}
+	return ESUCCESS;
+}
+
+int _buffer_extend(buffer_t *buffer, size_t length)
+{
+	size_t available = buffer->size - buffer->length - 1;
+	if (available >= length)
+		return ESUCCESS;
+	return _buffer_grow(buffer, available, length);
+}
+
 int _buffer_append(buffer_t *buffer, const char *data, size_t length)
 {
 	if (length == (size_t)-1)
@@ -148,40 +582,8 @@ int _buffer_append(buffer_t *buffer, const char *data, size_t length)
 	if (buffer->data + buffer->size <= buffer->offset + length)
 	{
 		size_t available = buffer->size - (buffer->offset - buffer->data);
-		int nbchunks = ((length - available) / ChunkSize) + 1;
-		if (buffer->maxchunks > -1 && buffer->maxchunks - nbchunks < 0)
-		{
-			err("buffer: %s impossible to exceed to %d chunks", buffer->name, buffer->maxchunks);
-			nbchunks = buffer->maxchunks;
-		}
-		size_t chunksize = ChunkSize * nbchunks;
-
-		if (chunksize == 0)
-		{
-			err("buffer: max chunk: %lu", buffer->size / ChunkSize);
+		if (_buffer_grow(buffer, available, length) < 0)
 			return -1;
-		}
-
-		char *newptr = vrealloc(buffer->data, buffer->size + chunksize);
-		if (newptr == NULL)
-		{
-			buffer->maxchunks = 0;
-			warn("buffer: memory allocation error");
-		}
-		if (buffer->maxchunks == 0)
-		{
-			err("buffer: out memory block: %lu", buffer->size + chunksize);
-			return -1;
-		}
-		if (buffer->maxchunks > 0)
-			buffer->maxchunks -= nbchunks;
-		buffer->size += chunksize;
-		if (newptr != buffer->data)
-		{
-			const char *offset = buffer->offset;
-			buffer->offset = newptr + (offset - buffer->data);
-			buffer->data = newptr;
-		}
 
 		available = buffer->size - (buffer->offset - buffer->data);
 		length = (length > available)? (available - 1): length;
@@ -193,9 +595,20 @@ int _buffer_append(buffer_t *buffer, const char *data, size_t length)
 	return offset - buffer->data;
 }
 
+int _buffer_prepend(buffer_t *buffer, const char *data, size_t length)
+{
+	if (_buffer_extend(buffer, length) < 0)
+		return -1;
+	memmove(buffer->data + length, buffer->data, buffer->length + 1);
+	memcpy(buffer->data, data, length);
+	buffer->length += length;
+	buffer->offset += length;
+	return ESUCCESS;
+}
+
 int _buffer_fill(buffer_t *buffer, _buffer_fillcb cb, void * cbarg)
 {
-	int size = cb(cbarg, buffer->offset, buffer->size - buffer->length - 1);
+	int size = cb(cbarg, buffer->data + buffer->length, buffer->size - buffer->length - 1);
 	if (size > 0)
 	{
 		buffer->length += size;
@@ -227,6 +640,48 @@ void _buffer_shrink(buffer_t *buffer)
 	buffer->offset = buffer->data;
 }
 
+/**
+ * give the data before the offset to a new buffer and
+ * keep only the rest into a new memory block.
+ */
+buffer_t *_buffer_detach(buffer_t *buffer, const char *name)
+{
+	size_t length = buffer->offset - buffer->data;
+	size_t rest = buffer->length - length;
+	size_t size = ChunkSize + 1;
+	if (rest >= ChunkSize)
+		size = rest + 1;
+
+	buffer_t *detached = vcalloc(1, sizeof(*detached));
+	if (detached == NULL)
+		return NULL;
+	char *data = vcalloc(1, size);
+	if (data == NULL)
+	{
+		vfree(detached);
+		return NULL;
+	}
+	memcpy(data, buffer->offset, rest);
+	detached->name = name;
+	detached->data = buffer->data;
+	detached->size = buffer->size;
+	detached->length = length;
+	detached->offset = buffer->offset;
+	detached->data[length] = '\0';
+	detached->role = _buffer_role(name);
+	detached->account = buffer->account;
+	_buffer_charge(detached, detached->size);
+
+	if (buffer->maxchunks > -1 && buffer->size > size)
+		buffer->maxchunks += (buffer->size - size) / ChunkSize;
+	_buffer_charge(buffer, size - buffer->size);
+	buffer->data = data;
+	buffer->size = size;
+	buffer->length = rest;
+	buffer->offset = data;
+	return detached;
+}
+
 void _buffer_reset(buffer_t *buffer, size_t offset)
 {
 	buffer->offset = buffer->data + offset;
@@ -370,6 +825,47 @@ int _buffer_serializedb(buffer_t *storage, dbentry_t *entry, char separator, cha
 	return ESUCCESS;
 }
 
+/**
+ * index the fields without to modify the storage.
+ * The value of a field without separator is empty and
+ * starts just after the key.
+ */
+int _buffer_indexdb(const buffer_t *storage, dbindex_t *index, char separator, char fieldsep)
+{
+	const char *data = storage->data;
+	const char *end = storage->data + storage->length;
+	int count = 0;
+
+	while (data < end)
+	{
+		while (data < end && *data == ' ')
+			data++;
+		const char *fieldend = data;
+		while (fieldend < end && *fieldend != fieldsep && *fieldend != '\0' &&
+				*fieldend != '\r' && *fieldend != '\n')
+			fieldend++;
+		const char *value = memchr(data, separator, fieldend - data);
+		size_t keylen = fieldend - data;
+		if (value != NULL)
+		{
+			keylen = value - data;
+			value++;
+			while (value < fieldend && *value == ' ')
+				value++;
+		}
+		else
+			value = fieldend;
+		if (keylen > 0)
+		{
+			if (dbindex_add(index, storage, data, keylen, value, fieldend - value) < 0)
+				return -1;
+			count++;
+		}
+		data = fieldend + 1;
+	}
+	return count;
+}
+
 size_t _buffer_length(const buffer_t *buffer)
 {
 	return buffer->length;
@@ -382,13 +878,16 @@ int _buffer_empty(const buffer_t *buffer)
 
 int _buffer_full(const buffer_t *buffer)
 {
-	return (buffer->length == buffer->size);
+	return (buffer->data != NULL) && (buffer->length == buffer->size);
 }
 
 void _buffer_destroy(buffer_t *buffer)
 {
 	if (buffer->data != NULL)
-		vfree(buffer->data);
+	{
+		_buffer_charge(buffer, -buffer->size);
+		_buffer_putchunk(buffer->data, buffer->size);
+	}
 	vfree(buffer);
 }
 
@@ -400,7 +899,7 @@ ssize_t dbentry_search(dbentry_t *entry, const char *key, const char **value)
 	while (entry != NULL)
 	{
 		const char *sto_key = entry->storage->data + entry->key.offset;
-		if (!strncasecmp(sto_key, key, entry->key.length))
+		if (!strncasecmp(sto_key, key, entry->key.length) && key[entry->key.length] == '\0')
 		{
 			if (value != NULL)
 				*value = entry->storage->data + entry->value.offset;
@@ -421,7 +920,7 @@ dbentry_t *dbentry_get(dbentry_t *entry, const char *key)
 	while (entry != NULL)
 	{
 		const char *sto_key = entry->storage->data + entry->key.offset;
-		if (!strncasecmp(sto_key, key, entry->key.length))
+		if (!strncasecmp(sto_key, key, entry->key.length) && key[entry->key.length] == '\0')
 		{
 			break;
 		}
@@ -483,3 +982,108 @@ void dbentry_destroy(dbentry_t *entry)
 		entry = next;
 	}
 }
+
+#define DBINDEX_CHUNK 16
+
+unsigned int dbindex_hash(const char *key, size_t keylen)
+{
+	/**
+	 * FNV-1a on the key folded to lower case.
+	 * The folding is not exact for all characters but the strings
+	 * are compared after the hash.
+	 */
+	unsigned int hash = 2166136261U;
+	for (size_t i = 0; i < keylen; i++)
+	{
+		hash ^= (unsigned char)(key[i] | 0x20);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+int dbindex_add(dbindex_t *index, const buffer_t *storage, const char *key, size_t keylen, const char *value, size_t valuelen)
+{
+	if (index->count == index->size)
+	{
+		int size = (index->size > 0)? index->size * 2 : DBINDEX_CHUNK;
+		dbfield_t *fields = vrealloc(index->fields, size * sizeof(*fields));
+		if (fields == NULL)
+			return -1;
+		index->fields = fields;
+		index->size = size;
+	}
+	while (*key == ' ')
+	{
+		key++;
+		keylen--;
+	}
+	while (keylen > 0 && key[keylen - 1] == ' ')
+		keylen--;
+	index->storage = storage;
+	dbfield_t *field = &index->fields[index->count];
+	field->hash = dbindex_hash(key, keylen);
+	field->key.offset = key - storage->data;
+	field->key.length = keylen;
+	field->value.offset = value - storage->data;
+	field->value.length = valuelen;
+	buffer_dbg("index \t%.*s\t%.*s", (int)keylen, key, (int)valuelen, value);
+	return index->count++;
+}
+
+int dbindex_find(const dbindex_t *index, unsigned int hash, const char *key, size_t keylen)
+{
+	for (int i = 0; i < index->count; i++)
+	{
+		const dbfield_t *field = &index->fields[i];
+		if (field->hash == hash && field->key.length == keylen &&
+			!strncasecmp(index->storage->data + field->key.offset, key, keylen))
+			return i;
+	}
+	return EREJECT;
+}
+
+int dbindex_findlast(const dbindex_t *index, unsigned int hash, const char *key, size_t keylen)
+{
+	for (int i = index->count - 1; i >= 0; i--)
+	{
+		const dbfield_t *field = &index->fields[i];
+		if (field->hash == hash && field->key.length == keylen &&
+			!strncasecmp(index->storage->data + field->key.offset, key, keylen))
+			return i;
+	}
+	return EREJECT;
+}
+
+ssize_t dbindex_value(const dbindex_t *index, int id, const char **value)
+{
+	if (id < 0 || id >= index->count)
+		return EREJECT;
+	if (value != NULL)
+		*value = index->storage->data + index->fields[id].value.offset;
+	return index->fields[id].value.length;
+}
+
+ssize_t dbindex_search(const dbindex_t *index, const char *key, const char **value)
+{
+	if (value != NULL)
+		*value = NULL;
+	if (index->count == 0)
+		return EREJECT;
+	size_t keylen = strlen(key);
+	int id = dbindex_find(index, dbindex_hash(key, keylen), key, keylen);
+	return dbindex_value(index, id, value);
+}
+
+void dbindex_reset(dbindex_t *index)
+{
+	index->count = 0;
+}
+
+void dbindex_destroy(dbindex_t *index)
+{
+	if (index->fields != NULL)
+		vfree(index->fields);
+	index->fields = NULL;
+	index->count = 0;
+	index->size = 0;
+}
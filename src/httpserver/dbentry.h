@@ -29,6 +29,7 @@
 #define DBENTRY_H
 
 typedef struct dbentry_s dbentry_t;
+typedef struct dbindex_s dbindex_t;
 
 #include "_buffer.h"
 
@@ -51,4 +52,41 @@ void dbentry_destroy(dbentry_t *entry);
 void dbentry_revert(dbentry_t *constentry, char separator, char fieldsep);
 dbentry_t *dbentry_get(dbentry_t *entry, const char *key);
 
+/**
+ * flat index of fields stored inside a buffer.
+ * The fields are kept in an array in the order of insertion, and each
+ * field carries the case insensitive hash of its key. The lookup compares
+ * the hash and the length before to compare the strings.
+ */
+typedef struct dbfield_s dbfield_t;
+struct dbfield_s
+{
+	unsigned int hash;
+	struct{
+		size_t offset;
+		size_t length;
+	} key;
+	struct{
+		size_t offset;
+		size_t length;
+	} value;
+};
+
+struct dbindex_s
+{
+	const buffer_t *storage;
+	dbfield_t *fields;
+	int count;
+	int size;
+};
+
+unsigned int dbindex_hash(const char *key, size_t keylen);
+int dbindex_add(dbindex_t *index, const buffer_t *storage, const char *key, size_t keylen, const char *value, size_t valuelen);
+int dbindex_find(const dbindex_t *index, unsigned int hash, const char *key, size_t keylen);
+int dbindex_findlast(const dbindex_t *index, unsigned int hash, const char *key, size_t keylen);
+ssize_t dbindex_value(const dbindex_t *index, int id, const char **value);
+ssize_t dbindex_search(const dbindex_t *index, const char *key, const char **value);
+void dbindex_reset(dbindex_t *index);
+void dbindex_destroy(dbindex_t *index);
+
 #endif
@@ -0,0 +1,592 @@
+/*****************************************************************************
+ * httpcache.c: in-memory cache of the responses
+ * this file is part of https://github.com/ouistiti-project/libhttpserver
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "valloc.h"
+#include "ouistiti/log.h"
+#include "ouistiti/httpserver.h"
+#include "_httpserver.h"
+#include "_httpmessage.h"
+#include "_httpcache.h"
+#include "_buffer.h"
+#include "dbentry.h"
+
+#define cache_dbg(...)
+
+#define HTTPCACHE_BUCKETS 64
+#define HTTPCACHE_KEYMAX 512
+
+static const char str_cache[] = "cache";
+static const char str_cachecontrol[] = "Cache-Control";
+static const char str_authorization[] = "Authorization";
+
+/**
+ * the stored response is the status line, the header and the content
+ * as they were sent. The entry, its key and its data are allocated
+ * together.
+ */
+struct http_cache_entry_s
+{
+	http_cache_t *cache;
+	unsigned int hash;
+	const char *key;
+	size_t keylen;
+	char *data;
+	size_t length;
+	size_t header; /**the length of the status line and the header into data*/
+	time_t expire;
+	int ref; /**the responses which send the entry*/
+	int stored; /**the entry is available into the cache*/
+	http_cache_entry_t *next; /**the next entry of the bucket*/
+	http_cache_entry_t *older;
+	http_cache_entry_t *newer;
+};
+
+struct http_cache_s
+{
+	size_t size;
+	size_t used;
+	int ttl;
+	const char *headers; /**the names of the headers of the key, the last one is empty*/
+	http_cache_entry_t *buckets[HTTPCACHE_BUCKETS];
+	http_cache_entry_t *newest;
+	http_cache_entry_t *oldest;
+	http_cache_capture_t *flights; /**the responses in generation*/
+#ifdef USE_PTHREAD
+	pthread_mutex_t mutex;
+#endif
+};
+
+/**
+ * the response of a missed request is copied into a new entry
+ * while it is sent. The first one for a key is a flight, the same
+ * requests of the other clients wait its end.
+ */
+typedef struct http_cache_waiter_s http_cache_waiter_t;
+struct http_cache_waiter_s
+{
+	http_message_pending_t *pending;
+	http_cache_waiter_t *next;
+};
+
+struct http_cache_capture_s
+{
+	http_cache_t *cache;
+	http_cache_entry_t *entry;
+	http_cache_waiter_t *waiters; /**the identical requests received during the generation*/
+	http_cache_capture_t *next; /**the next response of the flights*/
+	unsigned int hash;
+	int keepalive;
+	size_t size; /**the length of the header and the content*/
+	size_t length; /**the length already copied*/
+	size_t keylen;
+	char key[];
+};
+
+#ifdef USE_PTHREAD
+# define _httpcache_lock(cache) pthread_mutex_lock(&(cache)->mutex)
+# define _httpcache_unlock(cache) pthread_mutex_unlock(&(cache)->mutex)
+#else
+# define _httpcache_lock(cache)
+# define _httpcache_unlock(cache)
+#endif
+
+static time_t _httpcache_now(void)
+{
+	struct timespec now = {0};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static size_t _httpcache_footprint(const http_cache_entry_t *entry)
+{
+	return sizeof(*entry) + entry->keylen + entry->length;
+}
+
+/**
+ * the directives of Cache-Control are compared without the values
+ */
+static int _httpcache_directive(const char *value, size_t valuelen, const char *directive)
+{
+	size_t length = strlen(directive);
+	for (size_t i = 0; i + length <= valuelen; i++)
+	{
+		if ((i == 0 || value[i - 1] == ' ' || value[i - 1] == ',') &&
+			!strncasecmp(value + i, directive, length) &&
+			(i + length == valuelen || value[i + length] == ',' ||
+			value[i + length] == ' ' || value[i + length] == '='))
+			return 1;
+	}
+	return 0;
+}
+
+static int _httpcache_keyappend(char *key, size_t *keylen, const char *data, size_t length)
+{
+	if (*keylen + length > HTTPCACHE_KEYMAX)
+		return EREJECT;
+	memcpy(key + *keylen, data, length);
+	*keylen += length;
+	return ESUCCESS;
+}
+
+/**
+ * the key is the method, the host, the URI with the query, the version
+ * and the persistence of the connection (both are into the stored header)
+ * and the values of the selected headers.
+ * The requests with credentials are not cached, except if the
+ * header is selected.
+ */
+static int _httpcache_key(const http_cache_t *cache, http_message_t *request, http_message_t *response, char *key, size_t *keylen)
+{
+	if (request->method == NULL ||
+		(request->method->id != MESSAGE_TYPE_GET && request->method->id != MESSAGE_TYPE_HEAD) ||
+		response->version < HTTP10 || request->uri == NULL)
+		return EREJECT;
+
+	int authorization = (_httpmessage_searchheader(request, str_authorization, NULL) != EREJECT);
+	int cookie = (_httpmessage_headervalue(request, HEADER_COOKIE, NULL) != EREJECT);
+
+	const char *value = NULL;
+	ssize_t valuelen = _httpmessage_headervalue(request, HEADER_HOST, &value);
+	char flags[] = {' ', '0' + response->version, (response->mode & HTTPMESSAGE_KEEPALIVE)? 'k': 'c'};
+	int ret = _httpcache_keyappend(key, keylen, request->method->key.data, request->method->key.length);
+	if (ret == ESUCCESS)
+		ret = _httpcache_keyappend(key, keylen, " ", 1);
+	if (ret == ESUCCESS && valuelen > 0)
+		ret = _httpcache_keyappend(key, keylen, value, valuelen);
+	if (ret == ESUCCESS)
+		ret = _httpcache_keyappend(key, keylen, _buffer_get(request->uri, 0), _buffer_length(request->uri));
+	if (ret == ESUCCESS && request->query_storage != NULL && _buffer_length(request->query_storage) > 0)
+	{
+		ret = _httpcache_keyappend(key, keylen, "?", 1);
+		if (ret == ESUCCESS)
+			ret = _httpcache_keyappend(key, keylen, _buffer_get(request->query_storage, 0), _buffer_length(request->query_storage));
+	}
+	if (ret == ESUCCESS)
+		ret = _httpcache_keyappend(key, keylen, flags, sizeof(flags));
+	for (const char *header = cache->headers; ret == ESUCCESS && *header != '\0'; header += strlen(header) + 1)
+	{
+		if (!strcasecmp(header, str_authorization))
+			authorization = 0;
+		else if (!strcasecmp(header, str_cookie))
+			cookie = 0;
+		valuelen = _httpmessage_searchheader(request, header, &value);
+		ret = _httpcache_keyappend(key, keylen, "\n", 1);
+		if (ret == ESUCCESS && valuelen > 0)
+			ret = _httpcache_keyappend(key, keylen, value, valuelen);
+	}
+	if (authorization || cookie)
+		ret = EREJECT;
+	return ret;
+}
+
+static void _httpcache_unlink(http_cache_t *cache, http_cache_entry_t *entry)
+{
+	http_cache_entry_t **it = &cache->buckets[entry->hash % HTTPCACHE_BUCKETS];
+	while (*it != NULL && *it != entry)
+		it = &(*it)->next;
+	if (*it != NULL)
+		*it = entry->next;
+	if (entry->older)
+		entry->older->newer = entry->newer;
+	else
+		cache->oldest = entry->newer;
+	if (entry->newer)
+		entry->newer->older = entry->older;
+	else
+		cache->newest = entry->older;
+	entry->next = entry->older = entry->newer = NULL;
+	cache->used -= _httpcache_footprint(entry);
+	entry->stored = 0;
+	/// the responses which send the entry free it at the end
+	if (entry->ref == 0)
+		vfree(entry);
+}
+
+static void _httpcache_link(http_cache_t *cache, http_cache_entry_t *entry)
+{
+	http_cache_entry_t **bucket = &cache->buckets[entry->hash % HTTPCACHE_BUCKETS];
+	entry->next = *bucket;
+	*bucket = entry;
+	entry->older = cache->newest;
+	entry->newer = NULL;
+	if (cache->newest)
+		cache->newest->newer = entry;
+	else
+		cache->oldest = entry;
+	cache->newest = entry;
+	cache->used += _httpcache_footprint(entry);
+	entry->stored = 1;
+}
+
+static http_cache_entry_t *_httpcache_find(http_cache_t *cache, unsigned int hash, const char *key, size_t keylen)
+{
+	http_cache_entry_t *entry = cache->buckets[hash % HTTPCACHE_BUCKETS];
+	while (entry != NULL &&
+		(entry->hash != hash || entry->keylen != keylen || memcmp(entry->key, key, keylen)))
+		entry = entry->next;
+	return entry;
+}
+
+/**
+ * the cache must be locked
+ */
+static http_cache_entry_t *_httpcache_lookup(http_cache_t *cache, unsigned int hash, const char *key, size_t keylen)
+{
+	http_cache_entry_t *entry = _httpcache_find(cache, hash, key, keylen);
+	if (entry != NULL && entry->expire <= _httpcache_now())
+	{
+		_httpcache_unlink(cache, entry);
+		entry = NULL;
+	}
+	else if (entry != NULL)
+	{
+		/// the entry becomes the last one to be evicted
+		if (entry->newer != NULL)
+		{
+			if (entry->older)
+				entry->older->newer = entry->newer;
+			else
+				cache->oldest = entry->newer;
+			entry->newer->older = entry->older;
+			entry->older = cache->newest;
+			entry->newer = NULL;
+			cache->newest->newer = entry;
+			cache->newest = entry;
+		}
+		entry->ref++;
+	}
+	return entry;
+}
+
+static http_cache_capture_t *_httpcache_flight(http_cache_t *cache, unsigned int hash, const char *key, size_t keylen)
+{
+	http_cache_capture_t *flight = cache->flights;
+	while (flight != NULL &&
+		(flight->hash != hash || flight->keylen != keylen || memcmp(flight->key, key, keylen)))
+		flight = flight->next;
+	return flight;
+}
+
+/**
+ * the response waits the end of the same response for another client.
+ */
+static int _httpcache_park(http_cache_capture_t *flight, http_message_t *response)
+{
+	http_cache_waiter_t *waiter = vcalloc(1, sizeof(*waiter));
+	if (waiter == NULL)
+		return EREJECT;
+	waiter->pending = httpmessage_suspend(response);
+	if (waiter->pending == NULL)
+	{
+		vfree(waiter);
+		return EREJECT;
+	}
+	waiter->next = flight->waiters;
+	flight->waiters = waiter;
+	response->parked = 1;
+	return EPENDING;
+}
+
+/**
+ * the waiters are woken up when the flight is stored or dropped,
+ * they take the entry or they call the other connectors.
+ */
+static void _httpcache_land(http_cache_capture_t *capture)
+{
+	http_cache_t *cache = capture->cache;
+	_httpcache_lock(cache);
+	http_cache_capture_t **it = &cache->flights;
+	while (*it != NULL && *it != capture)
+		it = &(*it)->next;
+	if (*it != NULL)
+		*it = capture->next;
+	http_cache_waiter_t *waiter = capture->waiters;
+	capture->waiters = NULL;
+	_httpcache_unlock(cache);
+	while (waiter != NULL)
+	{
+		http_cache_waiter_t *next = waiter->next;
+		httpmessage_resume(waiter->pending);
+		vfree(waiter);
+		waiter = next;
+	}
+}
+
+/**
+ * the stored response is sent as it is, except to the conditional and
+ * the Range requests which get a response built from it.
+ */
+static void _httpcache_hit(http_cache_entry_t *entry, http_message_t *request, http_message_t *response)
+{
+	cache_dbg("cache: hit %.*s", (int)entry->keylen, entry->key);
+	if (_httpmessage_restore(request, response, entry->data, entry->header,
+			entry->data + entry->header, entry->length - entry->header) == ESUCCESS)
+	{
+		_httpcache_release(entry);
+		return;
+	}
+	response->cached = entry;
+	response->cached_offset = 0;
+	/// the length is into the stored header, the connection stays alive
+	response->content_length = 0;
+}
+
+static int _httpcache_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	http_cache_t *cache = (http_cache_t *)arg;
+	const char *control = NULL;
+	ssize_t controllen = _httpmessage_searchheader(request, str_cachecontrol, &control);
+	if (controllen > 0 && _httpcache_directive(control, controllen, "no-store"))
+		return EREJECT;
+
+	char key[HTTPCACHE_KEYMAX];
+	size_t keylen = 0;
+	if (_httpcache_key(cache, request, response, key, &keylen) != ESUCCESS)
+		return EREJECT;
+	unsigned int hash = dbindex_hash(key, keylen);
+
+	int ret = EREJECT;
+	http_cache_entry_t *entry = NULL;
+	_httpcache_lock(cache);
+	/// no-cache requires a new response, the response of a flight is new
+	if (response->parked || controllen <= 0 || !_httpcache_directive(control, controllen, "no-cache"))
+		entry = _httpcache_lookup(cache, hash, key, keylen);
+	http_cache_capture_t *flight = NULL;
+	/// a parked response which doesn't find the entry is generated
+	if (entry == NULL && !response->parked)
+		flight = _httpcache_flight(cache, hash, key, keylen);
+	if (entry != NULL)
+		ret = ESUCCESS;
+	else if (flight != NULL)
+		ret = _httpcache_park(flight, response);
+	if (ret != EREJECT)
+	{
+		_httpcache_unlock(cache);
+		if (entry != NULL)
+			_httpcache_hit(entry, request, response);
+		return ret;
+	}
+
+	http_cache_capture_t *capture = vcalloc(1, sizeof(*capture) + keylen);
+	if (capture != NULL)
+	{
+		capture->cache = cache;
+		capture->hash = hash;
+		capture->keepalive = response->mode & HTTPMESSAGE_KEEPALIVE;
+		capture->keylen = keylen;
+		memcpy(capture->key, key, keylen);
+		response->capture = capture;
+		/// the next identical requests wait this one
+		if (_httpcache_flight(cache, hash, key, keylen) == NULL)
+		{
+			capture->next = cache->flights;
+			cache->flights = capture;
+		}
+	}
+	_httpcache_unlock(cache);
+	return EREJECT;
+}
+
+size_t _httpcache_data(const http_cache_entry_t *entry, const char **data)
+{
+	*data = entry->data;
+	return entry->length;
+}
+
+void _httpcache_release(http_cache_entry_t *entry)
+{
+#ifdef USE_PTHREAD
+	http_cache_t *cache = entry->cache;
+#endif
+	_httpcache_lock(cache);
+	entry->ref--;
+	if (entry->ref == 0 && !entry->stored)
+		vfree(entry);
+	_httpcache_unlock(cache);
+}
+
+void _httpcache_drop(http_message_t *response)
+{
+	http_cache_capture_t *capture = response->capture;
+	if (capture == NULL)
+		return;
+	response->capture = NULL;
+	_httpcache_land(capture);
+	if (capture->entry)
+		vfree(capture->entry);
+	vfree(capture);
+}
+
+/**
+ * only the complete responses "200 OK" without cookie and
+ * without restriction of Cache-Control are stored.
+ * The entry is allocated with the size of the header
+ * and the Content-Length.
+ */
+void _httpcache_header(http_message_t *request, http_message_t *response, const buffer_t *header)
+{
+	http_cache_capture_t *capture = response->capture;
+	if (capture == NULL)
+		return;
+	const char *control = NULL;
+	ssize_t controllen = _httpmessage_searchheader(response, str_cachecontrol, &control);
+	if (response->result != RESULT_200 ||
+		(response->mode & (HTTPMESSAGE_CHUNKED | HTTPMESSAGE_LOCKED)) ||
+		(response->mode & HTTPMESSAGE_KEEPALIVE) != capture->keepalive ||
+		_httpmessage_contentempty(response, 1) ||
+		_httpmessage_searchheader(response, str_setcookie, NULL) != EREJECT ||
+		(controllen > 0 && (_httpcache_directive(control, controllen, "no-store") ||
+			_httpcache_directive(control, controllen, "private"))))
+	{
+		_httpcache_drop(response);
+		return;
+	}
+	size_t size = _buffer_length(header);
+	if (request->method->id != MESSAGE_TYPE_HEAD)
+		size += response->content_length;
+	/// a large response would evict too many entries
+	if (sizeof(http_cache_entry_t) + capture->keylen + size > capture->cache->size / 4)
+	{
+		_httpcache_drop(response);
+		return;
+	}
+	http_cache_entry_t *entry = vcalloc(1, sizeof(*entry) + capture->keylen + size);
+	if (entry == NULL)
+	{
+		_httpcache_drop(response);
+		return;
+	}
+	entry->cache = capture->cache;
+	entry->hash = capture->hash;
+	char *key = (char *)(entry + 1);
+	memcpy(key, capture->key, capture->keylen);
+	entry->key = key;
+	entry->keylen = capture->keylen;
+	entry->data = key + entry->keylen;
+	entry->header = _buffer_length(header);
+	capture->entry = entry;
+	capture->size = size;
+	_httpcache_append(response, _buffer_get(header, 0), _buffer_length(header));
+}
+
+void _httpcache_append(http_message_t *response, const char *data, size_t length)
+{
+	http_cache_capture_t *capture = response->capture;
+	if (capture == NULL || capture->entry == NULL)
+		return;
+	if (capture->length + length > capture->size)
+	{
+		_httpcache_drop(response);
+		return;
+	}
+	memcpy(capture->entry->data + capture->length, data, length);
+	capture->length += length;
+}
+
+/**
+ * the entry replaces the previous one with the same key,
+ * the oldest entries are evicted to make room.
+ */
+void _httpcache_store(http_message_t *response)
+{
+	http_cache_capture_t *capture = response->capture;
+	if (capture == NULL || capture->entry == NULL || capture->length != capture->size)
+	{
+		_httpcache_drop(response);
+		return;
+	}
+	http_cache_t *cache = capture->cache;
+	http_cache_entry_t *entry = capture->entry;
+	entry->length = capture->length;
+	entry->expire = _httpcache_now() + cache->ttl;
+	capture->entry = NULL;
+
+	_httpcache_lock(cache);
+	http_cache_entry_t *previous = _httpcache_find(cache, entry->hash, entry->key, entry->keylen);
+	if (previous != NULL)
+		_httpcache_unlink(cache, previous);
+	while (cache->oldest != NULL &&
+		cache->used + _httpcache_footprint(entry) > cache->size)
+		_httpcache_unlink(cache, cache->oldest);
+	_httpcache_link(cache, entry);
+	cache_dbg("cache: store %.*s", (int)entry->keylen, entry->key);
+	_httpcache_unlock(cache);
+	/// the waiters find the entry
+	_httpcache_drop(response);
+}
+
+void _httpcache_destroy(http_cache_t *cache)
+{
+	/// the clients are closed, no response uses the entries
+	while (cache->oldest != NULL)
+		_httpcache_unlink(cache, cache->oldest);
+#ifdef USE_PTHREAD
+	pthread_mutex_destroy(&cache->mutex);
+#endif
+	vfree(cache);
+}
+
+int httpserver_addcache(http_server_t *server, size_t size, int ttl, const char *headers)
+{
+	if (server->cache != NULL)
+		return EREJECT;
+	size_t headerslen = (headers != NULL)? strlen(headers): 0;
+	http_cache_t *cache = vcalloc(1, sizeof(*cache) + headerslen + 2);
+	if (cache == NULL)
+		return EREJECT;
+	cache->size = size;
+	cache->ttl = ttl;
+	/// the names are split on the comma and the spaces are removed
+	char *names = (char *)(cache + 1);
+	size_t length = 0;
+	for (size_t i = 0; i < headerslen; i++)
+	{
+		if (headers[i] == ',' && length > 0 && names[length - 1] != '\0')
+			names[length++] = '\0';
+		else if (headers[i] != ',' && headers[i] != ' ')
+			names[length++] = headers[i];
+	}
+	if (length > 0 && names[length - 1] != '\0')
+		names[length++] = '\0';
+	names[length] = '\0';
+	cache->headers = names;
+#ifdef USE_PTHREAD
+	pthread_mutex_init(&cache->mutex, NULL);
+#endif
+	server->cache = cache;
+	httpserver_addconnector(server, _httpcache_connector, cache, CONNECTOR_DOCFILTER, str_cache);
+	return ESUCCESS;
+}
@@ -59,6 +59,10 @@
 #endif
 
 #include <netdb.h>
+#include <sys/socket.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "valloc.h"
 #include "vthread.h"
@@ -72,12 +76,27 @@
 
 #define client_dbg(...)
 
+#ifndef MAXCHUNKS_PIPELINE
+# define MAXCHUNKS_PIPELINE 4
+#endif
+#define PIPELINE_DEPTH 8
+#ifndef MAXCHUNKS_SENDHIGH
+# define MAXCHUNKS_SENDHIGH 16
+#endif
+#ifndef MAXCHUNKS_SENDLOW
+# define MAXCHUNKS_SENDLOW 4
+#endif
+
 static const char str_sockdata[] = "sockdata";
+static const char str_sockout[] = "sockout";
 static const char str_header[] = "header";
 
 static int _httpclient_thread(http_client_t *client);
 static void _httpclient_destroy(http_client_t *client);
+static void _httpclient_releaseresolver(http_client_resolver_t *resolver);
 static int _httpclient_wait(http_client_t *client, int options);
+static int _httpclient_pipeline(const http_client_t *client);
+static int _httpclient_outchunks(const http_client_t *client);
 
 http_client_t *httpclient_create(http_server_t *server, const httpclient_ops_t *fops, void *protocol)
 {
@@ -94,7 +113,23 @@ http_client_t *httpclient_create(http_server_t *server, const httpclient_ops_t *
 
 	client->client_send = client->ops->sendresp;
 	client->client_recv = client->ops->recvreq;
+	if (server)
+		client->memory.parent = &server->memory;
+	buffer_account_t *owner = _buffer_owner(&client->memory);
+#ifdef HTTPMESSAGE_ZEROCOPY
+	/// the header block is kept into the socket buffer during the parsing
+	client->sockdata = _buffer_create(str_sockdata, MAXCHUNKS_HEADER);
+#else
 	client->sockdata = _buffer_create(str_sockdata, 1);
+#endif
+	if (server && (server->config->version & HTTP_PIPELINE))
+	{
+		client->sockout = _buffer_create(str_sockout, _httpclient_outchunks(client));
+		/// the chunk is taken only while responses are gathered
+		if (client->sockout)
+			_buffer_release(client->sockout);
+	}
+	_buffer_owner(owner);
 	if (client->sockdata == NULL)
 	{
 		err("client: not enough memory");
@@ -123,14 +158,8 @@ http_client_t *httpclient_create(http_server_t *server, const httpclient_ops_t *
 #endif
 	if (server)
 	{
-		for (http_server_mod_t *mod = server->mod; mod; mod = mod->next)
-		{
-			httpclient_addmodule(client, mod);
-		}
-		for (http_connector_list_t *callback = server->callbacks; callback != NULL; callback = callback->next)
-		{
-			httpclient_addconnector(client, callback->func, callback->arg, callback->priority, callback->name);
-		}
+		/// the contexts of the modules are created before the first reception
+		_httpclient_addconnectors(client, server);
 #ifdef VTHREAD
 		vthread_attr_t attr;
 		httpclient_flag(client, 1, CLIENT_STOPPED);
@@ -200,6 +229,9 @@ static void _httpclient_destroy(http_client_t *client)
 	if (client->sockdata)
 		_buffer_destroy(client->sockdata);
 	client->sockdata = NULL;
+	if (client->sockout)
+		_buffer_destroy(client->sockout);
+	client->sockout = NULL;
 #ifdef HTTPCLIENT_DUMPSOCKET
 	if (client->dumpfd > 0)
 		close(client->dumpfd);
@@ -212,6 +244,13 @@ static void _httpclient_destroy(http_client_t *client)
 		request = next;
 	}
 	client->request_queue = NULL;
+	if (client->wakeup[0] > 0)
+	{
+		close(client->wakeup[0]);
+		close(client->wakeup[1]);
+	}
+	if (client->resolver)
+		_httpclient_releaseresolver(client->resolver);
 	vfree(client);
 }
 
@@ -245,11 +284,66 @@ void httpclient_freeconnectors(http_client_t *client)
 		callback = next;
 	}
 	client->callbacks = NULL;
+	_httpconnector_release(client->connectors);
+	client->connectors = NULL;
+}
+
+void _httpclient_addconnectors(http_client_t *client, http_server_t *server)
+{
+	_httpconnector_release(client->connectors);
+	client->connectors = _httpconnector_acquire(server->connectors);
+	client->routes = &server->routes;
+}
+
+/**
+ * the shared connectors and the connectors of the client are walked
+ * together in the order of priority. On the same priority, the shared
+ * ones are after the connectors added once the modules are running and
+ * before the connectors of the modules, as they were when they were
+ * copied into each client.
+ */
+const http_connector_list_t *_httpclient_nextconnector(http_connector_cursor_t *cursor)
+{
+	const http_connector_list_t *next = cursor->own;
+	if (cursor->shared != NULL &&
+		(next == NULL || cursor->shared->priority < next->priority ||
+		(cursor->shared->priority == next->priority && !next->ahead)))
+	{
+		next = cursor->shared;
+		cursor->shared = next->next;
+	}
+	else if (next != NULL)
+		cursor->own = next->next;
+	return next;
+}
+
+const http_connector_list_t *_httpclient_connectors(const http_client_t *client, http_connector_cursor_t *cursor)
+{
+	cursor->shared = (client->connectors != NULL)? client->connectors->first: NULL;
+	cursor->own = client->callbacks;
+	return _httpclient_nextconnector(cursor);
+}
+
+/**
+ * the modules may install the receiver of the connection,
+ * they are created before the first data is read.
+ */
+void _httpclient_startmodules(http_client_t *client, http_server_t *server)
+{
+	if ((client->state & CLIENT_MODULES) || (server == NULL))
+		return;
+	for (http_server_mod_t *mod = server->mod; mod; mod = mod->next)
+	{
+		httpclient_addmodule(client, mod);
+	}
+	httpclient_flag(client, 0, CLIENT_MODULES);
 }
 
 void httpclient_addconnector(http_client_t *client, http_connector_t func, void *funcarg, int priority, const char *name)
 {
-	_httpconnector_add(&client->callbacks, func, funcarg, priority, name);
+	http_connector_list_t *callback = _httpconnector_add(&client->callbacks, func, funcarg, priority, name);
+	if (callback != NULL)
+		callback->ahead = !!(client->state & CLIENT_MODULES);
 }
 
 int httpclient_addmodule(http_client_t *client, http_server_mod_t *mod)
@@ -397,15 +491,23 @@ int httpclient_sendrequest(http_client_t *client, http_message_t *request, http_
 		}
 		client->client_send(client->send_arg, "\r\n", 2);
 
+		/**
+		 * the header is built before the change of state,
+		 * the headers are not accepted after it
+		 */
+		if (request->header == NULL)
+			request->header = _buffer_create(str_header, MAXCHUNKS_HEADER);
+		_buffer_reset(request->header, 0);
+		_httpmessage_buildheader(request, request->header);
 		ret = EINCOMPLETE;
 		request->state = GENERATE_HEADER;
 	}
 	break;
 	case GENERATE_HEADER:
 		/**
-		 * send the header
+		 * send the header and the separator
 		 */
-		data = _httpmessage_buildheader(request);
+		data = request->header;
 		size = 0;
 		while (_buffer_length(data) > size)
 		{
@@ -424,15 +526,6 @@ int httpclient_sendrequest(http_client_t *client, http_message_t *request, http_
 			}
 		}
 
-		ret = EINCOMPLETE;
-		request->state = GENERATE_SEPARATOR;
-	break;
-	case GENERATE_SEPARATOR:
-		ret = _httpclient_wait(client, WAIT_SEND);
-		if (ret == ESUCCESS)
-		{
-			size = client->client_send(client->send_arg, "\r\n", 2);
-		}
 		ret = EINCOMPLETE;
 		request->state = GENERATE_CONTENT;
 	break;
@@ -532,6 +625,8 @@ int _httpclient_run(http_client_t *client)
 	}
 	client->send_arg = client->opsctx;
 	client->recv_arg = client->opsctx;
+	/// the buffers created during the run are accounted to the client
+	buffer_account_t *owner = _buffer_owner(&client->memory);
 
 	httpclient_flag(client, 1, CLIENT_STARTED);
 	httpclient_flag(client, 0, CLIENT_RUNNING);
@@ -548,6 +643,13 @@ int _httpclient_run(http_client_t *client)
 	}
 	do
 	{
+		/**
+		 * a forked client is alone into its process,
+		 * it sheds itself over the hard limit of the process.
+		 */
+		if (!vthread_sharedmemory(client->thread) &&
+			!(client->state & CLIENT_STOPPED) && _buffer_overlimit(&client->memory))
+			_httpclient_shed(client);
 		ret = _httpclient_thread(client);
 	} while(ret == ECONTINUE || ret == EINCOMPLETE);
 	/**
@@ -573,6 +675,7 @@ int _httpclient_run(http_client_t *client)
 		httpclient_disconnect(client);
 	}
 #endif
+	_buffer_owner(owner);
 #ifdef DEBUG
 	fflush(stderr);
 #endif
@@ -584,32 +687,248 @@ int httpclient_socket(http_client_t *client)
 	return client->sock;
 }
 
+extern ssize_t tcpserver_getname(struct sockaddr_storage *addr, socklen_t addrlen, char *buffer, size_t length, int flag);
+
+static void _httpclient_name(http_client_name_t *name, struct sockaddr_storage *addr, socklen_t addrlen, int flag)
+{
+	ssize_t length = tcpserver_getname(addr, addrlen, name->data, sizeof(name->data), flag);
+	if (length < 0)
+	{
+		name->data[0] = '\0';
+		length = 0;
+	}
+	name->length = length;
+}
+
+/**
+ * the numeric names don't change during the connection,
+ * they are rendered once for all the requests.
+ */
+void _httpclient_names(http_client_t *client)
+{
+	if (client->names)
+		return;
+	client->names = 1;
+	_httpclient_name(&client->remote_addr, &client->addr, sizeof(client->addr), 0);
+	_httpclient_name(&client->remote_port, &client->addr, sizeof(client->addr), 2);
+
+	struct sockaddr_storage sin = {0};
+	socklen_t len = sizeof(sin);
+	if (!getsockname(client->sock, (struct sockaddr *)&sin, &len))
+	{
+		_httpclient_name(&client->local_addr, &sin, len, 0);
+		_httpclient_name(&client->local_port, &sin, len, 2);
+	}
+}
+
+static void _httpclient_releaseresolver(http_client_resolver_t *resolver)
+{
+	if (__atomic_sub_fetch(&resolver->ref, 1, __ATOMIC_ACQ_REL) == 0)
+		vfree(resolver);
+}
+
+static void _httpclient_resolve(http_client_resolver_t *resolver)
+{
+	/// the client is already closed
+	if (__atomic_load_n(&resolver->ref, __ATOMIC_ACQUIRE) > 1)
+	{
+		ssize_t length = tcpserver_getname(&resolver->addr, sizeof(resolver->addr), resolver->host, sizeof(resolver->host), 1);
+		resolver->length = (length < 0)? 0: length;
+	}
+	__atomic_store_n(&resolver->done, 1, __ATOMIC_RELEASE);
+	_httpclient_releaseresolver(resolver);
+}
+
+#ifdef USE_PTHREAD
+/**
+ * the lookups of the clients of a server wait into a queue,
+ * one thread of the server resolves them one after the other.
+ */
+struct http_client_resolvers_s
+{
+	pthread_t thread;
+	int started;
+	int stop;
+	http_client_resolver_t *first;
+	http_client_resolver_t *last;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+http_client_resolvers_t *_httpclient_createresolvers(void)
+{
+	http_client_resolvers_t *resolvers = vcalloc(1, sizeof(*resolvers));
+	if (resolvers == NULL)
+		return NULL;
+	pthread_mutex_init(&resolvers->mutex, NULL);
+	pthread_cond_init(&resolvers->cond, NULL);
+	return resolvers;
+}
+
+static void *_httpclient_resolvers(void *arg)
+{
+	http_client_resolvers_t *resolvers = (http_client_resolvers_t *)arg;
+	pthread_mutex_lock(&resolvers->mutex);
+	while (!resolvers->stop)
+	{
+		http_client_resolver_t *resolver = resolvers->first;
+		if (resolver == NULL)
+		{
+			pthread_cond_wait(&resolvers->cond, &resolvers->mutex);
+			continue;
+		}
+		resolvers->first = resolver->next;
+		if (resolvers->first == NULL)
+			resolvers->last = NULL;
+		pthread_mutex_unlock(&resolvers->mutex);
+		_httpclient_resolve(resolver);
+		pthread_mutex_lock(&resolvers->mutex);
+	}
+	pthread_mutex_unlock(&resolvers->mutex);
+	return NULL;
+}
+
+/**
+ * the thread starts with the first lookup
+ */
+static int _httpclient_pushresolver(http_client_resolvers_t *resolvers, http_client_resolver_t *resolver)
+{
+	int ret = ESUCCESS;
+	pthread_mutex_lock(&resolvers->mutex);
+	if (!resolvers->started)
+	{
+		if (pthread_create(&resolvers->thread, NULL, _httpclient_resolvers, resolvers) == 0)
+			resolvers->started = 1;
+		else
+			ret = EREJECT;
+	}
+	if (ret == ESUCCESS)
+	{
+		if (resolvers->last != NULL)
+			resolvers->last->next = resolver;
+		else
+			resolvers->first = resolver;
+		resolvers->last = resolver;
+		pthread_cond_signal(&resolvers->cond);
+	}
+	pthread_mutex_unlock(&resolvers->mutex);
+	return ret;
+}
+
+void _httpclient_destroyresolvers(http_client_resolvers_t *resolvers)
+{
+	pthread_mutex_lock(&resolvers->mutex);
+	resolvers->stop = 1;
+	pthread_cond_signal(&resolvers->cond);
+	pthread_mutex_unlock(&resolvers->mutex);
+	if (resolvers->started)
+		pthread_join(resolvers->thread, NULL);
+	/// the lookups which didn't start are dropped
+	while (resolvers->first != NULL)
+	{
+		http_client_resolver_t *resolver = resolvers->first;
+		resolvers->first = resolver->next;
+		__atomic_store_n(&resolver->done, 1, __ATOMIC_RELEASE);
+		_httpclient_releaseresolver(resolver);
+	}
+	pthread_cond_destroy(&resolvers->cond);
+	pthread_mutex_destroy(&resolvers->mutex);
+	vfree(resolvers);
+}
+#endif
+
+/**
+ * the reverse lookup is slow, it starts only if a module requires it
+ * and waits the thread of the lookups of the server. The client keeps
+ * the result (even the failure) for the next requests.
+ * Without thread, the lookup blocks only the process of the client
+ * (VTHREAD_TYPE=fork) and it is done on the first request.
+ */
+static http_client_resolver_t *_httpclient_startresolver(http_client_t *client)
+{
+	http_client_resolver_t *resolver = vcalloc(1, sizeof(*resolver));
+	if (resolver == NULL)
+		return NULL;
+	memcpy(&resolver->addr, &client->addr, sizeof(resolver->addr));
+	/// one reference for the client and one for the lookup
+	resolver->ref = 2;
+#ifdef USE_PTHREAD
+	http_client_resolvers_t *resolvers = client->server->resolvers;
+	if (resolvers != NULL && _httpclient_pushresolver(resolvers, resolver) == ESUCCESS)
+		return resolver;
+	/// the loop must not wait the lookup, the name stays numeric
+	warn("client: reverse lookup without thread");
+	__atomic_store_n(&resolver->done, 1, __ATOMIC_RELEASE);
+	_httpclient_releaseresolver(resolver);
+#else
+	_httpclient_resolve(resolver);
+#endif
+	return resolver;
+}
+
+/**
+ * the numeric address is returned until the name is resolved,
+ * or if the address has no name.
+ */
+size_t _httpclient_remotehost(http_client_t *client, const char **value)
+{
+	if (client->resolver == NULL)
+		client->resolver = _httpclient_startresolver(client);
+	const http_client_resolver_t *resolver = client->resolver;
+	if (resolver != NULL && __atomic_load_n(&resolver->done, __ATOMIC_ACQUIRE) &&
+		resolver->length > 0)
+	{
+		*value = resolver->host;
+		return resolver->length;
+	}
+	_httpclient_names(client);
+	if (client->remote_addr.length > 0)
+		*value = client->remote_addr.data;
+	return client->remote_addr.length;
+}
+
 http_server_t *httpclient_server(http_client_t *client)
 {
 	return client->server;
 }
 
+static int _httpclient_routeconnector(const http_connector_list_t *callback, const http_message_t *request, uint64_t routes)
+{
+	if (callback->methods)
+	{
+		/// the methods out of the mask are never set into a route
+		if (request->method == NULL || request->method->id >= (sizeof(callback->methods) * 8) ||
+			!(callback->methods & (1U << request->method->id)))
+			return 0;
+	}
+	if (callback->prefix == NULL)
+		return 1;
+	if (callback->route > -1)
+		return (routes & ((uint64_t)1 << callback->route)) != 0;
+	/// the routes over ROUTES_MAX are not into the trie
+	return request->uri && !strncmp(_buffer_get(request->uri, 0), callback->prefix, callback->prefixlen);
+}
+
 static int _httpclient_checkconnector(http_client_t *client, http_message_t *request, http_message_t *response, int priority)
 {
 	int ret = ESUCCESS;
-	http_connector_list_t *first;
-	first = client->callbacks;
-	if (first == NULL)
+	const http_connector_list_t *first = client->callbacks;
+	const http_connector_snapshot_t *shared = client->connectors;
+	http_connector_cursor_t cursor;
+	const http_connector_list_t *callback = _httpclient_connectors(client, &cursor);
+	if (callback == NULL)
 		warn("client: no connector available");
-	for (http_connector_list_t *callback = client->callbacks; callback != NULL; callback = callback->next)
-	{
-		if (response && callback->priority == CONNECTOR_COMPLETE)
-		{
-			if (response->complete == NULL)
-				response->complete = callback;
-			else
-			{
-				callback->nextcomplete = response->complete;
-				response->complete = callback;
-			}
-		}
-	}
-	for (http_connector_list_t *callback = client->callbacks; callback != NULL; callback = callback->next)
+	uint64_t routes = 0;
+	if (client->routes != NULL && request->uri != NULL)
+		routes = _httpserver_route(client->routes, _buffer_get(request->uri, 0), _buffer_length(request->uri));
+	if (response)
+		response->complete = 1;
+	/**
+	 * the search restarts on the connector which suspended the response,
+	 * it may pass the request to the next ones.
+	 */
+	const http_connector_list_t *resume = (response)? response->resume: NULL;
+	for (; callback != NULL; callback = _httpclient_nextconnector(&cursor))
 	{
 		if (callback->func)
 		{
@@ -617,24 +936,41 @@ static int _httpclient_checkconnector(http_client_t *client, http_message_t *req
 			{
 				continue;
 			}
+			if (resume != NULL && callback != resume)
+				continue;
+			resume = NULL;
+			if (response)
+				response->resume = NULL;
+			if (!_httpclient_routeconnector(callback, request, routes))
+				continue;
 			client_dbg("client %p connector \"%s\"", client, callback->name);
-			ret = callback->func(callback->arg, request, response);
+			ret = _httpconnector_call(callback, request, response);
+			if (ret == EPENDING && response != NULL)
+			{
+				response->resume = callback;
+				break;
+			}
 			if (ret != EREJECT)
 			{
 				if (ret == ESUCCESS)
 				{
 					httpclient_flag(client, 0, CLIENT_RESPONSEREADY);
 				}
-				request->connector = callback;
+				request->connector = (void *)callback;
 				break;
 			}
 			/**
 			 * check if the connectors' list wasn't reloaded
 			 */
-			else if (first != client->callbacks)
+			else if (first != client->callbacks || shared != client->connectors)
 			{
 				first = client->callbacks;
-				callback = first;
+				shared = client->connectors;
+				/// the next connector is the first of the new lists
+				cursor.shared = (shared != NULL)? shared->first: NULL;
+				cursor.own = first;
+				if (client->routes != NULL && request->uri != NULL)
+					routes = _httpserver_route(client->routes, _buffer_get(request->uri, 0), _buffer_length(request->uri));
 				continue;
 			}
 		}
@@ -731,6 +1067,11 @@ static int _httpclient_message(http_client_t *client, http_message_t *request)
 
 static int _httpclient_changeresponsestate(http_client_t *client, http_message_t *response, int ret)
 {
+	if (ret == EPENDING && response->pending == NULL)
+	{
+		err("client: connector pending without job");
+		ret = EREJECT;
+	}
 	switch (ret)
 	{
 	case ESUCCESS:
@@ -752,6 +1093,7 @@ static int _httpclient_changeresponsestate(http_client_t *client, http_message_t
 		response->state |= PARSE_CONTINUE;
 	break;
 	case EINCOMPLETE:
+	case EPENDING:
 		response->state |= PARSE_CONTINUE;
 	break;
 	case EREJECT:
@@ -785,6 +1127,7 @@ static int _httpclient_changeresponsestate(http_client_t *client, http_message_t
  * @return ESUCCESS : the request is pushed and the response is ready.
  * ECONTINUE : the request is pushed and the response needs to be build.
  * EINCOMPLETE :  the request is not ready to be pushed.
+ * EPENDING : the connector waits the end of a job.
  */
 static int _httpclient_request(http_client_t *client, http_message_t *request)
 {
@@ -807,6 +1150,10 @@ static int _httpclient_request(http_client_t *client, http_message_t *request)
 	 * this condition is necessary for bad request parsing
 	 */
 
+	/// the messages may be used by a worker
+	if (_httpmessage_pending(response))
+		return EPENDING;
+
 	if ((response->state & PARSE_MASK) < PARSE_END)
 	{
 		if (request->connector == NULL)
@@ -842,12 +1189,177 @@ static int _httpclient_request(http_client_t *client, http_message_t *request)
 	return ret;
 }
 
+/**
+ * send the gathered responses, the rest is kept when the socket is full
+ */
+static int _httpclient_flushout(http_client_t *client)
+{
+	buffer_t *out = client->sockout;
+	if (out == NULL || out->data == NULL)
+		return ESUCCESS;
+	size_t sent = 0;
+	int size = 0;
+	while (sent < out->length)
+	{
+		size = client->client_send(client->send_arg, out->data + sent, out->length - sent);
+		if (size < 0)
+			break;
+		sent += size;
+	}
+	if (sent > 0)
+	{
+		size_t rest = out->length - sent;
+		memmove(out->data, out->data + sent, rest);
+		_buffer_reset(out, rest);
+	}
+	if (size == EINCOMPLETE)
+		return EINCOMPLETE;
+	if (size < 0)
+	{
+		err("client %p rest %lu send error %s", client, out->length, strerror(errno));
+		return EREJECT;
+	}
+	_buffer_release(out);
+	return ESUCCESS;
+}
+
+size_t _httpclient_pendingout(const http_client_t *client)
+{
+	if (client->sockout == NULL)
+		return 0;
+	return _buffer_length(client->sockout);
+}
+
+static size_t _httpclient_sendhigh(const http_client_t *client)
+{
+	if (client->server && client->server->config->sendhigh > 0)
+		return client->server->config->sendhigh;
+	return MAXCHUNKS_SENDHIGH * _buffer_chunksize(-1);
+}
+
+static size_t _httpclient_sendlow(const http_client_t *client)
+{
+	if (client->server && client->server->config->sendlow > 0)
+		return client->server->config->sendlow;
+	return MAXCHUNKS_SENDLOW * _buffer_chunksize(-1);
+}
+
+/**
+ * the output is under the high watermark before each part,
+ * it takes one more part: a header, a content with its chunk framing,
+ * or the gathered responses.
+ */
+static int _httpclient_outchunks(const http_client_t *client)
+{
+	size_t chunksize = _buffer_chunksize(-1);
+	int part = MAXCHUNKS_HEADER + 1;
+	if (part < MAXCHUNKS_CONTENT)
+		part = MAXCHUNKS_CONTENT;
+	if (part < MAXCHUNKS_PIPELINE)
+		part = MAXCHUNKS_PIPELINE;
+	return (_httpclient_sendhigh(client) + chunksize - 1) / chunksize + part + 2;
+}
+
+size_t _httpclient_sendwindow(const http_client_t *client)
+{
+	if (client->state & CLIENT_THROTTLED)
+		return 0;
+	size_t high = _httpclient_sendhigh(client);
+	size_t pending = _httpclient_pendingout(client);
+	return (high > pending)? high - pending : 0;
+}
+
+/**
+ * the connectors are not called while the output is over the high
+ * watermark, they run again when the socket drained it under the low one.
+ */
+static int _httpclient_throttled(http_client_t *client)
+{
+	size_t pending = _httpclient_pendingout(client);
+	if (pending >= _httpclient_sendhigh(client))
+		httpclient_flag(client, 0, CLIENT_THROTTLED);
+	else if (pending <= _httpclient_sendlow(client))
+		httpclient_flag(client, 1, CLIENT_THROTTLED);
+	return (client->state & CLIENT_THROTTLED)? 1 : 0;
+}
+
+/**
+ * send the output while the socket takes it,
+ * a reader stalling longer than the timeout of the client is dropped.
+ */
+static int _httpclient_drain(http_client_t *client)
+{
+	int ret = _httpclient_flushout(client);
+	if (ret != EINCOMPLETE)
+		return ret;
+	if (client->timeout <= 0)
+		return EREJECT;
+	int wait = _httpclient_wait(client, WAIT_SEND);
+	if (wait == EREJECT)
+		return EREJECT;
+	if (wait == EINCOMPLETE)
+		client->timeout--;
+	return EINCOMPLETE;
+}
+
+/**
+ * the rest refused by the socket waits into the output buffer,
+ * the next parts go behind it.
+ */
+static int _httpclient_queueout(http_client_t *client, buffer_t *buffer)
+{
+	if (client->sockout == NULL)
+		client->sockout = _buffer_create(str_sockout, _httpclient_outchunks(client));
+	buffer_t *out = client->sockout;
+	if (out == NULL || _buffer_acquire(out) != ESUCCESS ||
+		_buffer_append(out, buffer->offset, buffer->length) < 0)
+	{
+		err("client %p rest %lu out of memory", client, buffer->length);
+		return EREJECT;
+	}
+	buffer->offset += buffer->length;
+	buffer->length = 0;
+	return ESUCCESS;
+}
+
+/**
+ * a part of response is gathered while the pipelining is enabled,
+ * _httpclient_thread sends them at the end of its loop
+ */
+static int _httpclient_gatherpart(http_client_t *client, buffer_t *buffer)
+{
+	buffer_t *out = client->sockout;
+	if (_buffer_acquire(out) != ESUCCESS)
+		return EREJECT;
+	if (_buffer_length(out) + buffer->length > MAXCHUNKS_PIPELINE * _buffer_chunksize(-1) &&
+		_httpclient_flushout(client) != ESUCCESS)
+		return EREJECT;
+	if (_buffer_acquire(out) != ESUCCESS ||
+		_buffer_append(out, buffer->data, buffer->length) < 0)
+		return EREJECT;
+	buffer->offset = buffer->data + buffer->length;
+	buffer->length = 0;
+	return ESUCCESS;
+}
+
 static int _httpclient_sendpart(http_client_t *client, buffer_t *buffer)
 {
 	int ret = ECONTINUE;
-	if ((buffer != NULL) && (buffer->length > 0))
+	if ((buffer != NULL) && (buffer->length > 0) &&
+		(client->sockout != NULL) && _httpclient_pipeline(client) &&
+		(_httpclient_gatherpart(client, buffer) == ESUCCESS))
+	{
+		ret = ESUCCESS;
+	}
+	else if ((buffer != NULL) && (buffer->length > 0))
 	{
 		buffer->offset = buffer->data;
+		/// the gathered parts go before this one
+		ret = _httpclient_flushout(client);
+		if (ret == EINCOMPLETE)
+			return (_httpclient_queueout(client, buffer) == ESUCCESS)? EINCOMPLETE: EREJECT;
+		if (ret != ESUCCESS)
+			return ret;
 		int size = 0;
 
 		while (buffer->length > 0)
@@ -860,7 +1372,10 @@ static int _httpclient_sendpart(http_client_t *client, buffer_t *buffer)
 		}
 		if (size == EINCOMPLETE)
 		{
+			/// the socket is full, the producer is slowed down by the watermarks
 			ret = EINCOMPLETE;
+			if (_httpclient_queueout(client, buffer) != ESUCCESS)
+				ret = EREJECT;
 		}
 		else if (size < 0)
 		{
@@ -880,6 +1395,53 @@ static int _httpclient_sendpart(http_client_t *client, buffer_t *buffer)
 	return ret;
 }
 
+static int _httpclient_sendraw(http_client_t *client, const char *data, size_t length)
+{
+	buffer_t buffer = {.name = "chunk", .data = (char *)data, .size = length + 1, .length = length};
+	return _httpclient_sendpart(client, &buffer);
+}
+
+static const char str_lastchunk[] = "0\r\n\r\n";
+
+/**
+ * the chunk framing is written around the content to be sent
+ * with it in one call. The last chunk follows the last part of
+ * the content.
+ */
+static int _httpclient_sendchunk(http_client_t *client, http_message_t *response, buffer_t *content, int last)
+{
+	size_t length = (content != NULL)? _buffer_length(content) : 0;
+	int ret = ESUCCESS;
+	if (length > 0)
+	{
+		char size[20];
+		int sizelen = snprintf(size, sizeof(size), "%zx\r\n", length);
+		if (_buffer_extend(content, sizelen + 2 + sizeof(str_lastchunk)) == ESUCCESS)
+		{
+			_buffer_prepend(content, size, sizelen);
+			_buffer_append(content, "\r\n", 2);
+			if (last)
+			{
+				_buffer_append(content, STRING_REF(str_lastchunk));
+				response->mode |= HTTPMESSAGE_LASTCHUNK;
+			}
+			return _httpclient_sendpart(client, content);
+		}
+		/// the content buffer is full, the framing is sent apart
+		ret = _httpclient_sendraw(client, size, sizelen);
+		if (ret != EREJECT)
+			ret = _httpclient_sendpart(client, content);
+		if (ret != EREJECT)
+			ret = _httpclient_sendraw(client, "\r\n", 2);
+	}
+	if (last && ret != EREJECT)
+	{
+		ret = _httpclient_sendraw(client, STRING_REF(str_lastchunk));
+		response->mode |= HTTPMESSAGE_LASTCHUNK;
+	}
+	return ret;
+}
+
 /**
  * @brief This function build and send the response of the request
  *
@@ -906,7 +1468,7 @@ static int _httpclient_response_generate_error(http_client_t *client, http_messa
 	else
 	{
 		if (response->header == NULL)
-			response->header = _buffer_create(str_header, MAXCHUNKS_HEADER);
+			response->header = _buffer_create(str_header, MAXCHUNKS_HEADER + 1);
 		buffer_t *buffer = response->header;
 		_httpmessage_buildresponse(response,response->version, buffer);
 		ret = EINCOMPLETE;
@@ -914,18 +1476,49 @@ static int _httpclient_response_generate_error(http_client_t *client, http_messa
 	response->state &= ~PARSE_CONTINUE;
 	return ret;
 }
+#ifdef HTTPCACHE
+/**
+ * the stored response is sent as it is, the header is not generated.
+ */
+static int _httpclient_response_generate_cached(http_client_t *client, http_message_t *response)
+{
+	const char *data = NULL;
+	size_t length = _httpcache_data(response->cached, &data);
+	size_t rest = length - response->cached_offset;
+	/// the stored response goes to the output by parts under the high watermark
+	size_t window = _httpclient_sendwindow(client);
+	if (rest > window)
+		rest = window;
+	buffer_t buffer = {.name = "cache", .data = (char *)data + response->cached_offset, .size = rest + 1, .length = rest};
+	if (rest > 0 && _httpclient_sendpart(client, &buffer) == EREJECT)
+		return EREJECT;
+	response->cached_offset += rest - buffer.length;
+	if (response->cached_offset == length)
+		_httpmessage_changestate(response, GENERATE_END);
+	return ECONTINUE;
+}
+#endif
+
 static int _httpclient_response_generate_init(http_client_t *client, http_message_t *request, http_message_t *response)
 {
 	int ret = ECONTINUE;
+#ifdef HTTPCACHE
+	if (response->cached != NULL)
+		return _httpclient_response_generate_cached(client, response);
+#endif
 	if (response->version == HTTP09)
 		_httpmessage_changestate(response, GENERATE_CONTENT);
 	else
 	{
 		if (response->header == NULL)
-			response->header = _buffer_create(str_header, MAXCHUNKS_HEADER);
+			response->header = _buffer_create(str_header, MAXCHUNKS_HEADER + 1);
 		buffer_t *buffer = response->header;
 		if ((response->state & PARSE_MASK) >= PARSE_POSTHEADER)
 		{
+			/// the response to a conditional request may be "304 Not Modified"
+			_httpmessage_conditional(request, response);
+			/// or "206 Partial Content" to a Range request
+			_httpmessage_partial(request, response);
 			_httpmessage_buildresponse(response,response->version, buffer);
 			ret = EINCOMPLETE;
 		}
@@ -935,42 +1528,39 @@ static int _httpclient_response_generate_init(http_client_t *client, http_messag
 
 static int _httpclient_response_generate_result(http_client_t *client, http_message_t *request, http_message_t *response)
 {
-	int ret = ESUCCESS;
-	int sent;
+	int ret = EINCOMPLETE;
 	/**
-	 * here, it is the call to the sendresp callback from the
-	 * server configuration.
-	 * see http_server_config_t and httpserver_create
+	 * for error the content must be set before the header
+	 * generation to set the ContentLength
 	 */
-	sent = _httpclient_sendpart(client, response->header);
-	if (sent == EREJECT)
-	{
-		ret = EREJECT;
+	if ((response->result >= 299) && (response->result != RESULT_304) &&
+		(response->content == NULL))
+	{
+		char value[_HTTPMESSAGE_RESULT_MAXLEN];
+		size_t valuelen = _httpmessage_status(response, value, _HTTPMESSAGE_RESULT_MAXLEN);
+		if (valuelen > 0)
+			httpmessage_addcontent(response, "text/plain", value, valuelen);
+		if (httpmessage_appendcontent(response, "\r\n", 2) != 2)
+			ret = EREJECT;
 	}
-	else if (sent == ESUCCESS)
-	{
-		/**
-		 * for error the content must be set before the header
-		 * generation to set the ContentLength
-		 */
-		if ((response->result >= 299) &&
-			(response->content == NULL))
-		{
-			char value[_HTTPMESSAGE_RESULT_MAXLEN];
-			size_t valuelen = _httpmessage_status(response, value, _HTTPMESSAGE_RESULT_MAXLEN);
-			if (valuelen > 0)
-				httpmessage_addcontent(response, "text/plain", value, valuelen);
-			httpmessage_appendcontent(response, "\r\n", 2);
-		}
 
-		_httpmessage_changestate(response, GENERATE_HEADER);
-		_buffer_destroy(response->header);
-		response->header = NULL;
-		int state = request->response->state;
-		_httpmessage_buildheader(response);
-		request->response->state = state;
-		ret = EINCOMPLETE;
-	}
+	/**
+	 * the status line, the headers and the separator
+	 * are sent together from the header buffer.
+	 */
+#ifdef HTTPENCODING
+	_httpencoding_header(request, response);
+#endif
+	if (!request->method || request->method->id != MESSAGE_TYPE_HEAD)
+		_httpmessage_chunkencoding(response);
+	int state = request->response->state;
+	if (_httpmessage_buildheader(response, response->header) != ESUCCESS)
+		ret = EREJECT;
+#ifdef HTTPCACHE
+	_httpcache_header(request, response, response->header);
+#endif
+	request->response->state = state;
+	_httpmessage_changestate(response, GENERATE_HEADER);
 	return ret;
 }
 
@@ -978,9 +1568,19 @@ static int _httpclient_response_generate_header(http_client_t *client, http_mess
 {
 	int ret = ESUCCESS;
 	int sent;
-	sent = _httpclient_sendpart(client, response->headers_storage);
-	if (sent == ESUCCESS)
+	/**
+	 * here, it is the call to the sendresp callback from the
+	 * server configuration.
+	 * see http_server_config_t and httpserver_create
+	 */
+	sent = _httpclient_sendpart(client, response->header);
+	/// the rest of the header may wait into the output of the client
+	if (sent == ESUCCESS || sent == EINCOMPLETE)
 	{
+		_buffer_destroy(response->header);
+		response->header = NULL;
+		if (client->ops->flush != NULL)
+			client->ops->flush(client->opsctx);
 		_httpmessage_changestate(response, GENERATE_SEPARATOR);
 		ret = EINCOMPLETE;
 	}
@@ -992,24 +1592,13 @@ static int _httpclient_response_generate_header(http_client_t *client, http_mess
 static int _httpclient_response_generate_separator(http_client_t *client, http_message_t *request, http_message_t *response)
 {
 	int ret = ESUCCESS;
-	int size;
-	size = client->client_send(client->send_arg, "\r\n", 2);
-	if (size < 0)
-	{
-		err("client %p SEPARATOR send error %s", client, strerror(errno));
-		ret = EREJECT;
-		return ret;
-	}
-	if (client->ops->flush != NULL)
-		client->ops->flush(client->opsctx);
 	/// Head method requires only the header
 	if (request->method && request->method->id == MESSAGE_TYPE_HEAD)
 	{
-		if (response->content != NULL)
-		{
+		/// the content may be the storage of the message, it is released with the message
+		if ((response->content != NULL) && (response->content != response->content_storage))
 			_buffer_destroy(response->content);
-			response->content = NULL;
-		}
+		response->content = NULL;
 		response->state &= ~PARSE_CONTINUE;
 	}
 	if (response->content != NULL)
@@ -1021,9 +1610,21 @@ static int _httpclient_response_generate_separator(http_client_t *client, http_m
 		 * The next loop may append data into the content, but
 		 * the first part has to be already sent
 		 */
-		if (_httpmessage_contentempty(response, 1))
+		if (!_httpmessage_contentempty(response, 1))
 			response->content_length -= contentlength;
-		sent = _httpclient_sendpart(client, response->content);
+#ifdef HTTPCACHE
+		_httpcache_append(response, _buffer_get(response->content, 0), contentlength);
+#endif
+		buffer_t *content = response->content;
+#ifdef HTTPENCODING
+		content = _httpencoding_content(response, content);
+		if (content == NULL)
+			return EREJECT;
+#endif
+		if (response->mode & HTTPMESSAGE_CHUNKED)
+			sent = _httpclient_sendchunk(client, response, content, 0);
+		else
+			sent = _httpclient_sendpart(client, content);
 		if (sent == EREJECT)
 		{
 			ret = EREJECT;
@@ -1072,9 +1673,26 @@ static int _httpclient_response_generate_content(http_client_t *client, http_mes
 				(response->content_length < contentlength)?
 				response->content_length : contentlength;
 		}
-		sent = _httpclient_sendpart(client, response->content);
+		int last = _httpmessage_state(response, PARSE_END);
+#ifdef HTTPCACHE
+		_httpcache_append(response, _buffer_get(response->content, 0), contentlength);
+#endif
+		buffer_t *content = response->content;
+		int lastchunk = last;
+#ifdef HTTPENCODING
+		content = _httpencoding_content(response, content);
+		if (content == NULL)
+			return EREJECT;
+		/// the end of the compressed stream goes before the last chunk
+		if (response->encoding != NULL)
+			lastchunk = 0;
+#endif
+		if (response->mode & HTTPMESSAGE_CHUNKED)
+			sent = _httpclient_sendchunk(client, response, content, lastchunk);
+		else
+			sent = _httpclient_sendpart(client, content);
 		ret = ECONTINUE;
-		if (_httpmessage_state(response, PARSE_END))
+		if (last)
 			_httpmessage_changestate(response, GENERATE_END);
 		if (sent == EREJECT)
 			ret = EREJECT;
@@ -1101,10 +1719,33 @@ static int _httpclient_response_generate_content(http_client_t *client, http_mes
 
 static int _httpclient_response_generate_end(http_client_t *client, http_message_t *request, http_message_t *response)
 {
+#ifdef HTTPENCODING
+	buffer_t *trailer = _httpencoding_finish(response);
+	if (trailer != NULL)
+	{
+		int sent;
+		if (response->mode & HTTPMESSAGE_CHUNKED)
+			sent = _httpclient_sendchunk(client, response, trailer, 1);
+		else
+			sent = _httpclient_sendpart(client, trailer);
+		if (sent == EREJECT)
+			return EREJECT;
+	}
+#endif
+	if ((response->mode & HTTPMESSAGE_CHUNKED) &&
+		!(response->mode & HTTPMESSAGE_LASTCHUNK))
+	{
+		response->mode |= HTTPMESSAGE_LASTCHUNK;
+		if (_httpclient_sendraw(client, STRING_REF(str_lastchunk)) == EREJECT)
+			return EREJECT;
+	}
 	if (response->content != NULL && response->content->length > 0)
 	{
 		_buffer_shrink(response->content);
 	}
+#ifdef HTTPCACHE
+	_httpcache_store(response);
+#endif
 	const http_connector_list_t *callback = request->connector;
 	const char *name = "server";
 	if (callback)
@@ -1177,6 +1818,78 @@ int httpclient_wait(http_client_t *client, int options)
 	return ret;
 }
 
+/**
+ * the socket pair is created on the first suspended response.
+ * The jobs write on the second socket.
+ */
+int _httpclient_wakeup(http_client_t *client)
+{
+	if (client->wakeup[0] > 0)
+		return client->wakeup[1];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, client->wakeup) < 0)
+	{
+		err("client: wake up error %s", strerror(errno));
+		client->wakeup[0] = 0;
+		return EREJECT;
+	}
+	fcntl(client->wakeup[0], F_SETFL, fcntl(client->wakeup[0], F_GETFL) | O_NONBLOCK);
+	return client->wakeup[1];
+}
+
+/**
+ * @return the socket to wait for the first response of the queue
+ * or -1 if the response is not suspended.
+ */
+int _httpclient_pending(const http_client_t *client)
+{
+	const http_message_t *request = client->request_queue;
+	if (request == NULL || request->response == NULL ||
+		!_httpmessage_suspended(request->response))
+		return -1;
+	return client->wakeup[0];
+}
+
+/**
+ * @brief This function waits the end of the job of a suspended response.
+ *
+ * The client socket is watched too, to stop on the closing of the connection.
+ *
+ * @return ECONTINUE : the response may be resumed.
+ * ESUCCESS : data are available on the socket.
+ */
+static int _httpclient_waitpending(http_client_t *client)
+{
+	int fd = _httpclient_pending(client);
+	if (fd < 0)
+		return ECONTINUE;
+#ifdef VTHREAD
+	int timeout = WAIT_TIMER * 1000;
+#else
+	/// the server polls the socket pair
+	int timeout = 0;
+#endif
+	int sock = (_buffer_empty(client->sockdata))? client->sock: -1;
+	int ret = ECONTINUE;
+#ifdef USE_POLL
+	struct pollfd poll_set[2] = {{.fd = fd, .events = POLLIN}, {.fd = sock, .events = POLLIN}};
+	if (poll(poll_set, 2, timeout) > 0 && poll_set[1].revents)
+		ret = ESUCCESS;
+#else
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	if (sock > 0)
+		FD_SET(sock, &fds);
+	struct timeval tv = {.tv_sec = timeout / 1000};
+	if (select(((fd > sock)? fd: sock) + 1, &fds, NULL, NULL, &tv) > 0 &&
+		sock > 0 && FD_ISSET(sock, &fds))
+		ret = ESUCCESS;
+#endif
+	char drain[8];
+	while (recv(fd, drain, sizeof(drain), MSG_DONTWAIT) > 0);
+	return ret;
+}
+
 int _httpclient_geterror(http_client_t *client)
 {
 	if (client->request == NULL)
@@ -1214,6 +1927,57 @@ int _httpclient_isalive(http_client_t *client)
 	return ESUCCESS;
 }
 
+/**
+ * over the memory hard limit, the client is closed by its own thread
+ * after the answer to its current request.
+ */
+void _httpclient_shed(http_client_t *client)
+{
+	httpclient_flag(client, 0, CLIENT_SHED | CLIENT_STOPPED);
+}
+
+static const char str_shedheader[] = "Content-Length: 0\r\nConnection: Close\r\n\r\n";
+
+/**
+ * the current request receives 413 while its content is receiving,
+ * 503 otherwise. Nothing is sent if its response is already sending.
+ */
+static int _httpclient_shedresponse(http_client_t *client)
+{
+	http_message_t *request = client->request_queue;
+	if (request == NULL)
+		return ESUCCESS;
+	if ((request->response != NULL) &&
+		((request->response->state & GENERATE_MASK) >= GENERATE_SEPARATOR))
+		return ESUCCESS;
+	int version = request->version;
+	/// the request line is not complete
+	if (version < 0)
+		version = client->server->config->version & HTTPVERSION_MASK;
+	if (version == HTTP09)
+		return ESUCCESS;
+	if (version > HTTP11)
+		version = HTTP11;
+	int result = RESULT_503;
+#ifdef RESULT_413
+	int parse = request->state & PARSE_MASK;
+	if ((parse >= PARSE_PRECONTENT) && (parse < PARSE_END))
+		result = RESULT_413;
+#endif
+	const _http_message_result_t *status = _httpmessage_result(result);
+	if (status == NULL)
+		return EREJECT;
+	char response[96];
+	size_t length = _string_length(&status->line[version]);
+	if (length + sizeof(str_shedheader) > sizeof(response))
+		return EREJECT;
+	memcpy(response, _string_get(&status->line[version]), length);
+	memcpy(response + length, str_shedheader, sizeof(str_shedheader) - 1);
+	length += sizeof(str_shedheader) - 1;
+	warn("client: %p shed with %d", client, result);
+	return _httpclient_sendraw(client, response, length);
+}
+
 static int _httpclient_thread_statemachine(http_client_t *client)
 {
 	int ret = ECONTINUE;
@@ -1228,6 +1992,12 @@ static int _httpclient_thread_statemachine(http_client_t *client)
 		case CLIENT_WAITING:
 		{
 			ret = ESUCCESS;
+			/**
+			 * an idle client gives back its socket buffer
+			 * while it waits the next request.
+			 */
+			if (client->request == NULL && client->request_queue == NULL)
+				_buffer_release(client->sockdata);
 			if (_buffer_empty(client->sockdata))
 				ret = _httpclient_wait(client, wait_option);
 			/// timeout on socket
@@ -1254,11 +2024,29 @@ static int _httpclient_thread_statemachine(http_client_t *client)
 				ret = client->ops->status(client->opsctx);
 		}
 		break;
+		case CLIENT_PENDING:
+		{
+			ret = _httpclient_waitpending(client);
+			/// the end of the loop suspends the client again if it is useful
+			httpclient_state(client, CLIENT_WAITING);
+		}
+		break;
 		case CLIENT_EXIT:
 		{
+			if (client->state & CLIENT_SHED)
+			{
+				httpclient_flag(client, 1, CLIENT_SHED);
+				_httpclient_shedresponse(client);
+			}
 			/**
-			 * flush the output socket
+			 * flush the output socket,
+			 * the closing waits that the reader takes the rest
 			 */
+			if (_httpclient_drain(client) == EINCOMPLETE)
+			{
+				ret = ECONTINUE;
+				break;
+			}
 			if (client->ops->flush != NULL)
 				client->ops->flush(client->opsctx);
 
@@ -1287,14 +2075,38 @@ static int _httpclient_thread_receive(http_client_t *client)
 
 	int size;
 
+	_httpclient_startmodules(client, client->server);
 	/**
 	 * here, it is the call to the recvreq callback from the
 	 * server configuration.
 	 * see http_server_config_t and httpserver_create
 	 */
-	_buffer_shrink(client->sockdata);
-	_buffer_reset(client->sockdata, _buffer_length(client->sockdata));
+	if (_buffer_acquire(client->sockdata) != ESUCCESS)
+	{
+		err("client: not enough memory");
+		httpclient_state(client, CLIENT_EXIT);
+		return ECONTINUE;
+	}
+	int pinned = 0;
+#ifdef HTTPMESSAGE_ZEROCOPY
+	/**
+	 * the request references its header lines into the buffer,
+	 * the new data is appended after them.
+	 */
+	pinned = (client->request != NULL) && _httpmessage_pinned(client->request);
+#endif
+	if (!pinned)
+	{
+		_buffer_shrink(client->sockdata);
+		_buffer_reset(client->sockdata, _buffer_length(client->sockdata));
+	}
 	size = _buffer_fill(client->sockdata, client->client_recv, client->recv_arg);
+	/**
+	 * the buffer must always be read from the beginning
+	 * or from the end of the previous data for pinned request
+	 */
+	if (!pinned)
+		client->sockdata->offset = client->sockdata->data;
 	if (size == 0 || size == EREJECT)
 	{
 		/**
@@ -1310,15 +2122,10 @@ static int _httpclient_thread_receive(http_client_t *client)
 	}
 	else
 	{
-		/**
-		 * the buffer must always be read from the beginning
-		 */
-		client->sockdata->offset = client->sockdata->data;
-
 		httpclient_state(client, CLIENT_READING);
 #ifdef HTTPCLIENT_DUMPSOCKET
 		if (client->dumpfd > 0)
-			write(client->dumpfd, client->sockdata->data, size);
+			write(client->dumpfd, client->sockdata->data + client->sockdata->length - size, size);
 #endif
 	}
 	return EINCOMPLETE;
@@ -1333,6 +2140,9 @@ static void _httpclient_thread_fillrequest(http_client_t *client)
 	if (client->request == NULL)
 	{
 		client->request = _httpmessage_create(client, NULL);
+#ifdef HTTPMESSAGE_ZEROCOPY
+		client->request->mode |= HTTPMESSAGE_NOCOPY;
+#endif
 		_httpclient_pushrequest(client, client->request);
 	}
 
@@ -1444,6 +2254,8 @@ static int _httpclient_thread_generateresponse(http_client_t *client, http_messa
 	int ret = ECONTINUE;
 	http_message_t *response = request->response;
 
+	if (_httpmessage_suspended(response))
+		return ret;
 	if ((response->state & GENERATE_MASK) > 0)
 	{
 		int res_ret = EINCOMPLETE;
@@ -1454,7 +2266,8 @@ static int _httpclient_thread_generateresponse(http_client_t *client, http_messa
 
 		if (res_ret == ESUCCESS)
 		{
-			if (_httpmessage_contentempty(response, 1))
+			if (_httpmessage_contentempty(response, 1) &&
+				!(response->mode & HTTPMESSAGE_CHUNKED))
 			{
 				dbg("client: disable keep alive (Content-Length is not set)");
 				httpclient_flag(client, 1, CLIENT_KEEPALIVE);
@@ -1508,6 +2321,23 @@ static int _httpclient_thread_generateresponse(http_client_t *client, http_messa
 	return ret;
 }
 
+static int _httpclient_pipeline(const http_client_t *client)
+{
+	if (client->server == NULL ||
+		!(client->server->config->version & HTTP_PIPELINE))
+		return 0;
+	int depth = client->server->config->pipeline;
+	return (depth > 0)? depth: PIPELINE_DEPTH;
+}
+
+static int _httpclient_queuelength(const http_client_t *client)
+{
+	int length = 0;
+	for (const http_message_t *it = client->request_queue; it != NULL; it = it->next)
+		length++;
+	return length;
+}
+
 /**
  * @brief This function is the manager of the client's loop.
  *
@@ -1532,10 +2362,21 @@ static int _httpclient_thread(http_client_t *client)
 	int ret = ECONTINUE;
 	ret = _httpclient_thread_statemachine(client);
 
-	if ((ret == ESUCCESS) && (client->state & CLIENT_STOPPED))
+	if ((ret == ESUCCESS) && (client->state & CLIENT_SHED))
+	{
+		/// the client shed during the waiting answers before the closing
+		httpclient_state(client, CLIENT_EXIT);
+		return ECONTINUE;
+	}
+	else if ((ret == ESUCCESS) && (client->state & CLIENT_STOPPED))
 	{
 		return ret;
 	}
+	else if ((client->state & CLIENT_MACHINEMASK) == CLIENT_EXIT)
+	{
+		/// the output is draining before the closing
+		return ECONTINUE;
+	}
 	else if ((ret == ESUCCESS) && !(client->state & CLIENT_LOCKED))
 	{
 		int ret = _httpclient_thread_receive(client);
@@ -1557,28 +2398,86 @@ static int _httpclient_thread(http_client_t *client)
 	}
 
 	/**
-	 * manage a request with the socket data
+	 * manage a request with the socket data.
+	 * With the pipelining, all the complete requests already received
+	 * are queued, up to the depth of the pipeline.
 	 */
-	if (!_buffer_empty(client->sockdata))
-	{
+	int pipeline = _httpclient_pipeline(client);
+	while (!_buffer_empty(client->sockdata))
+	{
+		if (pipeline && client->request == NULL &&
+			_httpclient_queuelength(client) >= pipeline)
+			break;
+		/// the content is not given during the job of the connector
+		if (client->request != NULL && client->request->response != NULL &&
+			_httpmessage_suspended(client->request->response))
+			break;
 		_httpclient_thread_fillrequest(client);
+		if (!pipeline || client->request != NULL)
+			break;
 	}
 
 	/**
 	 * manage the request occuring or already received
-	 * the socket data may fill a new other request at the same time
+	 * the socket data may fill a new other request at the same time.
+	 * With the pipelining, the responses ready are generated in order
+	 * and sent together.
 	 */
 	ret = ECONTINUE;
+	/// the socket takes the pending output before the next call to the connector
+	if (client->state & CLIENT_THROTTLED)
+		_httpclient_flushout(client);
 	http_message_t *request = client->request_queue;
-	if (request != NULL &&
-		((request->state & PARSE_MASK) > PARSE_PRECONTENT))
+	while (request != NULL &&
+		((request->state & PARSE_MASK) > PARSE_PRECONTENT) &&
+		!_httpclient_throttled(client))
 	{
+		int state = (request->response)? request->response->state & GENERATE_MASK: 0;
 		_httpclient_thread_parserequest(client, request);
 		ret = _httpclient_thread_generateresponse(client, request);
-	}
+		if (!pipeline || (client->state & CLIENT_MACHINEMASK) == CLIENT_EXIT)
+			break;
+		/// the response is still built by the connector
+		if ((client->request_queue == request) &&
+			(!_httpmessage_state(request->response, PARSE_END) ||
+			((request->response->state & GENERATE_MASK) == state)))
+			break;
+		request = client->request_queue;
+	}
+	int flush = _httpclient_flushout(client);
+	if (flush == EREJECT)
+		httpclient_state(client, CLIENT_EXIT);
+	else if (flush == EINCOMPLETE &&
+		(client->state & CLIENT_MACHINEMASK) != CLIENT_EXIT)
+		httpclient_state(client, CLIENT_SENDING);
+	/// the first response waits a job, nothing is to do before its end
+	else if ((client->state & CLIENT_MACHINEMASK) != CLIENT_EXIT &&
+		_httpclient_pending(client) >= 0)
+		httpclient_state(client, CLIENT_PENDING);
 	return ret;
 }
 
+size_t httpclient_footprint(http_client_t *client)
+{
+	size_t size = sizeof(*client);
+	if (client->sockdata)
+		size += _buffer_footprint(client->sockdata);
+	if (client->sockout)
+		size += _buffer_footprint(client->sockout);
+	for (http_connector_list_t *it = client->callbacks; it != NULL; it = it->next)
+		size += sizeof(*it);
+	for (http_client_modctx_t *it = client->modctx; it != NULL; it = it->next)
+		size += sizeof(*it);
+	for (http_message_t *it = client->request_queue; it != NULL; it = it->next)
+		size += _httpmessage_footprint(it);
+	return size;
+}
+
+size_t httpclient_memory(http_client_t *client)
+{
+	return client->memory.used;
+}
+
 void httpclient_shutdown(http_client_t *client)
 {
 	client->ops->disconnect(client->opsctx);
@@ -1588,6 +2487,8 @@ void httpclient_shutdown(http_client_t *client)
 
 void httpclient_flush(http_client_t *client)
 {
+	/// the gathered responses go before the data sent by the connector itself
+	while (_httpclient_drain(client) == EINCOMPLETE);
 	if (client->ops->flush)
 		client->ops->flush(client->opsctx);
 }
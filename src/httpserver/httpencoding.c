@@ -0,0 +1,342 @@
+/*****************************************************************************
+ * httpencoding.c: gzip and deflate content coding of the responses
+ * this file is part of https://github.com/ouistiti-project/libhttpserver
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "valloc.h"
+#include "ouistiti/log.h"
+#include "ouistiti/httpserver.h"
+#include "_httpserver.h"
+#include "_httpmessage.h"
+#include "_httpencoding.h"
+#include "_buffer.h"
+
+#define encoding_dbg(...)
+
+#define HTTPENCODING_ETAGMAX 130
+
+/**
+ * the window and the memory of zlib are bounded for each response,
+ * deflate uses (1 << (WINDOWBITS + 2)) + (1 << (MEMLEVEL + 9)) bytes.
+ */
+#ifndef HTTPENCODING_WINDOWBITS
+# define HTTPENCODING_WINDOWBITS 12
+#endif
+#ifndef HTTPENCODING_MEMLEVEL
+# define HTTPENCODING_MEMLEVEL 5
+#endif
+
+static const char str_encoding[] = "encoding";
+static const char str_acceptencoding[] = "Accept-Encoding";
+static const char str_contentencoding[] = "Content-Encoding";
+static const char str_vary[] = "Vary";
+static const char str_etag[] = "ETag";
+static const char str_gzip[] = "gzip";
+static const char str_deflate[] = "deflate";
+
+struct http_encoding_s
+{
+	int level;
+	size_t minsize;
+};
+
+struct http_encoding_stream_s
+{
+	z_stream zstream;
+	buffer_t *out; /**the compressed part to send*/
+	int finished;
+};
+
+/**
+ * the formats already compressed are sent as they are
+ */
+static const string_t _http_encoding_compressed[] = {
+	STRING_DCL("image/"),
+	STRING_DCL("audio/"),
+	STRING_DCL("video/"),
+	STRING_DCL("font/woff"),
+	STRING_DCL("multipart/"),
+	STRING_DCL("application/octet-stream"),
+	STRING_DCL("application/zip"),
+	STRING_DCL("application/gzip"),
+	STRING_DCL("application/x-gzip"),
+	STRING_DCL("application/x-bzip2"),
+	STRING_DCL("application/x-xz"),
+	STRING_DCL("application/zstd"),
+	STRING_DCL("application/x-7z-compressed"),
+	STRING_DCL("application/vnd.rar"),
+	STRING_DCL("application/x-rar-compressed"),
+	STRING_DCL("application/pdf"),
+};
+
+static int _httpencoding_compressible(const char *type, size_t typelen)
+{
+	/// svg is a text format
+	if (typelen >= 13 && !strncasecmp(type, "image/svg+xml", 13))
+		return 1;
+	for (int i = 0; i < sizeof(_http_encoding_compressed) / sizeof(*_http_encoding_compressed); i++)
+	{
+		const string_t *compressed = &_http_encoding_compressed[i];
+		if (typelen >= compressed->length &&
+			!strncasecmp(type, compressed->data, compressed->length))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * the quality is "q=1" or "q=0.xyz", it is returned from 0 to 1000
+ */
+static int _httpencoding_qvalue(const char *value, size_t length)
+{
+	size_t i = 0;
+	int quality = 0;
+	if (i < length && value[i] == '1')
+		quality = 1000;
+	else if (i >= length || value[i] != '0')
+		return 0;
+	i++;
+	if (i < length && value[i] == '.')
+	{
+		i++;
+		for (int scale = 100; scale > 0 && i < length && value[i] >= '0' && value[i] <= '9'; i++, scale /= 10)
+			quality += (value[i] - '0') * scale;
+	}
+	return (quality > 1000)? 1000: quality;
+}
+
+/**
+ * the quality of the coding into Accept-Encoding, or the one of "*"
+ */
+static int _httpencoding_quality(const char *value, size_t length, const char *coding)
+{
+	size_t codinglen = strlen(coding);
+	int quality = -1;
+	int any = 0;
+	size_t i = 0;
+	while (i < length)
+	{
+		while (i < length && (value[i] == ' ' || value[i] == ','))
+			i++;
+		size_t start = i;
+		while (i < length && value[i] != ',' && value[i] != ';' && value[i] != ' ')
+			i++;
+		size_t tokenlen = i - start;
+		int q = 1000;
+		while (i < length && value[i] != ',')
+		{
+			if ((value[i] == 'q' || value[i] == 'Q') && i + 1 < length && value[i + 1] == '=')
+				q = _httpencoding_qvalue(value + i + 2, length - i - 2);
+			i++;
+		}
+		if (tokenlen == codinglen && !strncasecmp(value + start, coding, codinglen))
+			quality = q;
+		else if (tokenlen == 1 && value[start] == '*')
+			any = q;
+	}
+	return (quality < 0)? any: quality;
+}
+
+/**
+ * gzip is preferred to deflate with the same quality
+ */
+static const char *_httpencoding_select(http_message_t *request, int *windowbits)
+{
+	const char *value = NULL;
+	ssize_t length = _httpmessage_searchheader(request, str_acceptencoding, &value);
+	if (length <= 0)
+		return NULL;
+	int gzip = _httpencoding_quality(value, length, str_gzip);
+	int deflate = _httpencoding_quality(value, length, str_deflate);
+	if (gzip > 0 && gzip >= deflate)
+	{
+		*windowbits = HTTPENCODING_WINDOWBITS + 16;
+		return str_gzip;
+	}
+	if (deflate > 0)
+	{
+		*windowbits = HTTPENCODING_WINDOWBITS;
+		return str_deflate;
+	}
+	return NULL;
+}
+
+/**
+ * The content is compressed if the client accepts it, if the content is
+ * not already compressed and if it is large enough to gain something.
+ */
+int _httpencoding_header(http_message_t *request, http_message_t *response)
+{
+	if (response->client == NULL)
+		return EREJECT;
+	http_encoding_t *encoding = httpclient_server(response->client)->encoding;
+	if (encoding == NULL || request->method == NULL ||
+		request->method->id == MESSAGE_TYPE_HEAD ||
+		response->result != RESULT_200 ||
+		(response->mode & HTTPMESSAGE_LOCKED) ||
+		_httpmessage_headervalue(response, HEADER_CONTENTLENGTH, NULL) != EREJECT ||
+		_httpmessage_headervalue(response, HEADER_TRANSFERENCODING, NULL) != EREJECT ||
+		_httpmessage_searchheader(response, str_contentencoding, NULL) != EREJECT)
+		return EREJECT;
+	const char *type = NULL;
+	ssize_t typelen = _httpmessage_headervalue(response, HEADER_CONTENTTYPE, &type);
+	if (typelen <= 0 || !_httpencoding_compressible(type, typelen))
+		return EREJECT;
+	if (!_httpmessage_contentempty(response, 1) && response->content_length < encoding->minsize)
+		return EREJECT;
+	/// the response depends on Accept-Encoding for the other caches
+	if (_httpmessage_searchheader(response, str_vary, NULL) == EREJECT)
+		httpmessage_addheader(response, str_vary, str_acceptencoding, -1);
+	int windowbits = 0;
+	const char *coding = _httpencoding_select(request, &windowbits);
+	if (coding == NULL)
+		return EREJECT;
+
+	http_encoding_stream_t *stream = vcalloc(1, sizeof(*stream));
+	if (stream == NULL)
+		return EREJECT;
+	if (deflateInit2(&stream->zstream, encoding->level, Z_DEFLATED, windowbits,
+			HTTPENCODING_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		err("encoding: zlib initialization error");
+		vfree(stream);
+		return EREJECT;
+	}
+	stream->out = _buffer_create(str_encoding, 0);
+	if (stream->out == NULL)
+	{
+		deflateEnd(&stream->zstream);
+		vfree(stream);
+		return EREJECT;
+	}
+	response->encoding = stream;
+	httpmessage_addheader(response, str_contentencoding, coding, -1);
+	/// the ETag of the document is not the one of the compressed content
+	const char *etag = NULL;
+	ssize_t etaglen = _httpmessage_searchheader(response, str_etag, &etag);
+	char weak[HTTPENCODING_ETAGMAX];
+	if (etaglen > 0 && etag[0] == '"' && etaglen + 2 < sizeof(weak))
+	{
+		memcpy(weak, "W/", 2);
+		memcpy(weak + 2, etag, etaglen);
+		_httpmessage_replaceheader(response, str_etag, weak, etaglen + 2);
+	}
+	/// the length is known at the end of the compression
+	response->content_length = (unsigned long long)-1;
+	encoding_dbg("encoding: response %p with %s", response, coding);
+	return ESUCCESS;
+}
+
+static int _httpencoding_deflate(http_encoding_stream_t *stream, const char *data, size_t length, int flush)
+{
+	z_stream *zstream = &stream->zstream;
+	buffer_t *out = stream->out;
+	zstream->next_in = (Bytef *)data;
+	zstream->avail_in = length;
+	_buffer_reset(out, 0);
+	do
+	{
+		if (_buffer_extend(out, _buffer_chunksize(0)) != ESUCCESS)
+			return EREJECT;
+		size_t available = out->size - out->length - 1;
+		zstream->next_out = (Bytef *)out->data + out->length;
+		zstream->avail_out = available;
+		if (deflate(zstream, flush) == Z_STREAM_ERROR)
+			return EREJECT;
+		out->length += available - zstream->avail_out;
+	} while (zstream->avail_out == 0);
+	out->offset = out->data + out->length;
+	out->data[out->length] = '\0';
+	return ESUCCESS;
+}
+
+/**
+ * A streamed content is flushed at each part for the client,
+ * a complete content is compressed as a whole.
+ */
+buffer_t *_httpencoding_content(http_message_t *response, buffer_t *content)
+{
+	http_encoding_stream_t *stream = response->encoding;
+	if (stream == NULL || content == NULL)
+		return content;
+	int flush = _httpmessage_state(response, PARSE_END)? Z_NO_FLUSH: Z_SYNC_FLUSH;
+	if (_httpencoding_deflate(stream, _buffer_get(content, 0), _buffer_length(content), flush) != ESUCCESS)
+	{
+		err("encoding: compression error");
+		return NULL;
+	}
+	return stream->out;
+}
+
+buffer_t *_httpencoding_finish(http_message_t *response)
+{
+	http_encoding_stream_t *stream = response->encoding;
+	if (stream == NULL || stream->finished)
+		return NULL;
+	stream->finished = 1;
+	if (_httpencoding_deflate(stream, NULL, 0, Z_FINISH) != ESUCCESS)
+	{
+		err("encoding: compression error");
+		return NULL;
+	}
+	return stream->out;
+}
+
+void _httpencoding_release(http_message_t *response)
+{
+	http_encoding_stream_t *stream = response->encoding;
+	if (stream == NULL)
+		return;
+	deflateEnd(&stream->zstream);
+	_buffer_destroy(stream->out);
+	vfree(stream);
+	response->encoding = NULL;
+}
+
+void _httpencoding_destroy(http_encoding_t *encoding)
+{
+	vfree(encoding);
+}
+
+int httpserver_addencoding(http_server_t *server, int level, size_t minsize)
+{
+	if (server->encoding != NULL)
+		return EREJECT;
+	http_encoding_t *encoding = vcalloc(1, sizeof(*encoding));
+	if (encoding == NULL)
+		return EREJECT;
+	if (level < Z_BEST_SPEED || level > Z_BEST_COMPRESSION)
+		level = Z_DEFAULT_COMPRESSION;
+	encoding->level = level;
+	encoding->minsize = minsize;
+	server->encoding = encoding;
+	return ESUCCESS;
+}
@@ -36,12 +36,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/resource.h>
 #include <time.h>
 #include <signal.h>
+#include <sched.h>
+#ifdef HTTPSERVER_WORKERS
+#include <pthread.h>
+#endif
 
 #ifdef USE_STDARG
 #include <stdarg.h>
@@ -54,11 +60,13 @@
 #endif
 
 #include <netdb.h>
+#include <sys/socket.h>
 
 #include "valloc.h"
 #include "vthread.h"
 #include "ouistiti/log.h"
 #include "ouistiti/httpserver.h"
+#include "ouistiti/hash.h"
 #include "_httpserver.h"
 #include "_httpclient.h"
 #define _HTTPMESSAGE_
@@ -71,6 +79,10 @@
 #define client_dbg(...)
 #define server_dbg(...)
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 static string_t httpversion[HTTPVERSIONS] =
 {
 	STRING_DCL("HTTP/0.9"),
@@ -94,6 +106,50 @@ const char str_uri[] = "uri";
 const char str_query[] = "query";
 const char str_content[] = "content";
 static const char str_headerstorage[] = "headerstorage";
+static const char str_status[] = "Status";
+static const char str_host[] = "Host";
+static const char str_transferencoding[] = "Transfer-Encoding";
+static const char str_chunked[] = "chunked";
+static const char str_etag[] = "ETag";
+static const char str_lastmodified[] = "Last-Modified";
+static const char str_ifnonematch[] = "If-None-Match";
+static const char str_ifmodifiedsince[] = "If-Modified-Since";
+static const char str_range[] = "Range";
+static const char str_ifrange[] = "If-Range";
+static const char str_contentrange[] = "Content-Range";
+static const char str_byteranges[] = "multipart/byteranges; boundary=";
+
+#define HTTPMESSAGE_DATEFORMAT "%a, %d %b %Y %H:%M:%S GMT"
+#define HTTPMESSAGE_DATEMAXLEN 40
+#define HTTPMESSAGE_KEYMAXLEN 64
+
+/**
+ * ranges of the bytes with a meaning for the parser (see _buffer_scan),
+ * the other bytes are copied as is.
+ */
+static const buffer_ranges_t _http_message_uriranges = {
+	BUFFER_RANGES("\x00\x18\x80\xff..%%//??##  "),
+	.table = {[0x00 ... 0x18] = 1, [0x80 ... 0xff] = 1,
+		['.'] = 1, ['%'] = 1, ['/'] = 1, ['?'] = 1, ['#'] = 1, [' '] = 1},
+};
+static const buffer_ranges_t _http_message_queryranges = {
+	BUFFER_RANGES("  \r\r\n\n"),
+	.table = {[' '] = 1, ['\r'] = 1, ['\n'] = 1},
+};
+static const buffer_ranges_t _http_message_headerranges = {
+	BUFFER_RANGES("\r\r\n\n"),
+	.table = {['\r'] = 1, ['\n'] = 1},
+};
+
+static const string_t _http_message_knownheaders[HEADER_KNOWN] = {
+	[HEADER_CONTENTTYPE] = STRING_DCL(str_contenttype),
+	[HEADER_CONTENTLENGTH] = STRING_DCL(str_contentlength),
+	[HEADER_CONNECTION] = STRING_DCL(str_connection),
+	[HEADER_COOKIE] = STRING_DCL(str_cookie),
+	[HEADER_STATUS] = STRING_DCL(str_status),
+	[HEADER_HOST] = STRING_DCL(str_host),
+	[HEADER_TRANSFERENCODING] = STRING_DCL(str_transferencoding),
+};
 
 const http_message_method_t default_methods[] = {
 	{ .key = STRING_DCL(str_get), .id = MESSAGE_TYPE_GET, .next = (http_message_method_t *)&default_methods[1]},
@@ -103,7 +159,6 @@ const http_message_method_t default_methods[] = {
 	{ .key = {NULL, 0, 0}, .id = -1, .next = NULL},
 #endif
 };
-extern ssize_t tcpserver_getname(struct sockaddr_storage *addr, socklen_t addrlen, char *buffer, size_t length, int flag);
 
 size_t httpserver_version(http_message_version_e versionid, const char **version)
 {
@@ -252,14 +307,189 @@ http_message_t * _httpmessage_create(http_client_t *client, http_message_t *pare
 			message->client = parent->client;
 			message->version = parent->version;
 			message->result = parent->result;
-			message->mode = parent->mode;
+			message->mode = parent->mode & ~(HTTPMESSAGE_NOCOPY | HTTPMESSAGE_CHUNKED | HTTPMESSAGE_LENGTHSET);
 		}
 	}
 	return message;
 }
 
+#ifdef HTTPSERVER_WORKERS
+/**
+ * the jobs wait a worker in the order of the calls.
+ * The event loop never runs a blocking connector.
+ */
+struct http_connector_queue_s
+{
+	threadpool_t *workers;
+	int nbworkers;
+	int running; /**the workers which take the jobs of the queue*/
+	http_connector_job_t *first;
+	http_connector_job_t *last;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /**the end of a job*/
+};
+
+http_connector_queue_t *_httpconnector_createqueue(threadpool_t *workers, int nbworkers)
+{
+	http_connector_queue_t *queue = vcalloc(1, sizeof(*queue));
+	if (queue == NULL)
+		return NULL;
+	queue->workers = workers;
+	queue->nbworkers = nbworkers;
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	return queue;
+}
+
+void _httpconnector_destroyqueue(http_connector_queue_t *queue)
+{
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->mutex);
+	vfree(queue);
+}
+
+/**
+ * a worker runs the jobs until the queue is empty
+ */
+static int _httpconnector_runjobs(void *data, void *userdata)
+{
+	http_connector_queue_t *queue = (http_connector_queue_t *)data;
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->first != NULL)
+	{
+		http_connector_job_t *job = queue->first;
+		queue->first = job->next;
+		if (queue->first == NULL)
+			queue->last = NULL;
+		job->next = NULL;
+		pthread_mutex_unlock(&queue->mutex);
+
+		buffer_account_t *owner = _buffer_owner(job->account);
+		job->ret = job->func(job->arg, job->request, job->response);
+		_buffer_owner(owner);
+		/// the client takes back the messages, the job is not usable after
+		httpmessage_resume(job->pending);
+
+		pthread_mutex_lock(&queue->mutex);
+		pthread_cond_broadcast(&queue->cond);
+	}
+	queue->running--;
+	pthread_mutex_unlock(&queue->mutex);
+	return 0;
+}
+
+/**
+ * The job is queued and a new worker is started if all the running
+ * ones are busy. A worker which leaves keeps its thread a short time
+ * after it found the queue empty, this one is waited.
+ */
+static void _httpconnector_pushjob(http_connector_queue_t *queue, http_connector_job_t *job)
+{
+	pthread_mutex_lock(&queue->mutex);
+	if (queue->last != NULL)
+		queue->last->next = job;
+	else
+		queue->first = job;
+	queue->last = job;
+	int start = (queue->running < queue->nbworkers);
+	if (start)
+		queue->running++;
+	pthread_mutex_unlock(&queue->mutex);
+	while (start && threadpool_get(queue->workers, _httpconnector_runjobs, queue, NULL) < 0)
+	{
+		pthread_mutex_lock(&queue->mutex);
+		/// a running worker takes the job before to leave
+		if (queue->running > 1)
+		{
+			queue->running--;
+			start = 0;
+		}
+		pthread_mutex_unlock(&queue->mutex);
+		if (start)
+			sched_yield();
+	}
+}
+
+/**
+ * the worker uses the messages until the end of the connector,
+ * a job still into the queue is removed.
+ */
+static void _httpconnector_waitjob(http_message_t *message)
+{
+	http_connector_queue_t *queue = message->client->server->jobs;
+	http_connector_job_t *job = message->job;
+	pthread_mutex_lock(&queue->mutex);
+	http_connector_job_t *previous = NULL;
+	http_connector_job_t *it = queue->first;
+	while (it != NULL && it != job)
+	{
+		previous = it;
+		it = it->next;
+	}
+	if (it != NULL)
+	{
+		if (previous != NULL)
+			previous->next = job->next;
+		else
+			queue->first = job->next;
+		if (queue->last == job)
+			queue->last = previous;
+		pthread_mutex_unlock(&queue->mutex);
+		/// the reference of the job is dropped without wake up
+		__atomic_store_n(&job->pending->resumed, 1, __ATOMIC_RELEASE);
+		_httpmessage_releasepending(job->pending);
+		return;
+	}
+	while (_httpmessage_suspended(message))
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	pthread_mutex_unlock(&queue->mutex);
+}
+#endif
+
+/**
+ * the content is hashed while it is appended and the ETag is
+ * the hexadecimal value of the hash.
+ */
+static void _httpmessage_etagupdate(http_message_t *message, const char *data, size_t length)
+{
+	if (message->etaghash == NULL)
+		return;
+	if (message->etagctx == NULL)
+		message->etagctx = message->etaghash->init();
+	if (message->etagctx != NULL)
+		message->etaghash->update(message->etagctx, data, length);
+}
+
+static size_t _httpmessage_etagfinish(http_message_t *message, char *etag)
+{
+	if (message->etagctx == NULL)
+		return 0;
+	char digest[64];
+	message->etaghash->finish(message->etagctx, digest);
+	message->etagctx = NULL;
+	if (etag == NULL)
+		return 0;
+	static const char hex[] = "0123456789abcdef";
+	size_t length = 0;
+	etag[length++] = '"';
+	for (int i = 0; i < message->etaghash->size; i++)
+	{
+		etag[length++] = hex[(digest[i] >> 4) & 0x0F];
+		etag[length++] = hex[digest[i] & 0x0F];
+	}
+	etag[length++] = '"';
+	return length;
+}
+
 void _httpmessage_destroy(http_message_t *message)
 {
+#ifdef HTTPSERVER_WORKERS
+	if (message->job)
+	{
+		_httpconnector_waitjob(message);
+		vfree(message->job);
+	}
+#endif
 	if (message->response)
 	{
 		_httpmessage_destroy(message->response);
@@ -270,20 +500,61 @@ void _httpmessage_destroy(http_message_t *message)
 		_buffer_destroy(message->content_storage);
 	if (message->header)
 		_buffer_destroy(message->header);
-	if (message->headers)
-		dbentry_destroy(message->headers);
+	dbindex_destroy(&message->headers);
 	if (message->headers_storage)
 		_buffer_destroy(message->headers_storage);
 	if (message->query_storage)
 		_buffer_destroy(message->query_storage);
-	if (message->queries)
-		dbentry_destroy(message->queries);
+	dbindex_destroy(&message->queries);
+	if (message->parameters_storage)
+		_buffer_destroy(message->parameters_storage);
+	for (int i = 0; i < message->parameters_nbretired; i++)
+		_buffer_destroy(message->parameters_retired[i]);
+	if (message->parameters_retired)
+		vfree(message->parameters_retired);
+	dbindex_destroy(&message->parameters);
 	if (message->cookie_storage)
 		_buffer_destroy(message->cookie_storage);
-	dbentry_destroy(message->cookies);
+	dbindex_destroy(&message->cookies);
+	_httpmessage_releasepending(message->pending);
+	_httpmessage_etagfinish(message, NULL);
+	if (message->ranges)
+		vfree(message->ranges);
+#ifdef HTTPCACHE
+	if (message->cached)
+		_httpcache_release(message->cached);
+	_httpcache_drop(message);
+#endif
+#ifdef HTTPENCODING
+	_httpencoding_release(message);
+#endif
 	vfree(message);
 }
 
+size_t _httpmessage_footprint(const http_message_t *message)
+{
+	size_t size = sizeof(*message);
+	const buffer_t *buffers[] = {
+		message->uri, message->content_storage, message->header,
+		message->headers_storage, message->query_storage, message->cookie_storage,
+		message->parameters_storage,
+	};
+	for (int i = 0; i < sizeof(buffers) / sizeof(*buffers); i++)
+	{
+		if (buffers[i] != NULL)
+			size += _buffer_footprint(buffers[i]);
+	}
+	size += message->headers.size * sizeof(dbfield_t);
+	size += message->queries.size * sizeof(dbfield_t);
+	size += message->parameters.size * sizeof(dbfield_t);
+	for (int i = 0; i < message->parameters_nbretired; i++)
+		size += _buffer_footprint(message->parameters_retired[i]);
+	size += message->cookies.size * sizeof(dbfield_t);
+	if (message->response)
+		size += _httpmessage_footprint(message->response);
+	return size;
+}
+
 int _httpmessage_changestate(http_message_t *message, int new)
 {
 	int mask = PARSE_MASK;
@@ -317,7 +588,7 @@ static int _httpmessage_decodeuri(const char *data, char *decodeval)
 	for (int i = 0; i < 2; i++)
 	{
 		*decodeval = *decodeval << 4;
-		if (*encoded > 0x29 && *encoded < 0x40)
+		if (*encoded > 0x2f && *encoded < 0x3a)
 			*decodeval += (*encoded - 0x30);
 		else if (*encoded > 0x40 && *encoded < 0x47)
 			*decodeval += (*encoded - 0x41 + 10);
@@ -335,7 +606,8 @@ static int _httpmessage_decodeuri(const char *data, char *decodeval)
 
 static int _httpmesssage_parsefailed(http_message_t *message)
 {
-	message->version = httpclient_server(message->client)->config->version;
+	if (message->client != NULL)
+		message->version = httpclient_server(message->client)->config->version & HTTPVERSION_MASK;
 	switch (message->state  & PARSE_MASK)
 	{
 #ifdef RESULT_405
@@ -352,39 +624,72 @@ static int _httpmesssage_parsefailed(http_message_t *message)
 		message->result = RESULT_400;
 	break;
 	}
+	/// over the memory hard limit, a new request is refused
+	if (((message->state & PARSE_MASK) == PARSE_INIT) &&
+		(message->client != NULL) && _buffer_overlimit(&message->client->memory))
+		message->result = RESULT_503;
 
 	return PARSE_END;
 }
 
+/**
+ * keep the bytes of a token (method, version) received
+ * in several parts until its delimiter.
+ */
+static int _httpmessage_token(http_message_t *message, buffer_t *data, char delimiter)
+{
+	const char *end = _buffer_get(data, 0) + _buffer_length(data);
+	while (data->offset < end && *data->offset != delimiter)
+	{
+		if (message->tokenlen >= sizeof(message->token))
+			return EREJECT;
+		message->token[message->tokenlen++] = *data->offset;
+		data->offset++;
+	}
+	if (data->offset == end)
+		return EINCOMPLETE;
+	data->offset++;
+	return ESUCCESS;
+}
+
 static int _httpmessage_parseinit(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_INIT;
 
-	for (const http_message_method_t *method = httpclient_server(message->client)->methods; method != NULL; method = method->next)
+	int ret = _httpmessage_token(message, data, ' ');
+	if (ret == EINCOMPLETE)
+		return next;
+	if (ret == ESUCCESS && message->client != NULL)
+		message->method = _httpserver_method(httpclient_server(message->client), message->token, message->tokenlen);
+	else if (ret == ESUCCESS)
 	{
-		size_t length = _string_length(&method->key);
-		if (!_string_cmp(&method->key, data->offset, -1) &&
-			data->offset[length] == ' ')
+		/// a message without client (httpmessage_create) knows the default methods
+		for (const http_message_method_t *method = default_methods; method; method = method->next)
 		{
-			message->method = method;
-			data->offset += length + 1;
-			next = PARSE_URI;
-			/**
-			 * to parse a request the default value of content_length MUST be 0
-			 * otherwise the parser continue to wait content.
-			 * for GET method, there isn't any content and content_length is not set
-			 */
-			message->content_length = 0;
-			break;
+			if (!_string_cmp(&method->key, message->token, message->tokenlen))
+			{
+				message->method = method;
+				break;
+			}
 		}
 	}
+	if (message->method != NULL)
+	{
+		next = PARSE_URI;
+		/**
+		 * to parse a request the default value of content_length MUST be 0
+		 * otherwise the parser continue to wait content.
+		 * for GET method, there isn't any content and content_length is not set
+		 */
+		message->content_length = 0;
+	}
 
 	if (message->method == NULL)
 	{
-		err("message: reject method %s", data->offset);
-		data->offset++;
+		err("message: reject method %.*s", (int)message->tokenlen, message->token);
 		next = _httpmesssage_parsefailed(message);
 	}
+	message->tokenlen = 0;
 	return next;
 }
 
@@ -402,14 +707,51 @@ static int _httpmessage_pushuri(http_message_t *message, int next, const char *u
 	return next;
 }
 
+/**
+ * the last character of the URI before the current one
+ */
+static char _httpmessage_urilast(const http_message_t *message, const char *uri, size_t length)
+{
+	if (length > 0)
+		return uri[length - 1];
+	size_t urilength = _buffer_length(message->uri);
+	if (urilength > 0)
+		return *_buffer_get(message->uri, urilength - 1);
+	return '\0';
+}
+
+/**
+ * an encoded character may be received in several parts,
+ * the token keeps the first ones.
+ */
+static int _httpmessage_pushencoded(http_message_t *message, int next, buffer_t *data)
+{
+	const char *end = _buffer_get(data, 0) + _buffer_length(data);
+	while (message->tokenlen < 3 && data->offset < end)
+		message->token[message->tokenlen++] = *data->offset++;
+	if (message->tokenlen < 3)
+		return next;
+	char code = 0;
+	_httpmessage_decodeuri(message->token, &code);
+	message->tokenlen = 0;
+	if (code == -1)
+	{
+		err("message: reject uri mal formated : %.3s", message->token);
+		return _httpmesssage_parsefailed(message);
+	}
+	return _httpmessage_pushuri(message, next, &code, 1);
+}
+
 static int _httpmessage_parseuri(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_URI;
-	const char *uri = data->offset;
-	size_t length = 0;
+	const char *end = _buffer_get(data, 0) + _buffer_length(data);
 
+	if (data->offset == end)
+		return next;
 	if (message->uri == NULL)
 	{
+		const char *uri = data->offset;
 		if (uri[0] == '/')
 			message->uri = _buffer_create(str_uri, MAXCHUNKS_URI);
 		/**
@@ -424,23 +766,33 @@ static int _httpmessage_parseuri(http_message_t *message, buffer_t *data)
 		else if (uri[0] == '\n')
 			message->uri = _buffer_create(str_uri, MAXCHUNKS_URI);
 		else
-			next = _httpmesssage_parsefailed(message);
+			return _httpmesssage_parsefailed(message);
 	}
+	/// complete the encoded character of the previous data
+	if (message->tokenlen > 0)
+		next = _httpmessage_pushencoded(message, next, data);
 
-	while (data->offset < (_buffer_get(data, 0) + _buffer_length(data)) && next == PARSE_URI)
+	const char *uri = data->offset;
+	size_t length = 0;
+	while (data->offset < end && next == PARSE_URI)
 	{
-		if (*(data->offset + 1) == '\0')
-		{
-			next = PARSE_URI | PARSE_CONTINUE;
+		size_t span = _buffer_scan(data->offset, end - data->offset, &_http_message_uriranges);
+		length += span;
+		data->offset += span;
+		if (data->offset == end)
 			break;
-		}
 		switch (*data->offset)
 		{
 #ifndef HTTPMESSAGE_NODOUBLEDOT
 			case '.':
 			{
-				if (*(data->offset + 1) == '.')
+				if (_httpmessage_urilast(message, uri, length) == '.')
 				{
+					/// remove the first dot and the last directory
+					if (length > 0)
+						length--;
+					else
+						_buffer_pop(message->uri, 1);
 					next = _httpmessage_pushuri(message, next, uri, length);
 					if (_buffer_rewindto(message->uri, '/') != ESUCCESS)
 					{
@@ -455,7 +807,6 @@ static int _httpmessage_parseuri(http_message_t *message, buffer_t *data)
 						err("message: reject dangerous uri : %s", _buffer_get(data, 0));
 						break;
 					}
-					data->offset += 2 - 1;
 					length = 0;
 					uri = data->offset + 1;
 				}
@@ -467,40 +818,26 @@ static int _httpmessage_parseuri(http_message_t *message, buffer_t *data)
 			case '%':
 			{
 				next = _httpmessage_pushuri(message, next, uri, length);
-				char code = 0;
-				int ret = _httpmessage_decodeuri(data->offset, &code);
-				if (code == -1)
-				{
-					next = _httpmesssage_parsefailed(message);
-					err("message: reject uri mal formated : %s %s",
-							uri,
-							_buffer_get(data, 0));
-				}
-				else
-					next = _httpmessage_pushuri(message, next, &code, 1);
-				if (ret > 0)
-					data->offset += ret - 1;
+				next = _httpmessage_pushencoded(message, next, data);
 				length = 0;
-				uri = data->offset + 1;
+				uri = data->offset;
+				/// the offset is already after the encoded character
+				continue;
 			}
-			break;
 			case '/':
 				/**
 				 * Remove all double / inside the URI.
 				 * This may allow unsecure path with double .
 				 * But leave double // for the query part
 				 */
-				length++;
-				if (*(data->offset + 1) == '/')
+				if (_httpmessage_urilast(message, uri, length) == '/')
 				{
 					next = _httpmessage_pushuri(message, next, uri, length);
-				}
-				while (*(data->offset + 1) == '/')
-				{
-					data->offset++;
-					uri = data->offset + 1;
 					length = 0;
+					uri = data->offset + 1;
 				}
+				else
+					length++;
 			break;
 			case '?':
 				next = PARSE_QUERY;
@@ -521,7 +858,7 @@ static int _httpmessage_parseuri(http_message_t *message, buffer_t *data)
 			{
 				/// version is not present but it must be parse to be "HTTP/0.9"
 				next = PARSE_END;
-				if (*(data->offset + 1) == '\n')
+				if (data->offset + 1 < end && *(data->offset + 1) == '\n')
 				{
 					data->offset++;
 				}
@@ -589,8 +926,14 @@ static int _httpmessage_parsequery(http_message_t *message, buffer_t *data)
 		message->query_storage = _buffer_create(str_query, MAXCHUNKS_URI);
 	}
 
-	while (data->offset < (data->data + data->length) && next == PARSE_QUERY)
+	const char *end = data->data + data->length;
+	while (data->offset < end && next == PARSE_QUERY)
 	{
+		size_t span = _buffer_scan(data->offset, end - data->offset, &_http_message_queryranges);
+		length += span;
+		data->offset += span;
+		if (data->offset == end)
+			break;
 		switch (*data->offset)
 		{
 			case ' ':
@@ -602,7 +945,10 @@ static int _httpmessage_parsequery(http_message_t *message, buffer_t *data)
 			case '\n':
 			{
 				next = PARSE_PREHEADER;
-				if (*(data->offset + 1) == '\n')
+				/// the '\n' is into the next data
+				if (*data->offset == '\r' && data->offset + 1 == end)
+					message->token[message->tokenlen++] = '\r';
+				else if (*(data->offset + 1) == '\n')
 					data->offset++;
 			}
 			break;
@@ -662,49 +1008,41 @@ static int _httpmessage_parseversion(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_VERSION;
 
-	/**
-	 * There is not enougth data to parse the version.
-	 * Move the rest to the beginning and request
-	 * more data.
-	 **/
-	if (data->offset + 10 > _buffer_get(data, 0) + _buffer_length(data))
-	{
+	int ret = _httpmessage_token(message, data, '\n');
+	if (ret == EINCOMPLETE)
 		return next;
-	}
-	char *version = data->offset;
-	for (int i = 0; i < sizeof(httpversion)/sizeof(string_t); i++)
+	if (message->tokenlen > 0 && message->token[message->tokenlen - 1] == '\r')
+		message->tokenlen--;
+	for (int i = 0; i < sizeof(httpversion)/sizeof(string_t) && ret == ESUCCESS; i++)
 	{
-		if (!_string_cmp(&httpversion[i], version, -1))
+		if (!_string_cmp(&httpversion[i], message->token, message->tokenlen))
 		{
-			data->offset += _string_length(&httpversion[i]);
-			if (*data->offset == '\r')
-				data->offset++;
-			if (*data->offset == '\n')
-			{
-				data->offset++;
-				next = PARSE_PREHEADER;
-			}
-			else
-			{
-				next = PARSE_END;
-				message->result = RESULT_400;
-				err("bad request %s", data->data);
-			}
 			message->version = i;
+			next = PARSE_PREHEADER;
 			break;
 		}
 	}
 	if (message->version == -1)
 	{
 		next = _httpmesssage_parsefailed(message);
-		err("message: bad protocol version %s", version);
+		err("message: bad protocol version %.*s", (int)message->tokenlen, message->token);
 	}
+	message->tokenlen = 0;
 	return next;
 }
 
 static int _httpmessage_parsepreheader(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_HEADER;
+	if (message->tokenlen > 0)
+	{
+		/// the request line ends with '\r' and waits its '\n'
+		if (_buffer_empty(data))
+			return PARSE_PREHEADER;
+		if (*data->offset == '\n')
+			data->offset++;
+		message->tokenlen = 0;
+	}
 	/**
 	 * keep the query to the end of the URI first.
 	 * When the URI is completed, remove the '?'
@@ -716,10 +1054,13 @@ static int _httpmessage_parsepreheader(http_message_t *message, buffer_t *data)
 		 * query must be set at the end of the uri loading
 		 * uri buffer may be change during an extension
 		 */
-		const char *service = httpserver_INFO(httpclient_server(message->client), "service");
-		warn("new request %.*s %.*s from \"%s\" service",
-				(int)_string_length(&message->method->key), _string_get(&message->method->key),
-				(int)_buffer_length(message->uri), _buffer_get(message->uri, 0), service);
+		if (message->client != NULL)
+		{
+			const char *service = httpserver_INFO(httpclient_server(message->client), "service");
+			warn("new request %.*s %.*s from \"%s\" service",
+					(int)_string_length(&message->method->key), _string_get(&message->method->key),
+					(int)_buffer_length(message->uri), _buffer_get(message->uri, 0), service);
+		}
 	}
 	else if (message->uri == NULL)
 	{
@@ -729,6 +1070,74 @@ static int _httpmessage_parsepreheader(http_message_t *message, buffer_t *data)
 	return next;
 }
 
+static int _httpmessage_knownheader(const char *key, size_t keylen)
+{
+	for (int i = 0; i < HEADER_KNOWN; i++)
+	{
+		if (_http_message_knownheaders[i].length == keylen &&
+			!strncasecmp(_http_message_knownheaders[i].data, key, keylen))
+			return i;
+	}
+	return EREJECT;
+}
+
+static void _httpmessage_knownslot(http_message_t *message, int id)
+{
+	const dbfield_t *field = &message->headers.fields[id];
+	int known = _httpmessage_knownheader(_buffer_get(message->headers.storage, field->key.offset), field->key.length);
+	if (known != EREJECT && message->headers_known[known] == 0)
+		message->headers_known[known] = id + 1;
+}
+
+/**
+ * index a line stored as "<key>:<value>\0" into the storage
+ */
+static int _httpmessage_indexheader(http_message_t *message, const buffer_t *storage, size_t offset, size_t linelen)
+{
+	const char *line = _buffer_get(storage, offset);
+	const char *value = memchr(line, ':', linelen);
+	size_t keylen = linelen;
+	size_t valuelen = 0;
+	if (value != NULL)
+	{
+		keylen = value - line;
+		value++;
+		while (*value == ' ')
+			value++;
+		valuelen = line + linelen - value;
+	}
+	else
+		value = line + linelen;
+	if (keylen == 0)
+		return ESUCCESS;
+	int id = dbindex_add(&message->headers, storage, line, keylen, value, valuelen);
+	if (id < 0)
+		return id;
+	_httpmessage_knownslot(message, id);
+	return ESUCCESS;
+}
+
+ssize_t _httpmessage_headervalue(const http_message_t *message, _http_message_header_e id, const char **value)
+{
+	if (value != NULL)
+		*value = NULL;
+	if (message->headers_known[id] == 0)
+		return EREJECT;
+	return dbindex_value(&message->headers, message->headers_known[id] - 1, value);
+}
+
+ssize_t _httpmessage_searchheader(const http_message_t *message, const char *key, const char **value)
+{
+	size_t keylen = strlen(key);
+	int known = _httpmessage_knownheader(key, keylen);
+	if (known != EREJECT)
+		return _httpmessage_headervalue(message, known, value);
+	if (value != NULL)
+		*value = NULL;
+	int id = dbindex_find(&message->headers, dbindex_hash(key, keylen), key, keylen);
+	return dbindex_value(&message->headers, id, value);
+}
+
 static int _httpmessage_parseheader(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_HEADER;
@@ -741,8 +1150,28 @@ static int _httpmessage_parseheader(http_message_t *message, buffer_t *data)
 	}
 
 	/* store header line as "<key>:<value>\0" */
-	while (data->offset < (_buffer_get(data, 0) + _buffer_length(data)) && next == PARSE_HEADER)
+	const char *end = _buffer_get(data, 0) + _buffer_length(data);
+	/// the previous data ended with '\r', it was a bare CR without '\n'
+	if (message->tokenlen > 0 && data->offset < end)
 	{
+		message->tokenlen = 0;
+		if (*data->offset != '\n')
+		{
+			if (_buffer_append(message->headers_storage, " ", 1) < 0)
+			{
+				err("message: header too long!!!");
+				return _httpmesssage_parsefailed(message);
+			}
+			message->state |= PARSE_CONTINUE;
+		}
+	}
+	while (data->offset < end && next == PARSE_HEADER)
+	{
+		size_t span = _buffer_scan(data->offset, end - data->offset, &_http_message_headerranges);
+		length += span;
+		data->offset += span;
+		if (data->offset == end)
+			break;
 		switch (*data->offset)
 		{
 		case '\n':
@@ -763,8 +1192,15 @@ static int _httpmessage_parseheader(http_message_t *message, buffer_t *data)
 					next = _httpmesssage_parsefailed(message);
 					err("message: header too long!!!");
 				}
+				else if (_httpmessage_indexheader(message, message->headers_storage,
+							message->headers_line, _buffer_length(message->headers_storage) - message->headers_line - 1) < 0)
+				{
+					next = _httpmesssage_parsefailed(message);
+					err("message: too many headers!!!");
+				}
 				else
 				{
+					message->headers_line = _buffer_length(message->headers_storage);
 					header = data->offset + 1;
 					length = 0;
 					message->state &= ~PARSE_CONTINUE;
@@ -773,6 +1209,14 @@ static int _httpmessage_parseheader(http_message_t *message, buffer_t *data)
 		}
 		break;
 		case '\r':
+			/// the line must stay contiguous, a bare CR is replaced by a space
+			if (data->offset + 1 == end)
+				message->tokenlen = 1;
+			else if (data->offset[1] != '\n')
+			{
+				*data->offset = ' ';
+				length++;
+			}
 		break;
 		default:
 			length++;
@@ -782,21 +1226,101 @@ static int _httpmessage_parseheader(http_message_t *message, buffer_t *data)
 	/* not enougth data to complete the line */
 	if (next == PARSE_HEADER && length > 0)
 	{
-		_buffer_append(message->headers_storage, header, length);
-		message->state |= PARSE_CONTINUE;
+		if (_buffer_append(message->headers_storage, header, length) < 0)
+		{
+			next = _httpmesssage_parsefailed(message);
+			err("message: header too long!!!");
+		}
+		else
+			message->state |= PARSE_CONTINUE;
+	}
+	return next;
+}
+
+#ifdef HTTPMESSAGE_ZEROCOPY
+/**
+ * the header block stays into the receive buffer.
+ * The lines are only split and indexed, and the buffer is detached
+ * at the end of the block (see parsepostheader).
+ * headers_line is the offset of the beginning of the current line.
+ */
+static int _httpmessage_parsepinnedheader(http_message_t *message, buffer_t *data)
+{
+	int next = PARSE_HEADER;
+
+	if (message->headers.storage == NULL)
+	{
+		_buffer_shrink(data);
+		message->headers.storage = data;
+		message->headers_line = 0;
+	}
+
+	const char *end = _buffer_get(data, 0) + _buffer_length(data);
+	while (data->offset < end && next == PARSE_HEADER)
+	{
+		char *eol = memchr(data->offset, '\n', end - data->offset);
+		if (eol == NULL)
+		{
+			data->offset += end - data->offset;
+			break;
+		}
+		data->offset = eol;
+		char *header = data->data + message->headers_line;
+		size_t length = data->offset - header;
+		if (length > 0 && header[length - 1] == '\r')
+			length--;
+		if (length == 0)
+		{
+			next = PARSE_POSTHEADER;
+		}
+		else
+		{
+			header[length] = '\0';
+			if (_httpmessage_indexheader(message, data, message->headers_line, length) < 0)
+			{
+				next = _httpmesssage_parsefailed(message);
+				err("message: too many headers!!!");
+			}
+		}
+		message->headers_line = data->offset + 1 - data->data;
+		data->offset++;
+	}
+	/* not enougth place to complete the line */
+	if (next == PARSE_HEADER && _buffer_length(data) + 1 >= data->size &&
+		_buffer_extend(data, _buffer_chunksize(-1)) < 0)
+	{
+		next = _httpmesssage_parsefailed(message);
+		err("message: header too long!!!");
 	}
 	return next;
 }
 
+int _httpmessage_pinned(const http_message_t *message)
+{
+	return (message->mode & HTTPMESSAGE_NOCOPY) &&
+		(message->headers.storage != NULL) && (message->headers_storage == NULL);
+}
+#endif
+
 static int _httpmessage_parsepostheader(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_POSTHEADER;
-	/**
-	 * If the client send headers with only \n at end of each line
-	 * it is impossible to rebuild the header correctly.
-	 * This null character allows to add \r\n at the end of the headers.
-	 */
-	_buffer_append(message->headers_storage, "\0", 1);
+#ifdef HTTPMESSAGE_ZEROCOPY
+	if (_httpmessage_pinned(message))
+	{
+		/**
+		 * the message keeps the header block and
+		 * the receive buffer continues with the rest.
+		 */
+		message->headers_storage = _buffer_detach(data, str_headerstorage);
+		if (message->headers_storage == NULL)
+		{
+			err("message: not enough memory");
+			return _httpmesssage_parsefailed(message);
+		}
+		message->headers.storage = message->headers_storage;
+	}
+#endif
 	if (_httpmessage_fillheaderdb(message) != ESUCCESS)
 	{
 		next = _httpmesssage_parsefailed(message);
@@ -805,9 +1329,9 @@ static int _httpmessage_parsepostheader(http_message_t *message, buffer_t *data)
 	else
 	{
 #ifdef DEBUG
-		for (dbentry_t *entry = message->headers; entry != NULL; entry = entry->next)
+		for (int i = 0; i < message->headers.count; i++)
 		{
-			dbg("message: headers %s", entry->storage->data + entry->key.offset);
+			dbg("message: headers %s", _buffer_get(message->headers_storage, message->headers.fields[i].key.offset));
 		}
 #endif
 		_buffer_shrink(data);
@@ -817,6 +1341,16 @@ static int _httpmessage_parsepostheader(http_message_t *message, buffer_t *data)
 	return next;
 }
 
+enum
+{
+	CHUNK_SIZE,
+	CHUNK_EXTENSION,
+	CHUNK_DATA,
+	CHUNK_DATAEND,
+	CHUNK_TRAILER,
+	CHUNK_TRAILERLINE,
+};
+
 static int _httpmessage_parseprecontent(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_PRECONTENT;
@@ -824,16 +1358,32 @@ static int _httpmessage_parseprecontent(http_message_t *message, buffer_t *data)
 	message->content_packet = 0;
 	const char *content_type = NULL;
 	int length = 0;
-	length = dbentry_search(message->headers, str_contenttype, &content_type);
+	length = _httpmessage_headervalue(message, HEADER_CONTENTTYPE, &content_type);
 	if (length > 0)
 	{
 		const char *end = strchr(content_type, ';');
 		if (end)
 			length = end - content_type;
+		while (length > 0 && (content_type[length - 1] == ' ' || content_type[length - 1] == '\t'))
+			length--;
 	}
 
-	if ((message->method->properties & MESSAGE_ALLOW_CONTENT) &&
-			content_type != NULL && !strncasecmp(content_type, str_form_urlencoded, length))
+	if (message->mode & HTTPMESSAGE_CHUNKED)
+	{
+		message->chunk_state = CHUNK_SIZE;
+		message->chunk_length = 0;
+		message->tokenlen = 0;
+		next = PARSE_CONTENT;
+		message->state &= ~PARSE_CONTINUE;
+	}
+	else if (_httpmessage_contentempty(message, 0))
+	{
+		next = PARSE_END;
+		dbg("no content inside request");
+	}
+	else if ((message->method->properties & MESSAGE_ALLOW_CONTENT) &&
+			content_type != NULL && length == sizeof(str_form_urlencoded) - 1 &&
+			!strncasecmp(content_type, str_form_urlencoded, length))
 	{
 		/**
 		 * message mix query data inside the URI and Content
@@ -854,11 +1404,6 @@ static int _httpmessage_parseprecontent(http_message_t *message, buffer_t *data)
 		next = PARSE_POSTCONTENT;
 		message->state &= ~PARSE_CONTINUE;
 	}
-	else if (_httpmessage_contentempty(message, 0))
-	{
-		next = PARSE_END;
-		dbg("no content inside request");
-	}
 	else
 	{
 		next = PARSE_CONTENT;
@@ -868,11 +1413,134 @@ static int _httpmessage_parseprecontent(http_message_t *message, buffer_t *data)
 	return next;
 }
 
+static int _httpmessage_hexdigit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * a part of the content is at most the data received from the socket,
+ * and at most the declared length.
+ */
+static buffer_t *_httpmessage_contentstorage(http_message_t *message, const buffer_t *data)
+{
+	if (message->content_storage == NULL)
+	{
+		size_t chunksize = _buffer_chunksize(-1);
+		int nbchunks = (data->size / chunksize) + 1;
+		if (nbchunks < MAXCHUNKS_CONTENT)
+			nbchunks = MAXCHUNKS_CONTENT;
+		if (!_httpmessage_contentempty(message, 1) &&
+			(message->content_length / chunksize) + 1 < nbchunks)
+			nbchunks = (message->content_length / chunksize) + 1;
+		message->content_storage = _buffer_create(str_content, nbchunks);
+	}
+	return message->content_storage;
+}
+
+/**
+ * decode the chunked content available into data. The payload of the
+ * chunks is gathered into the content for the connector, the framing
+ * may be split anywhere between two receptions.
+ */
+static int _httpmessage_parsechunked(http_message_t *message, buffer_t *data)
+{
+	int next = PARSE_CONTENT;
+	const char *end = _buffer_get(data, 0) + _buffer_length(data);
+
+	message->content = _httpmessage_contentstorage(message, data);
+	if (message->content == NULL)
+		return _httpmesssage_parsefailed(message);
+	_buffer_reset(message->content, 0);
+
+	while (data->offset < end && next == PARSE_CONTENT)
+	{
+		char c = *data->offset;
+		switch (message->chunk_state)
+		{
+		case CHUNK_SIZE:
+		{
+			int digit = _httpmessage_hexdigit(c);
+			if (digit >= 0 && message->chunk_length <= (((unsigned long long)-1) >> 4))
+			{
+				message->chunk_length = (message->chunk_length << 4) + digit;
+				message->tokenlen++;
+			}
+			else if (digit >= 0 || message->tokenlen == 0)
+				next = _httpmesssage_parsefailed(message);
+			else if (c == '\n')
+				message->chunk_state = (message->chunk_length > 0)? CHUNK_DATA: CHUNK_TRAILER;
+			else
+				message->chunk_state = CHUNK_EXTENSION;
+			data->offset++;
+		}
+		break;
+		case CHUNK_EXTENSION:
+			if (c == '\n')
+				message->chunk_state = (message->chunk_length > 0)? CHUNK_DATA: CHUNK_TRAILER;
+			data->offset++;
+		break;
+		case CHUNK_DATA:
+		{
+			size_t length = end - data->offset;
+			if (length > message->chunk_length)
+				length = message->chunk_length;
+			if (_buffer_append(message->content, data->offset, length) < 0)
+			{
+				next = _httpmesssage_parsefailed(message);
+				break;
+			}
+			message->chunk_length -= length;
+			data->offset += length;
+			if (message->chunk_length == 0)
+				message->chunk_state = CHUNK_DATAEND;
+		}
+		break;
+		case CHUNK_DATAEND:
+			if (c == '\n')
+			{
+				message->chunk_state = CHUNK_SIZE;
+				message->tokenlen = 0;
+			}
+			else if (c != '\r')
+				next = _httpmesssage_parsefailed(message);
+			data->offset++;
+		break;
+		case CHUNK_TRAILER:
+			if (c == '\n')
+				next = PARSE_END;
+			else if (c != '\r')
+				message->chunk_state = CHUNK_TRAILERLINE;
+			data->offset++;
+		break;
+		case CHUNK_TRAILERLINE:
+			if (c == '\n')
+				message->chunk_state = CHUNK_TRAILER;
+			data->offset++;
+		break;
+		}
+	}
+	message->content_packet = _buffer_length(message->content);
+	if (next == PARSE_END)
+		message->tokenlen = 0;
+	return next;
+}
+
 static int _httpmessage_parsecontent(http_message_t *message, buffer_t *data)
 {
 	int next = PARSE_CONTENT;
 
-	if (_httpmessage_contentempty(message, 0))
+	if (message->mode & HTTPMESSAGE_CHUNKED)
+	{
+		next = _httpmessage_parsechunked(message, data);
+	}
+	else if (_httpmessage_contentempty(message, 0))
 	{
 		next = PARSE_END;
 	}
@@ -916,13 +1584,14 @@ static int _httpmessage_parsecontent(http_message_t *message, buffer_t *data)
 			length -= (data->offset - _buffer_get(data, 0));
 		}
 
-		if (message->content_storage == NULL)
-			message->content_storage = _buffer_create(str_content, 1);
 		if (message->content == NULL)
-			message->content = message->content_storage;
+			message->content = _httpmessage_contentstorage(message, data);
+		if (message->content == NULL)
+			return _httpmesssage_parsefailed(message);
 		_buffer_reset(message->content, 0);
-		if (message->content != data)
-			_buffer_append(message->content, data->offset, length);
+		if (message->content != data &&
+			_buffer_append(message->content, data->offset, length) < 0)
+			return _httpmesssage_parsefailed(message);
 		message->content_packet = length;
 		data->offset += length;
 	}
@@ -934,7 +1603,13 @@ static int _httpmessage_parsepostcontent(http_message_t *message, buffer_t *data
 	int next = PARSE_POSTCONTENT;
 	const char *query = data->offset;
 	size_t length = _buffer_length(data) - (data->offset - _buffer_get(data, 0));
-	int offset = _buffer_append(message->query_storage, query, length);
+	/// the data after the content belongs to the next request
+	if (length > message->content_length)
+		length = message->content_length;
+	int offset = EREJECT;
+	/// the query is refused instead to be truncated
+	if (_buffer_available(message->query_storage) >= length)
+		offset = _buffer_append(message->query_storage, query, length);
 	if (offset < 0)
 	{
 		next = _httpmesssage_parsefailed(message);
@@ -942,7 +1617,7 @@ static int _httpmessage_parsepostcontent(http_message_t *message, buffer_t *data
 				_buffer_get(message->query_storage, 0),
 				_buffer_get(data, 0));
 	}
-	else if (message->content_length <= length)
+	else if (message->content_length == length)
 	{
 		/// The content may be binary data like a file
 		/// No parsinng must be done
@@ -985,6 +1660,16 @@ int _httpmessage_parserequest(http_message_t *message, buffer_t *data)
 {
 	int ret = ECONTINUE;
 
+	/**
+	 * over the memory hard limit, a new request is refused.
+	 * The server closes the client which uses the most of the memory.
+	 */
+	if (((message->state & PARSE_MASK) == PARSE_INIT) &&
+		(message->client != NULL) && _buffer_overlimit(&message->client->memory))
+	{
+		warn("message: memory limit reached");
+		_httpmessage_changestate(message, _httpmesssage_parsefailed(message));
+	}
 	do
 	{
 		ret = ECONTINUE;
@@ -1031,6 +1716,11 @@ int _httpmessage_parserequest(http_message_t *message, buffer_t *data)
 			break;
 			case PARSE_HEADER:
 			{
+#ifdef HTTPMESSAGE_ZEROCOPY
+				if (message->mode & HTTPMESSAGE_NOCOPY)
+					next = _httpmessage_parsepinnedheader(message, data);
+				else
+#endif
 				next = _httpmessage_parseheader(message, data);
 			}
 			break;
@@ -1084,37 +1774,80 @@ int _httpmessage_buildresponse(http_message_t *message, int version, buffer_t *h
 	http_message_version_e _version = message->version;
 	if (message->version > (version & HTTPVERSION_MASK))
 		_version = (version & HTTPVERSION_MASK);
-	_buffer_append(header, _string_get(&httpversion[_version]), _string_length(&httpversion[_version]));
+	const _http_message_result_t *result = _httpmessage_result(message->result);
+	if ((result != NULL) && (_version >= HTTP10) && (_version <= HTTP11))
+	{
+		_buffer_append(header, _string_get(&result->line[_version]), _string_length(&result->line[_version]));
+	}
+	else
+	{
+		_buffer_append(header, _string_get(&httpversion[_version]), _string_length(&httpversion[_version]));
 
-	char status[_HTTPMESSAGE_RESULT_MAXLEN];
-	size_t len = _httpmessage_status(message, status, _HTTPMESSAGE_RESULT_MAXLEN);
-	_buffer_append(header, status, len);
-	_buffer_append(header, "\r\n", 2);
+		char status[_HTTPMESSAGE_RESULT_MAXLEN];
+		size_t len = _httpmessage_status(message, status, _HTTPMESSAGE_RESULT_MAXLEN);
+		_buffer_append(header, status, len);
+		_buffer_append(header, "\r\n", 2);
+	}
 
 	if (message->result > 399)
 		message->mode &= ~HTTPMESSAGE_KEEPALIVE;
-	header->offset = (char *)_buffer_get(header, 0);
 	_httpmessage_changestate(message, GENERATE_RESULT);
 	return ESUCCESS;
 }
 
-buffer_t *_httpmessage_buildheader(http_message_t *message)
+/**
+ * a response without Content-Length on a persistent connection
+ * is sent with the chunked transfer coding
+ */
+int _httpmessage_chunkencoding(http_message_t *message)
 {
-	int headers_contains_length = 0;
-	if (message->headers != NULL)
-	{
-		headers_contains_length = dbentry_search(message->headers, str_contentlength, NULL);
-		_buffer_serializedb(message->headers_storage, message->headers, ':', '\n');
-		dbentry_destroy(message->headers);
-		message->headers = NULL;
-	}
-	if (!_httpmessage_contentempty(message, 1) && ! headers_contains_length)
+	if (!_httpmessage_contentempty(message, 1) ||
+		(message->version != HTTP11) ||
+		!(message->mode & HTTPMESSAGE_KEEPALIVE) ||
+		(message->mode & HTTPMESSAGE_LOCKED) ||
+		(message->result < 200) || (message->result == 204) || (message->result == 304))
+		return EREJECT;
+	/// the connection or the coding is already managed by a connector
+	if ((_httpmessage_headervalue(message, HEADER_CONNECTION, NULL) != EREJECT) ||
+		(_httpmessage_headervalue(message, HEADER_TRANSFERENCODING, NULL) != EREJECT))
+		return EREJECT;
+	httpmessage_addheader(message, str_transferencoding, STRING_REF(str_chunked));
+	message->mode |= HTTPMESSAGE_CHUNKED;
+	return ESUCCESS;
+}
+
+/**
+ * the complete connectors are called from the last one of the list
+ */
+static void _httpmessage_completeconnectors(http_message_t *message, const http_connector_list_t *it, http_connector_cursor_t *cursor)
+{
+	while (it != NULL && (it->func == NULL || it->priority != CONNECTOR_COMPLETE))
+		it = _httpclient_nextconnector(cursor);
+	if (it == NULL)
+		return;
+	_httpmessage_completeconnectors(message, _httpclient_nextconnector(cursor), cursor);
+	message_dbg("message %p complete connector \"%s\"", message->client, it->name);
+	it->func(it->arg, NULL, message);
+}
+
+/**
+ * serialize the headers after the status line
+ */
+int _httpmessage_buildheader(http_message_t *message, buffer_t *header)
+{
+	/// 304 has no content, its length would be the length of the document
+	if (!_httpmessage_contentempty(message, 1) && (message->result != RESULT_304) &&
+		(_httpmessage_headervalue(message, HEADER_CONTENTLENGTH, NULL) == EREJECT))
 	{
 		char content_length[32];
 		int length = snprintf(content_length, 31, "%llu",  message->content_length);
 		httpmessage_addheader(message, str_contentlength, content_length, length);
 	}
-	if ((message->mode & HTTPMESSAGE_KEEPALIVE) > 0)
+	if (_httpmessage_headervalue(message, HEADER_CONNECTION, NULL) != EREJECT)
+	{
+		/// the connection is already managed by a connector (upgrade)
+	}
+	else if ((message->mode & HTTPMESSAGE_KEEPALIVE) > 0)
 	{
 		httpmessage_addheader(message, str_connection, STRING_REF(str_keepalive));
 	}
@@ -1122,27 +1855,27 @@ buffer_t *_httpmessage_buildheader(http_message_t *message)
 	{
 		httpmessage_addheader(message, str_connection, STRING_REF("Close"));
 	}
-	if (message->complete)
+	if (message->complete && message->client != NULL)
 	{
-		/**
-		 * rebuild temporarily the DB for the connectors
-		 */
-		_buffer_filldb(message->headers_storage, &message->headers, ':', '\r');
-		for (http_connector_list_t *it = message->complete; it != NULL;
-			it = it->nextcomplete)
+		http_connector_cursor_t cursor;
+		_httpmessage_completeconnectors(message, _httpclient_connectors(message->client, &cursor), &cursor);
+	}
+	for (int i = 0; i < message->headers.count; i++)
+	{
+		const dbfield_t *field = &message->headers.fields[i];
+		if (_buffer_accept(header, field->key.length + 2 + field->value.length + 2) != ESUCCESS)
 		{
-			if (it->func)
-			{
-				message_dbg("message %p complete connector \"%s\"", message->client, it->name);
-				it->func(it->arg, NULL, message);
-			}
+			err("message: header too long %.*s", (int)field->key.length, _buffer_get(message->headers.storage, field->key.offset));
+			return EREJECT;
 		}
-		_buffer_serializedb(message->headers_storage, message->headers, ':', '\n');
-		dbentry_destroy(message->headers);
-		message->headers = NULL;
+		_buffer_append(header, _buffer_get(message->headers.storage, field->key.offset), field->key.length);
+		_buffer_append(header, ": ", 2);
+		_buffer_append(header, _buffer_get(message->headers.storage, field->value.offset), field->value.length);
+		_buffer_append(header, "\r\n", 2);
 	}
-	message->headers_storage->offset = (char *)_buffer_get(message->headers_storage, 0);
-	return message->headers_storage;
+	_buffer_append(header, "\r\n", 2);
+	header->offset = (char *)_buffer_get(header, 0);
+	return ESUCCESS;
 }
 
 void *httpmessage_private(http_message_t *message, void *data)
@@ -1169,6 +1902,12 @@ int httpmessage_content(http_message_t *message, const char **data, size_t *cont
 		{
 			*content_length = message->content_length;
 		}
+		else if ((message->mode & HTTPMESSAGE_CHUNKED) && (state < PARSE_END) &&
+			!(message->state & GENERATE_MASK))
+		{
+			/// the rest of the current chunk, at least 1 until the last chunk
+			*content_length = (message->chunk_length > 0)? message->chunk_length: 1;
+		}
 		else
 		{
 			*content_length = 0;
@@ -1250,21 +1989,25 @@ http_message_result_e httpmessage_result(http_message_t *message, http_message_r
 	return message->result;
 }
 
+const _http_message_result_t *_httpmessage_result(int result)
+{
+	if ((result < 100) || (result / 100 > _HTTPMESSAGE_RESULT_CLASSES) ||
+		(result % 100 >= _HTTPMESSAGE_RESULT_SUBCODES))
+		return NULL;
+	return _http_message_result[result / 100 - 1][result % 100];
+}
+
 size_t _httpmessage_status(const http_message_t *message, char *status, size_t statuslen)
 {
-	int i = 0;
-	while (_http_message_result[i] != NULL)
+	const _http_message_result_t *result = _httpmessage_result(message->result);
+	if (result != NULL)
 	{
-		if (_http_message_result[i]->result == message->result)
+		if (status != NULL)
 		{
-			if (status != NULL)
-			{
-				statuslen = (_string_length(&_http_message_result[i]->status) > statuslen)? statuslen: _string_length(&_http_message_result[i]->status) + 1;
-				memcpy(status, _string_get(&_http_message_result[i]->status), statuslen);
-			}
-			return _string_length(&_http_message_result[i]->status);
+			statuslen = (_string_length(&result->status) > statuslen)? statuslen: _string_length(&result->status) + 1;
+			memcpy(status, _string_get(&result->status), statuslen);
 		}
-		i++;
+		return _string_length(&result->status);
 	}
 	if (status != NULL && statuslen > 4)
 	{
@@ -1273,14 +2016,29 @@ size_t _httpmessage_status(const http_message_t *message, char *status, size_t s
 	return 4;
 }
 
+/**
+ * compare the last coding of a comma-separated list (Transfer-Encoding)
+ */
+static int _httpmessage_lastcoding(const char *value, size_t length, const char *coding, size_t codinglen)
+{
+	const char *end = value + length;
+	const char *start = end;
+	while (start > value && start[-1] != ',')
+		start--;
+	while (start < end && (*start == ' ' || *start == '\t'))
+		start++;
+	while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	return ((size_t)(end - start) == codinglen && !strncasecmp(start, coding, codinglen));
+}
+
 int _httpmessage_fillheaderdb(http_message_t *message)
 {
-	_buffer_filldb(message->headers_storage, &message->headers, ':', '\n');
 	const char *value = NULL;
 	ssize_t valuelen = 0;
 	/// HTTP 0.9 and 1.0 must close connection
 	if (message->version == 2)
-		valuelen = dbentry_search(message->headers, str_connection, &value);
+		valuelen = _httpmessage_headervalue(message, HEADER_CONNECTION, &value);
 	if (valuelen > 0)
 	{
 		for (int i = 0; i < valuelen; i++)
@@ -1298,7 +2056,7 @@ int _httpmessage_fillheaderdb(http_message_t *message)
 			}
 		}
 	}
-	valuelen = dbentry_search(message->headers, str_contentlength, &value);
+	valuelen = _httpmessage_headervalue(message, HEADER_CONTENTLENGTH, &value);
 	char *endvalue;
 	if (valuelen > 0)
 	{
@@ -1306,22 +2064,80 @@ int _httpmessage_fillheaderdb(http_message_t *message)
 		if (endvalue - value == valuelen)
 			message->content_length = intvalue;
 	}
-	valuelen = dbentry_search(message->headers, "Status", &value);
+	valuelen = _httpmessage_headervalue(message, HEADER_TRANSFERENCODING, &value);
+	/**
+	 * the end of a request body is known only with the chunked coding
+	 * as the last one (RFC 7230 3.3.3). Content-Length can't frame it,
+	 * the server and a proxy would disagree on the end of the request,
+	 * the request is rejected and the connection closed.
+	 * A response without chunked coding ends with the connection.
+	 */
+	if (valuelen > 0 && message->uri != NULL &&
+		(message->version < HTTP11 || !_httpmessage_lastcoding(value, valuelen, STRING_REF(str_chunked))))
+	{
+		warn("message: Transfer-Encoding without chunked framing");
+		return EREJECT;
+	}
+	/// the chunked coding is the last one of the list and overrides Content-Length
+	if (valuelen > 0 && _httpmessage_lastcoding(value, valuelen, STRING_REF(str_chunked)))
+	{
+		message->mode |= HTTPMESSAGE_CHUNKED;
+		message->content_length = (unsigned long long) -1;
+	}
+	valuelen = _httpmessage_headervalue(message, HEADER_STATUS, &value);
 	if (valuelen > 0)
 	{
 		long intvalue = strtol(value, &endvalue, 10);
 		if (endvalue - value == valuelen)
 			httpmessage_result(message, intvalue);
 	}
-	valuelen = dbentry_search(message->headers, str_cookie, &value);
-	if ((valuelen > 0) && (message->cookies == NULL))
+	return ESUCCESS;
+}
+
+/**
+ * @brief call the connector, or give it to a worker of the server
+ * for a blocking connector.
+ *
+ * The response is suspended during the job, and the result
+ * of the worker is returned on the next call for the same connector.
+ *
+ * @return the result of the connector, or EPENDING during the job
+ */
+int _httpconnector_call(const http_connector_list_t *connector, http_message_t *request, http_message_t *response)
+{
+#ifdef HTTPSERVER_WORKERS
+	http_connector_job_t *job = response->job;
+	if (job != NULL && job->connector == connector)
+	{
+		int ret = job->ret;
+		vfree(job);
+		response->job = NULL;
+		return ret;
+	}
+	http_connector_queue_t *queue = (response->client)? response->client->server->jobs: NULL;
+	if (connector->blocking && job == NULL && queue != NULL)
 	{
-		int nbchunks = ((valuelen + 1) / _buffer_chunksize(-1)) + 1;
-		message->cookie_storage = _buffer_create(str_cookie, nbchunks);
-		_buffer_append(message->cookie_storage, value, valuelen);
-		_buffer_filldb(message->cookie_storage, &message->cookies, '=', ';');
+		job = vcalloc(1, sizeof(*job));
+		if (job == NULL)
+			return EREJECT;
+		job->connector = connector;
+		job->func = connector->func;
+		job->arg = connector->arg;
+		job->request = request;
+		job->response = response;
+		job->account = &response->client->memory;
+		job->pending = httpmessage_suspend(response);
+		if (job->pending == NULL)
+		{
+			vfree(job);
+			return EREJECT;
+		}
+		response->job = job;
+		_httpconnector_pushjob(queue, job);
+		return EPENDING;
 	}
-	return ESUCCESS;
+#endif
+	return connector->func(connector->arg, request, response);
 }
 
 int _httpmessage_runconnector(http_message_t *request, http_message_t *response)
@@ -1331,16 +2147,36 @@ int _httpmessage_runconnector(http_message_t *request, http_message_t *response)
 	if (connector && connector->func)
 	{
 		message_dbg("message %p connector \"%s\"", request->client, connector->name);
-		ret = connector->func(connector->arg, request, response);
+		ret = _httpconnector_call(connector, request, response);
 	}
 	return ret;
 }
 
+/**
+ * store the header as "<key>\0<value>\0" and index it
+ */
+static int _httpmessage_storeheader(http_message_t *message, const char *key, size_t keylen, const char *value, size_t valuelen)
+{
+	buffer_t *storage = message->headers_storage;
+	if (_buffer_accept(storage, keylen + 1 + valuelen + 1) != ESUCCESS)
+		return EREJECT;
+	size_t keyoffset = _buffer_length(storage);
+	_buffer_append(storage, key, keylen);
+	_buffer_append(storage, "\0", 1);
+	size_t valueoffset = _buffer_length(storage);
+	if (value != NULL)
+		_buffer_append(storage, value, valuelen);
+	if (_buffer_append(storage, "\0", 1) < 0)
+		return EREJECT;
+	return dbindex_add(&message->headers, storage, _buffer_get(storage, keyoffset), keylen,
+					_buffer_get(storage, valueoffset), valuelen);
+}
+
 int httpmessage_addheader(http_message_t *message, const char *key, const char *value, ssize_t valuelen)
 {
 	if (key == NULL)
 		return EREJECT;
-	if ((message->state & GENERATE_MASK) >= GENERATE_SEPARATOR)
+	if ((message->state & GENERATE_MASK) >= GENERATE_HEADER)
 	{
 		warn("message: result generated, header %s too late", key);
 		return EREJECT;
@@ -1350,7 +2186,9 @@ int httpmessage_addheader(http_message_t *message, const char *key, const char *
 		message->headers_storage = _buffer_create(str_headerstorage, MAXCHUNKS_HEADER);
 	}
 	size_t keylen = strlen(key);
-	if (value != NULL && valuelen == -1)
+	if (value == NULL)
+		valuelen = 0;
+	else if (valuelen == -1)
 		valuelen = strlen(value);
 	int ret = 0;
 	const string_t mulitdefined[] = {
@@ -1361,347 +2199,1279 @@ int httpmessage_addheader(http_message_t *message, const char *key, const char *
 		if (!_string_cmp(&mulitdefined[i], key, keylen))
 			ret = 1;
 	}
-	if (ret == 0)
-	{
-		const char *prevkey = strstr(message->headers_storage->data, key);
-		if (prevkey != NULL && prevkey[keylen] == ':')
-		{
-			err("message: header already present %s %.*s", key, (int)valuelen, prevkey + keylen + 1);
-			return EREJECT;
-		}
-	}
-	if (_buffer_accept(message->headers_storage, keylen + 2 + valuelen + 2) == ESUCCESS)
+	int known = _httpmessage_knownheader(key, keylen);
+	if (ret == 0 && known != EREJECT)
+		ret = (message->headers_known[known] != 0)? -1 : 0;
+	else if (ret == 0)
+		ret = (dbindex_find(&message->headers, dbindex_hash(key, keylen), key, keylen) != EREJECT)? -1 : 0;
+	if (ret < 0)
 	{
-		_buffer_append(message->headers_storage, key, keylen);
-		_buffer_append(message->headers_storage, ": ", 2);
-		if (value != NULL)
-			_buffer_append(message->headers_storage, value, valuelen);
-		_buffer_append(message->headers_storage, "\r\n", 2);
+		err("message: header already present %s", key);
+		return EREJECT;
 	}
-	else
+	int id = _httpmessage_storeheader(message, key, keylen, value, valuelen);
+	if (id < 0)
 	{
 		err("message: buffer too small to add %s", key);
 		return EREJECT;
 	}
+	if (known != EREJECT)
+		message->headers_known[known] = id + 1;
 	return ESUCCESS;
 }
 
 int httpmessage_appendheader(http_message_t *message, const char *key, const char *value, ssize_t valuelen)
 {
-	if (message->headers_storage == NULL)
-	{
-		message->headers_storage = _buffer_create(str_headerstorage, MAXCHUNKS_HEADER);
-	}
 	/**
 	 * check the key of the current header
 	 */
-	const char *end = message->headers_storage->offset - 2;
-	while (*end != '\n' && end >= _buffer_get(message->headers_storage, 0) ) end--;
-	int length = strlen(key);
-	if (strncmp(end + 1, key, length))
+	if (message->headers.count == 0)
+		return EREJECT;
+	dbfield_t *field = &message->headers.fields[message->headers.count - 1];
+	buffer_t *storage = message->headers_storage;
+	size_t length = strlen(key);
+	if (field->key.length != length ||
+		strncmp(_buffer_get(message->headers.storage, field->key.offset), key, length))
 		return EREJECT;
-	/**
-	 * remove the ending \r\n of the previous header
-	 */
-	_buffer_pop(message->headers_storage, 2);
 	if (value == NULL)
 		return EREJECT;
 	if (valuelen == -1)
 		valuelen = strlen(value);
+	if (storage == NULL)
+	{
+		/// the headers are still in the receive buffer
+		storage = _buffer_create(str_headerstorage, MAXCHUNKS_HEADER);
+		message->headers_storage = storage;
+	}
 
-	if (_buffer_accept(message->headers_storage, valuelen) == ESUCCESS)
+	size_t valueoffset = field->value.offset;
+	size_t previouslen = field->value.length;
+	int copy = (message->headers.storage != storage || valueoffset + previouslen + 1 != _buffer_length(storage));
+	size_t needed = valuelen + 1;
+	if (copy)
+		needed += previouslen + 1;
+	/**
+	 * the storage grows before the copy, the previous value may be inside
+	 */
+	if ((_buffer_extend(storage, needed) != ESUCCESS) ||
+		(_buffer_accept(storage, needed) != ESUCCESS))
+	{
+		err("message: headers too long %s", value);
+		return EREJECT;
+	}
+	if (copy)
 	{
-		_buffer_append(message->headers_storage, value, valuelen);
+		/**
+		 * the value is not at the end of the storage, it is copied first
+		 */
+		valueoffset = _buffer_length(storage);
+		_buffer_append(storage, _buffer_get(message->headers.storage, field->value.offset), previouslen);
+		_buffer_append(storage, "\0", 1);
 	}
-	else
+	/**
+	 * remove the ending \0 of the previous value
+	 */
+	_buffer_pop(storage, 1);
+	if (_buffer_append(storage, value, valuelen) < 0)
 	{
 		err("message: headers too long %s", value);
-		_buffer_append(message->headers_storage, "\r\n", 2);
+		_buffer_append(storage, "\0", 1);
 		return EREJECT;
 	}
-	_buffer_append(message->headers_storage, "\r\n", 2);
+	_buffer_append(storage, "\0", 1);
+	field->value.offset = valueoffset;
+	field->value.length = previouslen + valuelen;
 	return ESUCCESS;
 }
 
-int httpmessage_addcontent(http_message_t *message, const char *type, const char *content, int length)
+static time_t _httpmessage_date(const char *value, size_t valuelen)
 {
-	if (message->content == NULL)
+	char date[HTTPMESSAGE_DATEMAXLEN];
+	if (valuelen >= sizeof(date))
+		return (time_t)-1;
+	memcpy(date, value, valuelen);
+	date[valuelen] = '\0';
+	struct tm tm = {0};
+	if (strptime(date, HTTPMESSAGE_DATEFORMAT, &tm) == NULL)
+		return (time_t)-1;
+	return timegm(&tm);
+}
+
+/**
+ * If-None-Match uses the weak comparison, the "W/" prefixes are ignored.
+ */
+static int _httpmessage_matchetag(const char *list, size_t listlen, const char *etag, size_t etaglen)
+{
+	if (etaglen > 2 && !strncmp(etag, "W/", 2))
 	{
-		if (type == NULL)
+		etag += 2;
+		etaglen -= 2;
+	}
+	size_t i = 0;
+	while (i < listlen)
+	{
+		if (list[i] == ' ' || list[i] == ',')
 		{
-			httpmessage_addheader(message, str_contenttype, STRING_REF("text/plain"));
+			i++;
+			continue;
 		}
-		else if (strcmp(type, "none"))
+		if (list[i] == '*')
+			return 1;
+		if (i + 2 < listlen && !strncmp(list + i, "W/", 2))
+			i += 2;
+		size_t start = i;
+		if (list[i] == '"')
 		{
-			httpmessage_addheader(message, str_contenttype, type, -1);
+			const char *end = memchr(list + i + 1, '"', listlen - i - 1);
+			i = (end != NULL)? end - list + 1: listlen;
 		}
+		else
+		{
+			while (i < listlen && list[i] != ',' && list[i] != ' ')
+				i++;
+		}
+		if ((i - start == etaglen) && !memcmp(list + start, etag, etaglen))
+			return 1;
 	}
-	if (message->content_storage == NULL)
-	{
-		message->content_storage = _buffer_create(str_content, MAXCHUNKS_CONTENT);
-	}
-	if (message->content == NULL && content != NULL)
-	{
-		_buffer_reset(message->content_storage, 0);
-		message->content = message->content_storage;
-	}
+	return 0;
+}
 
-	if (content != NULL)
+/**
+ * If-Modified-Since is ignored when If-None-Match is present.
+ */
+static int _httpmessage_notmodified(http_message_t *request, const char *etag, ssize_t etaglen, time_t mtime)
+{
+	if (request->method == NULL ||
+		(request->method->id != MESSAGE_TYPE_GET && request->method->id != MESSAGE_TYPE_HEAD))
+		return 0;
+	const char *value = NULL;
+	ssize_t valuelen = _httpmessage_searchheader(request, str_ifnonematch, &value);
+	if (valuelen > 0)
+		return (etag != NULL && etaglen > 0 && _httpmessage_matchetag(value, valuelen, etag, etaglen));
+	valuelen = _httpmessage_searchheader(request, str_ifmodifiedsince, &value);
+	if (valuelen > 0 && mtime > 0)
 	{
-		buffer_t *buffer = message->content;
-		_buffer_reset(buffer, 0);
-		if (length == -1)
-			length = strnlen(content, buffer->size - 1);
-		length = (buffer->size < length)? buffer->size - 1: length;
-		memcpy(buffer->offset, content, length);
-		buffer->length += length;
-		buffer->offset += length;
-		buffer->data[buffer->length] = '\0';
+		time_t since = _httpmessage_date(value, valuelen);
+		return (since != (time_t)-1 && mtime <= since);
 	}
+	return 0;
+}
 
-	if (_httpmessage_contentempty(message, 1))
+int _httpmessage_conditional(http_message_t *request, http_message_t *response)
+{
+	char hashetag[2 + 2 * 64];
+	size_t hashetaglen = _httpmessage_etagfinish(response, hashetag);
+	response->etaghash = NULL;
+	/// the content is complete, the ETag is the hash of this content
+	if (hashetaglen > 0 && _httpmessage_state(response, PARSE_END) &&
+		_httpmessage_searchheader(response, str_etag, NULL) == EREJECT)
+		httpmessage_addheader(response, str_etag, hashetag, hashetaglen);
+
+	/// a connector which streams its content is not stopped
+	if (response->result != RESULT_200 || !_httpmessage_state(response, PARSE_END))
+		return EREJECT;
+	const char *etag = NULL;
+	ssize_t etaglen = _httpmessage_searchheader(response, str_etag, &etag);
+	const char *modified = NULL;
+	ssize_t modifiedlen = _httpmessage_searchheader(response, str_lastmodified, &modified);
+	time_t mtime = (modifiedlen > 0)? _httpmessage_date(modified, modifiedlen): 0;
+	if (!_httpmessage_notmodified(request, etag, etaglen, mtime))
+		return EREJECT;
+	response->result = RESULT_304;
+	if ((response->content != NULL) && (response->content != response->content_storage))
+		_buffer_destroy(response->content);
+	response->content = NULL;
+	response->content_length = 0;
+	return ESUCCESS;
+}
+
+int httpmessage_validator(http_message_t *request, http_message_t *response, const char *etag, ssize_t etaglen, time_t mtime)
+{
+	if (etag != NULL)
 	{
-		if (length > -1)
-			message->content_length = length;
-		else if (message->content != NULL)
-			message->content_length = message->content->length;
+		if (etaglen == -1)
+			etaglen = strlen(etag);
+		httpmessage_addheader(response, str_etag, etag, etaglen);
 	}
-	if (message->content != NULL && _buffer_get(message->content, 0) != NULL )
+	if (mtime > 0)
 	{
-		return _buffer_length(message->content);
+		char date[HTTPMESSAGE_DATEMAXLEN];
+		struct tm tm = {0};
+		gmtime_r(&mtime, &tm);
+		size_t datelen = strftime(date, sizeof(date), HTTPMESSAGE_DATEFORMAT, &tm);
+		httpmessage_addheader(response, str_lastmodified, date, datelen);
 	}
-	return 0;
+	if (_httpmessage_notmodified(request, etag, etaglen, mtime))
+		return ESUCCESS;
+	return EREJECT;
 }
 
-int httpmessage_appendcontent(http_message_t *message, const char *content, int length)
+#ifdef HTTPCACHE
+/**
+ * the header lines are given as they were sent, after the status line
+ */
+static ssize_t _httpmessage_storedheader(const char *header, size_t headerlen, const char *key, const char **value)
 {
-	if (message->content == NULL && content != NULL)
+	size_t keylen = strlen(key);
+	const char *end = header + headerlen;
+	const char *line = memchr(header, '\n', headerlen);
+	while (line != NULL && ++line < end)
 	{
-		message->content_storage = _buffer_create(str_content, MAXCHUNKS_CONTENT);
-		message->content = message->content_storage;
+		const char *next = memchr(line, '\n', end - line);
+		if (next == NULL)
+			break;
+		size_t linelen = next - line;
+		if (linelen > 0 && line[linelen - 1] == '\r')
+			linelen--;
+		if (linelen > keylen && line[keylen] == ':' && !strncasecmp(line, key, keylen))
+		{
+			*value = line + keylen + 1;
+			while (*value < line + linelen && **value == ' ')
+				(*value)++;
+			return line + linelen - *value;
+		}
+		line = next;
 	}
+	return EREJECT;
+}
 
-	if (message->content != NULL && content != NULL)
+/**
+ * the header lines of the stored response are added to the response,
+ * the length and the connection are generated for this response.
+ */
+static int _httpmessage_storedheaders(http_message_t *response, const char *header, size_t headerlen)
+{
+	const char *end = header + headerlen;
+	const char *line = memchr(header, '\n', headerlen);
+	while (line != NULL && ++line < end)
 	{
-		size_t contentlength = _buffer_length(message->content);
-		if (length == -1)
-			length = strnlen(content, message->content->size - message->content->length);
-		if (!_httpmessage_contentempty(message, 1))
-			message->content_length += length;
-		if (_buffer_append(message->content, content, length) < 0)
+		const char *next = memchr(line, '\n', end - line);
+		if (next == NULL)
+			break;
+		size_t linelen = next - line;
+		if (linelen > 0 && line[linelen - 1] == '\r')
+			linelen--;
+		const char *separator = memchr(line, ':', linelen);
+		if (separator != NULL && separator - line < HTTPMESSAGE_KEYMAXLEN)
+		{
+			char key[HTTPMESSAGE_KEYMAXLEN];
+			size_t keylen = separator - line;
+			memcpy(key, line, keylen);
+			key[keylen] = '\0';
+			const char *value = separator + 1;
+			while (value < line + linelen && *value == ' ')
+				value++;
+			if (strcasecmp(key, str_contentlength) && strcasecmp(key, str_connection) &&
+				httpmessage_addheader(response, key, value, line + linelen - value) != ESUCCESS)
+				return EREJECT;
+		}
+		line = next;
+	}
+	return ESUCCESS;
+}
+
+/**
+ * The conditional and the Range requests are answered from a stored
+ * response as from the response of a connector: the validators of the
+ * stored header select "304 Not Modified", and the ranges are cut from
+ * a copy of the stored content by _httpmessage_partial.
+ *
+ * @return ESUCCESS if the response is built, EREJECT to send the stored response
+ */
+int _httpmessage_restore(http_message_t *request, http_message_t *response, const char *header, size_t headerlen, const char *content, size_t contentlen)
+{
+	const char *etag = NULL;
+	ssize_t etaglen = _httpmessage_storedheader(header, headerlen, str_etag, &etag);
+	const char *modified = NULL;
+	ssize_t modifiedlen = _httpmessage_storedheader(header, headerlen, str_lastmodified, &modified);
+	time_t mtime = (modifiedlen > 0)? _httpmessage_date(modified, modifiedlen): 0;
+	if (_httpmessage_notmodified(request, etag, etaglen, mtime))
+	{
+		if (_httpmessage_storedheaders(response, header, headerlen) != ESUCCESS)
 			return EREJECT;
-		return _buffer_length(message->content) - contentlength;
+		response->result = RESULT_304;
+		response->content_length = 0;
+		return ESUCCESS;
 	}
-	return httpclient_server(message->client)->config->chunksize;
+	if (request->method == NULL || request->method->id != MESSAGE_TYPE_GET ||
+		_httpmessage_searchheader(request, str_range, NULL) == EREJECT)
+		return EREJECT;
+	buffer_t *storage = _buffer_create(str_content, contentlen / _buffer_chunksize(0) + 2);
+	if (storage == NULL)
+		return EREJECT;
+	if (_buffer_accept(storage, contentlen) != ESUCCESS ||
+		_buffer_append(storage, content, contentlen) < 0 ||
+		_httpmessage_storedheaders(response, header, headerlen) != ESUCCESS)
+	{
+		_buffer_destroy(storage);
+		return EREJECT;
+	}
+	if (response->content_storage != NULL)
+		_buffer_destroy(response->content_storage);
+	response->content_storage = storage;
+	response->content = storage;
+	response->content_length = contentlen;
+	return ESUCCESS;
 }
+#endif
 
-int httpmessage_keepalive(http_message_t *message)
+int httpmessage_etag(http_message_t *message, const struct hash_s *hash)
 {
-	message->mode |= HTTPMESSAGE_KEEPALIVE;
-	return httpclient_socket(message->client);
+	if (hash == NULL || hash->size > 64 || (message->state & GENERATE_MASK) >= GENERATE_HEADER)
+		return EREJECT;
+	_httpmessage_etagfinish(message, NULL);
+	message->etaghash = hash;
+	/// the content already appended is hashed now
+	if (message->content != NULL && _buffer_length(message->content) > 0)
+		_httpmessage_etagupdate(message, _buffer_get(message->content, 0), _buffer_length(message->content));
+	return ESUCCESS;
 }
 
-int httpmessage_lock(http_message_t *message)
+#define HTTPMESSAGE_PARTHEADERLEN 320
+#define HTTPMESSAGE_PARTTYPELEN 128
+
+static size_t _httpmessage_rangenumber(const char *value, size_t length, unsigned long long *number, int *found)
 {
-	message->mode |= HTTPMESSAGE_LOCKED;
-	return httpclient_socket(message->client);
+	size_t i = 0;
+	*number = 0;
+	*found = 0;
+	while (i < length && value[i] >= '0' && value[i] <= '9')
+	{
+		/// a too large value is kept to the maximum, it is out of the document
+		if (*number < (ULLONG_MAX - 9) / 10)
+			*number = *number * 10 + (value[i] - '0');
+		else
+			*number = ULLONG_MAX;
+		*found = 1;
+		i++;
+	}
+	return i;
 }
 
-int httpmessage_isprotected(http_message_t *message)
+/**
+ * The value is "bytes=first-last, first-, -suffix".
+ * The Range header is ignored (-1) when it is invalid or when it contains
+ * too many ranges, 0 means that no range is satisfiable.
+ */
+static int _httpmessage_parseranges(const char *value, size_t valuelen, size_t size, http_message_ranges_t *ranges)
 {
-	if (message->method == NULL)
+	if (valuelen < 6 || strncasecmp(value, "bytes=", 6))
 		return -1;
-	else
-		return ((message->method->properties & MESSAGE_PROTECTED) == MESSAGE_PROTECTED);
+	size_t i = 6;
+	int count = 0;
+	while (i < valuelen)
+	{
+		if (value[i] == ' ' || value[i] == '\t' || value[i] == ',')
+		{
+			i++;
+			continue;
+		}
+		unsigned long long first = 0;
+		unsigned long long last = 0;
+		int hasfirst = 0;
+		int haslast = 0;
+		i += _httpmessage_rangenumber(value + i, valuelen - i, &first, &hasfirst);
+		if (i >= valuelen || value[i] != '-')
+			return -1;
+		i++;
+		i += _httpmessage_rangenumber(value + i, valuelen - i, &last, &haslast);
+		while (i < valuelen && (value[i] == ' ' || value[i] == '\t'))
+			i++;
+		if ((i < valuelen && value[i] != ',') ||
+			(!hasfirst && !haslast) ||
+			(hasfirst && haslast && last < first))
+			return -1;
+		if (!hasfirst)
+		{
+			/// the suffix is the end of the document
+			if (last == 0 || size == 0)
+				continue;
+			first = (last < size)? size - last: 0;
+			last = size - 1;
+		}
+		else if (first >= size)
+			continue;
+		else if (!haslast || last >= size)
+			last = size - 1;
+		if (count == HTTPMESSAGE_MAXRANGES)
+			return -1;
+		ranges->parts[count].start = first;
+		ranges->parts[count].length = last - first + 1;
+		count++;
+	}
+	return count;
 }
 
-static char host[NI_MAXHOST] = {0};
-static char service[NI_MAXSERV];
+/**
+ * the parts are sorted and the overlapping or adjacent ones are merged
+ */
+static int _httpmessage_mergeranges(http_message_ranges_t *ranges, int count)
+{
+	for (int i = 1; i < count; i++)
+	{
+		off_t start = ranges->parts[i].start;
+		size_t length = ranges->parts[i].length;
+		int j = i;
+		for (; j > 0 && ranges->parts[j - 1].start > start; j--)
+			ranges->parts[j] = ranges->parts[j - 1];
+		ranges->parts[j].start = start;
+		ranges->parts[j].length = length;
+	}
+	int last = 0;
+	for (int i = 1; i < count; i++)
+	{
+		off_t end = ranges->parts[last].start + ranges->parts[last].length;
+		if (ranges->parts[i].start <= end)
+		{
+			off_t iend = ranges->parts[i].start + ranges->parts[i].length;
+			if (iend > end)
+				ranges->parts[last].length = iend - ranges->parts[last].start;
+		}
+		else
+			ranges->parts[++last] = ranges->parts[i];
+	}
+	return last + 1;
+}
 
-const char *httpmessage_SERVER(http_message_t *message, const char *key)
+/**
+ * If-Range keeps the Range only for the same document,
+ * the entity tags use the strong comparison.
+ */
+static int _httpmessage_ifrange(http_message_t *request, http_message_t *response)
 {
-	if (message->client == NULL || httpclient_server(message->client) == NULL)
-		return NULL;
 	const char *value = NULL;
+	ssize_t valuelen = _httpmessage_searchheader(request, str_ifrange, &value);
+	if (valuelen <= 0)
+		return 1;
+	if (value[0] == '"' || !strncmp(value, "W/", 2))
+	{
+		const char *etag = NULL;
+		ssize_t etaglen = _httpmessage_searchheader(response, str_etag, &etag);
+		return (etaglen == valuelen && etag[0] == '"' && !memcmp(etag, value, etaglen));
+	}
+	const char *modified = NULL;
+	ssize_t modifiedlen = _httpmessage_searchheader(response, str_lastmodified, &modified);
+	if (modifiedlen <= 0)
+		return 0;
+	time_t date = _httpmessage_date(value, valuelen);
+	return (date != (time_t)-1 && _httpmessage_date(modified, modifiedlen) == date);
+}
 
-	httpmessage_REQUEST2(message, key, &value);
-	return value;
+static size_t _httpmessage_partheader(const http_message_t *response, int part, char *header, size_t headerlen)
+{
+	const http_message_ranges_t *ranges = response->ranges;
+	unsigned long long first = ranges->parts[part].start;
+	unsigned long long last = first + ranges->parts[part].length - 1;
+	int length;
+	if (ranges->typelength > 0)
+		length = snprintf(header, headerlen, "\r\n--%s\r\n%s: %.*s\r\n%s: bytes %llu-%llu/%zu\r\n\r\n",
+				ranges->boundary, str_contenttype,
+				(int)ranges->typelength, _buffer_get(response->headers.storage, ranges->typeoffset),
+				str_contentrange, first, last, ranges->size);
+	else
+		length = snprintf(header, headerlen, "\r\n--%s\r\n%s: bytes %llu-%llu/%zu\r\n\r\n",
+				ranges->boundary, str_contentrange, first, last, ranges->size);
+	return (length > 0 && length < headerlen)? length: 0;
 }
 
-const char *httpmessage_REQUEST(http_message_t *message, const char *key)
+static size_t _httpmessage_partclose(const http_message_t *response, char *close, size_t closelen)
+{
+	int length = snprintf(close, closelen, "\r\n--%s--\r\n", response->ranges->boundary);
+	return (length > 0 && length < closelen)? length: 0;
+}
+
+/**
+ * The parts of the document are selected without change of the response.
+ * The length of the content is the sum of the parts and of
+ * the multipart/byteranges delimiters.
+ *
+ * @return the number of parts, 0 if no one is satisfiable, -1 to send the whole document
+ */
+static int _httpmessage_selectranges(http_message_t *request, http_message_t *response, size_t size)
 {
+	http_message_ranges_t *ranges = response->ranges;
+	ranges->size = size;
+	int count = -1;
 	const char *value = NULL;
-	httpmessage_REQUEST2(message, key, &value);
-	return value;
+	ssize_t valuelen = EREJECT;
+	if (request->method != NULL && request->method->id == MESSAGE_TYPE_GET &&
+		response->result == RESULT_200)
+		valuelen = _httpmessage_searchheader(request, str_range, &value);
+	if (valuelen > 0 && _httpmessage_ifrange(request, response))
+		count = _httpmessage_parseranges(value, valuelen, size, ranges);
+	if (count < 0)
+	{
+		ranges->parts[0].start = 0;
+		ranges->parts[0].length = size;
+		ranges->count = 1;
+		ranges->total = size;
+		return -1;
+	}
+	if (count == 0)
+		return 0;
+	ranges->count = _httpmessage_mergeranges(ranges, count);
+	if (ranges->count == 1)
+	{
+		ranges->total = ranges->parts[0].length;
+		return 1;
+	}
+	ranges->multipart = 1;
+	snprintf(ranges->boundary, sizeof(ranges->boundary), "%08lx%012llx",
+			(unsigned long)time(NULL) & 0xFFFFFFFFUL, (unsigned long long)(uintptr_t)response & 0xFFFFFFFFFFFFULL);
+	const char *type = NULL;
+	ssize_t typelen = _httpmessage_headervalue(response, HEADER_CONTENTTYPE, &type);
+	if (typelen > 0 && typelen < HTTPMESSAGE_PARTTYPELEN)
+	{
+		ranges->typeoffset = type - _buffer_get(response->headers.storage, 0);
+		ranges->typelength = typelen;
+	}
+	char header[HTTPMESSAGE_PARTHEADERLEN];
+	ranges->total = _httpmessage_partclose(response, header, sizeof(header));
+	for (int i = 0; i < ranges->count; i++)
+		ranges->total += _httpmessage_partheader(response, i, header, sizeof(header)) + ranges->parts[i].length;
+	return ranges->count;
 }
 
-size_t httpmessage_REQUEST2(http_message_t *message, const char *key, const char **value)
+/**
+ * the new value is stored after the previous one into the storage
+ */
+int _httpmessage_replaceheader(http_message_t *message, const char *key, const char *value, size_t valuelen)
 {
-	size_t valuelen = 0;
-	*value = NULL;
-	if (!strcasecmp(key, "uri") && (message->uri != NULL))
+	size_t keylen = strlen(key);
+	int known = _httpmessage_knownheader(key, keylen);
+	int id;
+	if (known != EREJECT)
+		id = message->headers_known[known] - 1;
+	else
+		id = dbindex_find(&message->headers, dbindex_hash(key, keylen), key, keylen);
+	if (id < 0)
+		return httpmessage_addheader(message, key, value, valuelen);
+	buffer_t *storage = message->headers_storage;
+	size_t valueoffset = _buffer_length(storage);
+	if ((_buffer_accept(storage, valuelen + 1) != ESUCCESS) ||
+		(_buffer_append(storage, value, valuelen) < 0) ||
+		(_buffer_append(storage, "\0", 1) < 0))
+		return EREJECT;
+	dbfield_t *field = &message->headers.fields[id];
+	field->value.offset = valueoffset;
+	field->value.length = valuelen;
+	return ESUCCESS;
+}
+
+/**
+ * the result and the headers of the response are set for the selected parts
+ */
+static int _httpmessage_applyranges(http_message_t *response, int count)
+{
+	http_message_ranges_t *ranges = response->ranges;
+	char value[HTTPMESSAGE_PARTHEADERLEN];
+	int length;
+	if (count == 0)
+	{
+		response->result = RESULT_416;
+		length = snprintf(value, sizeof(value), "bytes */%zu", ranges->size);
+		httpmessage_addheader(response, str_contentrange, value, length);
+		/// the content is empty, the error message is not added
+		if (response->content_storage == NULL)
+			response->content_storage = _buffer_create(str_content, MAXCHUNKS_CONTENT);
+		if (response->content_storage != NULL)
+			_buffer_reset(response->content_storage, 0);
+		response->content = response->content_storage;
+		ranges->count = 0;
+		ranges->total = 0;
+		response->content_length = 0;
+		return EREJECT;
+	}
+	if (count < 0)
+		return ESUCCESS;
+	response->result = RESULT_206;
+	/// the ETag is the one of the whole document, not the hash of the parts
+	_httpmessage_etagfinish(response, NULL);
+	response->etaghash = NULL;
+	if (!ranges->multipart)
+	{
+		unsigned long long first = ranges->parts[0].start;
+		length = snprintf(value, sizeof(value), "bytes %llu-%llu/%zu",
+				first, first + ranges->parts[0].length - 1, ranges->size);
+		return httpmessage_addheader(response, str_contentrange, value, length);
+	}
+	length = snprintf(value, sizeof(value), "%s%s", str_byteranges, ranges->boundary);
+	return _httpmessage_replaceheader(response, str_contenttype, value, length);
+}
+
+/**
+ * the delimiter of the next part, or the close delimiter after the last one,
+ * is appended to the content.
+ */
+static int _httpmessage_nextrange(http_message_t *response, buffer_t *content, off_t *offset, size_t *length)
+{
+	http_message_ranges_t *ranges = response->ranges;
+	char header[HTTPMESSAGE_PARTHEADERLEN];
+	size_t headerlen = 0;
+	int ret = ECONTINUE;
+	if (ranges->next > ranges->count)
+		return ESUCCESS;
+	if (ranges->next == ranges->count)
 	{
-		*value = _buffer_get(message->uri, 0);
-		valuelen = _buffer_length(message->uri);
-		/**
-		 * For security all the first '/' (and %2f == /) are removed.
-		 * The module may use the URI as a path on the file system,
-		 * but an absolute path may be dangerous if the module doesn't
-		 * manage correctly the "root" directory.
-		 *
-		 * /%2f///%2f//etc/password translated to etc/password
-		 *
-		 */
-		/**
-		 * the full URI is necessary for authentication and filter
-		 *
-		while (**value == '/' && **value != '\0') *value++;
-		 */
+		if (ranges->multipart)
+			headerlen = _httpmessage_partclose(response, header, sizeof(header));
+		ret = ESUCCESS;
 	}
-	else if (!strcasecmp(key, "query") && (message->query_storage != NULL))
+	else
+	{
+		*offset = ranges->parts[ranges->next].start;
+		*length = ranges->parts[ranges->next].length;
+		if (ranges->multipart)
+			headerlen = _httpmessage_partheader(response, ranges->next, header, sizeof(header));
+	}
+	if (headerlen > 0 &&
+		((_buffer_accept(content, headerlen) != ESUCCESS) ||
+		(_buffer_append(content, header, headerlen) < 0)))
+		return EREJECT;
+	ranges->next++;
+	return ret;
+}
+
+/**
+ * A complete content is cut to the parts, if the connector
+ * did not select them with httpmessage_range.
+ */
+int _httpmessage_partial(http_message_t *request, http_message_t *response)
+{
+	if (response->ranges != NULL)
 	{
-		if (message->queries)
+		/// the connector may append data before the header is generated
+		if (response->result == RESULT_200 || response->result == RESULT_206)
+			response->content_length = response->ranges->total;
+		return ESUCCESS;
+	}
+	if (response->result != RESULT_200 || !_httpmessage_state(response, PARSE_END) ||
+		response->content == NULL ||
+		_httpmessage_searchheader(request, str_range, NULL) == EREJECT)
+		return EREJECT;
+	size_t size = _buffer_length(response->content);
+	if (!_httpmessage_contentempty(response, 1) && response->content_length != size)
+		return EREJECT;
+	response->ranges = vcalloc(1, sizeof(*response->ranges));
+	if (response->ranges == NULL)
+		return EREJECT;
+	int count = _httpmessage_selectranges(request, response, size);
+	buffer_t *content = NULL;
+	if (count > 0)
+		content = _buffer_create(str_content, response->ranges->total / _buffer_chunksize(0) + 2);
+	if (content != NULL && _buffer_accept(content, response->ranges->total) == ESUCCESS)
+	{
+		off_t offset = 0;
+		size_t length = 0;
+		int ret;
+		while ((ret = _httpmessage_nextrange(response, content, &offset, &length)) == ECONTINUE)
 		{
-			_buffer_serializedb(message->query_storage , message->queries, '=', '&');
-			dbentry_destroy(message->queries);
-			message->queries = NULL;
+			if (_buffer_append(content, _buffer_get(response->content, offset), length) < 0)
+				break;
 		}
-		*value = _buffer_get(message->query_storage, 0);
-		valuelen = _buffer_length(message->query_storage);
+		if (ret != ESUCCESS)
+			count = -1;
 	}
-	else if (!strcasecmp(key, "scheme"))
-	{
-		*value = _string_get(&message->client->scheme);
-		valuelen = _string_length(&message->client->scheme);
+	else
+		count = (count > 0)? -1: count;
+	if (count < 0)
+	{
+		/// the whole document is sent
+		if (content != NULL)
+			_buffer_destroy(content);
+		vfree(response->ranges);
+		response->ranges = NULL;
+		return EREJECT;
 	}
-	else if (!strcasecmp(key, "version"))
+	_httpmessage_applyranges(response, count);
+	if (count == 0)
+		return ESUCCESS;
+	if (response->content != response->content_storage)
+		_buffer_destroy(response->content);
+	_buffer_destroy(response->content_storage);
+	response->content_storage = content;
+	response->content = content;
+	response->content_length = response->ranges->total;
+	return ESUCCESS;
+}
+
+int httpmessage_range(http_message_t *request, http_message_t *response, size_t size, off_t *offset, size_t *length)
+{
+	if (response->ranges == NULL)
 	{
-		valuelen = httpserver_version(message->version, value);
+		if ((response->state & GENERATE_MASK) >= GENERATE_HEADER)
+		{
+			warn("message: result generated, range too late");
+			return EREJECT;
+		}
+		response->ranges = vcalloc(1, sizeof(*response->ranges));
+		if (response->ranges == NULL)
+			return EREJECT;
+		int count = _httpmessage_selectranges(request, response, size);
+		if (_httpmessage_applyranges(response, count) != ESUCCESS)
+			return EREJECT;
+		response->content_length = response->ranges->total;
 	}
-	else if (!strcasecmp(key, "method") && (message->method))
+	if (response->ranges->multipart && response->content == NULL)
 	{
-		*value = _string_get(&message->method->key);
-		valuelen = _string_length(&message->method->key);
+		if (response->content_storage == NULL)
+			response->content_storage = _buffer_create(str_content, MAXCHUNKS_CONTENT);
+		if (response->content_storage == NULL)
+			return EREJECT;
+		_buffer_reset(response->content_storage, 0);
+		response->content = response->content_storage;
 	}
-	else if (!strcasecmp(key, "result"))
+	return _httpmessage_nextrange(response, response->content, offset, length);
+}
+
+int httpmessage_addcontent(http_message_t *message, const char *type, const char *content, int length)
+{
+	if (message->content == NULL)
 	{
-		int i = 0;
-		while (_http_message_result[i] != NULL)
+		if (type == NULL)
 		{
-			if (_http_message_result[i]->result == message->result)
-			{
-				*value = _string_get(&_http_message_result[i]->status);
-				valuelen = _string_length(&_http_message_result[i]->status);
-				break;
-			}
-			i++;
+			httpmessage_addheader(message, str_contenttype, STRING_REF("text/plain"));
+		}
+		else if (strcmp(type, "none"))
+		{
+			httpmessage_addheader(message, str_contenttype, type, -1);
 		}
 	}
-	else if (!strcasecmp(key, "content") && (message->content != NULL))
+	if (message->content_storage == NULL)
 	{
-		*value = _buffer_get(message->content, 0);
-		valuelen = _buffer_length(message->content);
+		message->content_storage = _buffer_create(str_content, MAXCHUNKS_CONTENT);
 	}
-	else if (!strcasecmp(key, str_contenttype))
+	if (message->content == NULL && content != NULL)
 	{
-		valuelen = dbentry_search(message->headers, key, value);
+		_buffer_reset(message->content_storage, 0);
+		message->content = message->content_storage;
 	}
-	else if (!strncasecmp(key, "remote_addr", 11))
+
+	if (content != NULL)
 	{
-		if (message->client == NULL)
-			return 0;
-		struct sockaddr_storage *sin = &message->client->addr;
-		socklen_t len = sizeof(message->client->addr);
+		buffer_t *buffer = message->content;
+		_buffer_reset(buffer, 0);
+		if (length == -1)
+			length = strnlen(content, buffer->size - 1);
+		length = (buffer->size < length)? buffer->size - 1: length;
+		memcpy(buffer->offset, content, length);
+		buffer->length += length;
+		buffer->offset += length;
+		buffer->data[buffer->length] = '\0';
+		/// the content is replaced
+		_httpmessage_etagfinish(message, NULL);
+		_httpmessage_etagupdate(message, content, length);
+	}
 
-		memset(host, 0, NI_MAXHOST);
-		valuelen = tcpserver_getname(sin, len, host, NI_MAXHOST, 0);
-		if ((ssize_t)valuelen > -1)
-			*value = host;
-		else
-			valuelen = 0;
+	if (_httpmessage_contentempty(message, 1))
+	{
+		if (length > -1)
+			message->content_length = length;
+		else if (message->content != NULL)
+			message->content_length = message->content->length;
+		/// the declared length already counts the content appended later
+		if (content == NULL && length > 0)
+			message->mode |= HTTPMESSAGE_LENGTHSET;
 	}
-	else if (!strncasecmp(key, "remote_host", 11))
+	if (message->content != NULL && _buffer_get(message->content, 0) != NULL )
 	{
-		if (message->client == NULL)
-			return 0;
-		struct sockaddr_storage *sin = &message->client->addr;
-		socklen_t len = sizeof(message->client->addr);
+		return _buffer_length(message->content);
+	}
+	return 0;
+}
 
-		memset(host, 0, NI_MAXHOST);
-		valuelen = tcpserver_getname(sin, len, host, NI_MAXHOST, 1);
-		if ((ssize_t)valuelen > -1)
-			*value = host;
-		else
-			valuelen = 0;
+int httpmessage_appendcontent(http_message_t *message, const char *content, int length)
+{
+	if (message->content == NULL && content != NULL)
+	{
+		message->content_storage = _buffer_create(str_content, MAXCHUNKS_CONTENT);
+		message->content = message->content_storage;
 	}
-	else if (!strncasecmp(key, "remote_port", 11))
+
+	if (message->content != NULL && content != NULL)
 	{
-		if (message->client == NULL)
-			return 0;
-		struct sockaddr_storage *sin = &message->client->addr;
-		socklen_t len = sizeof(message->client->addr);
+		size_t contentlength = _buffer_length(message->content);
+		if (length == -1)
+			length = strnlen(content, message->content->size - message->content->length);
+		/// the rest of the data is given again by the connector on its next call
+		size_t available = _buffer_available(message->content);
+		if ((size_t)length > available)
+			length = available;
+		if (length > 0 && _buffer_append(message->content, content, length) < 0)
+			return EREJECT;
+		length = _buffer_length(message->content) - contentlength;
+		if (!_httpmessage_contentempty(message, 1) &&
+			!(message->mode & HTTPMESSAGE_LENGTHSET))
+			message->content_length += length;
+		_httpmessage_etagupdate(message, content, length);
+		return length;
+	}
+	return httpclient_server(message->client)->config->chunksize;
+}
 
-		memset(service, 0, NI_MAXSERV);
-		valuelen = tcpserver_getname(sin, len, service, NI_MAXSERV, 2);
-		if ((ssize_t)valuelen > -1)
-			*value = service;
-		else
-			return 0;
+size_t httpmessage_sendwindow(http_message_t *message)
+{
+	size_t window = _httpclient_sendwindow(message->client);
+	/// the content not yet generated goes to the output too
+	size_t length = (message->content != NULL)? _buffer_length(message->content) : 0;
+	window = (window > length)? window - length : 0;
+	/// and the content buffer takes the appended data until the next call
+	size_t available = MAXCHUNKS_CONTENT * _buffer_chunksize(-1);
+	if (message->content != NULL)
+		available = _buffer_available(message->content);
+	return (window > available)? available : window;
+}
+
+int httpmessage_keepalive(http_message_t *message)
+{
+	message->mode |= HTTPMESSAGE_KEEPALIVE;
+	return httpclient_socket(message->client);
+}
+
+int httpmessage_lock(http_message_t *message)
+{
+	message->mode |= HTTPMESSAGE_LOCKED;
+	return httpclient_socket(message->client);
+}
+
+http_message_pending_t *httpmessage_suspend(http_message_t *message)
+{
+	if (message->client == NULL || message->pending != NULL)
+		return NULL;
+	int fd = _httpclient_wakeup(message->client);
+	if (fd < 0)
+		return NULL;
+	http_message_pending_t *pending = vcalloc(1, sizeof(*pending));
+	if (pending == NULL)
+		return NULL;
+	/// the job may resume after the end of the client
+	pending->fd = dup(fd);
+	if (pending->fd < 0)
+	{
+		err("message: wake up error %s", strerror(errno));
+		vfree(pending);
+		return NULL;
 	}
-	else if (!strcasecmp(key, "port"))
+	/// one reference for the message and one for the job
+	pending->ref = 2;
+	message->pending = pending;
+	return pending;
+}
+
+void httpmessage_resume(http_message_pending_t *pending)
+{
+	if (pending == NULL)
+		return;
+	__atomic_store_n(&pending->resumed, 1, __ATOMIC_RELEASE);
+	/// a full socket already wakes up the client
+	if ((send(pending->fd, "", 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) && (errno != EAGAIN))
 	{
-		struct sockaddr_storage sin = {0};
-		socklen_t len = sizeof(sin);
+		warn("message: resume on closed client %s", strerror(errno));
+	}
+	_httpmessage_releasepending(pending);
+}
+
+void _httpmessage_releasepending(http_message_pending_t *pending)
+{
+	if (pending == NULL || __atomic_sub_fetch(&pending->ref, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	close(pending->fd);
+	vfree(pending);
+}
+
+int _httpmessage_suspended(const http_message_t *message)
+{
+	return (message->pending != NULL &&
+		!__atomic_load_n(&message->pending->resumed, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * the handle is dropped as soon as the job resumed the message
+ */
+int _httpmessage_pending(http_message_t *message)
+{
+	if (message->pending == NULL)
+		return 0;
+	if (_httpmessage_suspended(message))
+		return 1;
+	_httpmessage_releasepending(message->pending);
+	message->pending = NULL;
+	return 0;
+}
+
+int httpmessage_isprotected(http_message_t *message)
+{
+	if (message->method == NULL)
+		return -1;
+	else
+		return ((message->method->properties & MESSAGE_PROTECTED) == MESSAGE_PROTECTED);
+}
+
+const char *httpmessage_SERVER(http_message_t *message, const char *key)
+{
+	if (message->client == NULL || httpclient_server(message->client) == NULL)
+		return NULL;
+	const char *value = NULL;
+
+	httpmessage_REQUEST2(message, key, &value);
+	return value;
+}
+
+const char *httpmessage_REQUEST(http_message_t *message, const char *key)
+{
+	const char *value = NULL;
+	httpmessage_REQUEST2(message, key, &value);
+	return value;
+}
+
+static size_t _httpmessage_requesturi(http_message_t *message, const char **value)
+{
+	if (message->uri == NULL)
+		return EREJECT;
+	*value = _buffer_get(message->uri, 0);
+	/**
+	 * For security all the first '/' (and %2f == /) are removed.
+	 * The module may use the URI as a path on the file system,
+	 * but an absolute path may be dangerous if the module doesn't
+	 * manage correctly the "root" directory.
+	 *
+	 * /%2f///%2f//etc/password translated to etc/password
+	 *
+	 */
+	/**
+	 * the full URI is necessary for authentication and filter
+	 *
+	while (**value == '/' && **value != '\0') *value++;
+	 */
+	return _buffer_length(message->uri);
+}
+
+static size_t _httpmessage_requestquery(http_message_t *message, const char **value)
+{
+	if (message->query_storage == NULL)
+		return EREJECT;
+	*value = _buffer_get(message->query_storage, 0);
+	return _buffer_length(message->query_storage);
+}
+
+static size_t _httpmessage_requestscheme(http_message_t *message, const char **value)
+{
+	*value = _string_get(&message->client->scheme);
+	return _string_length(&message->client->scheme);
+}
+
+static size_t _httpmessage_requestversion(http_message_t *message, const char **value)
+{
+	return httpserver_version(message->version, value);
+}
+
+static size_t _httpmessage_requestmethod(http_message_t *message, const char **value)
+{
+	if (message->method == NULL)
+		return EREJECT;
+	*value = _string_get(&message->method->key);
+	return _string_length(&message->method->key);
+}
+
+static size_t _httpmessage_requestresult(http_message_t *message, const char **value)
+{
+	const _http_message_result_t *result = _httpmessage_result(message->result);
+	if (result == NULL)
+		return 0;
+	*value = _string_get(&result->status);
+	return _string_length(&result->status);
+}
+
+static size_t _httpmessage_requestcontent(http_message_t *message, const char **value)
+{
+	if (message->content == NULL)
+		return EREJECT;
+	*value = _buffer_get(message->content, 0);
+	return _buffer_length(message->content);
+}
+
+static size_t _httpmessage_requestcontenttype(http_message_t *message, const char **value)
+{
+	return _httpmessage_searchheader(message, str_contenttype, value);
+}
+
+static size_t _httpmessage_requestname(const http_client_name_t *name, const char **value)
+{
+	if (name->length > 0)
+		*value = name->data;
+	return name->length;
+}
+
+static size_t _httpmessage_requestremoteaddr(http_message_t *message, const char **value)
+{
+	if (message->client == NULL)
+		return 0;
+	_httpclient_names(message->client);
+	return _httpmessage_requestname(&message->client->remote_addr, value);
+}
+
+static size_t _httpmessage_requestremotehost(http_message_t *message, const char **value)
+{
+	if (message->client == NULL)
+		return 0;
+	return _httpclient_remotehost(message->client, value);
+}
+
+static size_t _httpmessage_requestremoteport(http_message_t *message, const char **value)
+{
+	if (message->client == NULL)
+		return 0;
+	_httpclient_names(message->client);
+	return _httpmessage_requestname(&message->client->remote_port, value);
+}
+
+static size_t _httpmessage_requestport(http_message_t *message, const char **value)
+{
+	if (message->client == NULL)
+		return 0;
+	_httpclient_names(message->client);
+	return _httpmessage_requestname(&message->client->local_port, value);
+}
 
-		memset(service, 0, NI_MAXSERV);
-		if (!getsockname(httpclient_socket(message->client), (struct sockaddr *)&sin, &len))
+static size_t _httpmessage_requestaddr(http_message_t *message, const char **value)
+{
+	if (message->client == NULL)
+		return 0;
+	_httpclient_names(message->client);
+	size_t valuelen = _httpmessage_requestname(&message->client->local_addr, value);
+	if (valuelen == 0)
+		valuelen = httpserver_INFO2(httpclient_server(message->client), "addr", value);
+	return valuelen;
+}
+
+typedef size_t (*_httpmessage_request_t)(http_message_t *message, const char **value);
+static const struct
+{
+	string_t key;
+	_httpmessage_request_t cb;
+} _httpmessage_requests[HTTPMESSAGE_REQUESTS] =
+{
+	[HTTPMESSAGE_URI] = {STRING_DCL("uri"), _httpmessage_requesturi},
+	[HTTPMESSAGE_QUERY] = {STRING_DCL("query"), _httpmessage_requestquery},
+	[HTTPMESSAGE_SCHEME] = {STRING_DCL("scheme"), _httpmessage_requestscheme},
+	[HTTPMESSAGE_VERSION] = {STRING_DCL("version"), _httpmessage_requestversion},
+	[HTTPMESSAGE_METHOD] = {STRING_DCL("method"), _httpmessage_requestmethod},
+	[HTTPMESSAGE_RESULT] = {STRING_DCL("result"), _httpmessage_requestresult},
+	[HTTPMESSAGE_CONTENT] = {STRING_DCL("content"), _httpmessage_requestcontent},
+	[HTTPMESSAGE_CONTENTTYPE] = {STRING_DCL("Content-Type"), _httpmessage_requestcontenttype},
+	[HTTPMESSAGE_REMOTEADDR] = {STRING_DCL("remote_addr"), _httpmessage_requestremoteaddr},
+	[HTTPMESSAGE_REMOTEHOST] = {STRING_DCL("remote_host"), _httpmessage_requestremotehost},
+	[HTTPMESSAGE_REMOTEPORT] = {STRING_DCL("remote_port"), _httpmessage_requestremoteport},
+	[HTTPMESSAGE_PORT] = {STRING_DCL("port"), _httpmessage_requestport},
+	[HTTPMESSAGE_ADDR] = {STRING_DCL("addr"), _httpmessage_requestaddr},
+};
+
+/**
+ * the length and one character are enough to select the only candidate,
+ * a single comparison confirms the key.
+ * The remote_xxx keys are accepted as prefix like before.
+ */
+static int _httpmessage_requestid(const char *key)
+{
+	size_t length = strlen(key);
+	int id = -1;
+	if (length > 11 && !strncasecmp(key, "remote_", 7))
+		length = 11;
+	switch (length)
+	{
+	case 3:
+		id = HTTPMESSAGE_URI;
+	break;
+	case 4:
+		id = ((key[0] | 0x20) == 'p')? HTTPMESSAGE_PORT: HTTPMESSAGE_ADDR;
+	break;
+	case 5:
+		id = HTTPMESSAGE_QUERY;
+	break;
+	case 6:
+		switch (key[0] | 0x20)
 		{
-			valuelen = tcpserver_getname(&sin, len, service, NI_MAXSERV, 2);
-			if ((ssize_t)valuelen > -1)
-				*value = service;
-			else
-				return 0;
+		case 's':
+			id = HTTPMESSAGE_SCHEME;
+		break;
+		case 'm':
+			id = HTTPMESSAGE_METHOD;
+		break;
+		case 'r':
+			id = HTTPMESSAGE_RESULT;
+		break;
+		}
+	break;
+	case 7:
+		id = ((key[0] | 0x20) == 'v')? HTTPMESSAGE_VERSION: HTTPMESSAGE_CONTENT;
+	break;
+	case 11:
+		switch (key[7] | 0x20)
+		{
+		case 'a':
+			id = HTTPMESSAGE_REMOTEADDR;
+		break;
+		case 'h':
+			id = HTTPMESSAGE_REMOTEHOST;
+		break;
+		case 'p':
+			id = HTTPMESSAGE_REMOTEPORT;
+		break;
 		}
+	break;
+	case 12:
+		id = HTTPMESSAGE_CONTENTTYPE;
+	break;
 	}
-	else if (!strcasecmp(key, "addr"))
+	if ((id > -1) && strncasecmp(key, _string_get(&_httpmessage_requests[id].key), length))
+		id = -1;
+	return id;
+}
+
+size_t httpmessage_REQUEST_ID(http_message_t *message, http_message_request_e id, const char **value)
+{
+	*value = NULL;
+	if ((id < 0) || (id >= HTTPMESSAGE_REQUESTS))
+		return 0;
+	const char *key = _string_get(&_httpmessage_requests[id].key);
+	size_t valuelen = _httpmessage_requests[id].cb(message, value);
+	if (valuelen == (size_t)EREJECT)
+		valuelen = _httpmessage_searchheader(message, key, value);
+	if (valuelen == (size_t)EREJECT)
+		valuelen = httpserver_INFO2(httpclient_server(message->client), key, value);
+	return valuelen;
+}
+
+size_t httpmessage_REQUEST2(http_message_t *message, const char *key, const char **value)
+{
+	int id = _httpmessage_requestid(key);
+	if (id > -1)
+		return httpmessage_REQUEST_ID(message, id, value);
+
+	*value = NULL;
+	size_t valuelen = _httpmessage_searchheader(message, key, value);
+	if (valuelen == (size_t)EREJECT)
 	{
-		struct sockaddr_storage sin = {0};
-		socklen_t len = sizeof(sin);
+		valuelen = httpserver_INFO2(httpclient_server(message->client), key, value);
+	}
+	return valuelen;
+}
 
-		memset(host, 0, NI_MAXHOST);
-		if (!getsockname(httpclient_socket(message->client), (struct sockaddr *)&sin, &len))
+static size_t _httpmessage_urldecode(char *decoded, const char *encoded, size_t length)
+{
+	size_t i = 0;
+	size_t j = 0;
+	while (i < length)
+	{
+		int high = -1;
+		int low = -1;
+		if (encoded[i] == '%' && i + 2 < length)
 		{
-			valuelen = tcpserver_getname(&sin, len, host, NI_MAXHOST, 0);
-			if ((ssize_t)valuelen > -1)
-				*value = host;
-			else
-				return 0;
+			high = _httpmessage_hexdigit(encoded[i + 1]);
+			low = _httpmessage_hexdigit(encoded[i + 2]);
+		}
+		if (high > -1 && low > -1)
+		{
+			decoded[j++] = (char)((high << 4) | low);
+			i += 3;
 		}
-		if (*value != host)
+		else if (encoded[i] == '+')
 		{
-			valuelen = httpserver_INFO2(httpclient_server(message->client), "addr", value);
+			decoded[j++] = ' ';
+			i++;
 		}
+		else
+			decoded[j++] = encoded[i++];
 	}
-	else
+	return j;
+}
+
+/**
+ * the values already returned are kept until the end of the message,
+ * the next ones are decoded into a new storage reserved for the new query.
+ */
+static int _httpmessage_retireparameters(http_message_t *message)
+{
+	buffer_t *parameters = message->parameters_storage;
+	if (_buffer_length(parameters) == 0)
+		return ESUCCESS;
+	buffer_t **retired = vrealloc(message->parameters_retired,
+			(message->parameters_nbretired + 1) * sizeof(*retired));
+	if (retired == NULL)
+		return EREJECT;
+	retired[message->parameters_nbretired++] = parameters;
+	message->parameters_retired = retired;
+	message->parameters_storage = NULL;
+	return ESUCCESS;
+}
+
+/**
+ * the raw string is indexed once (again only if the POST data is appended)
+ * and it stays available for the "query" request.
+ * Each value is decoded on its first access and kept
+ * with its key into parameters_storage.
+ */
+static ssize_t _httpmessage_decodeparameter(http_message_t *message, const char *key, size_t keylen, const char **value)
+{
+	const buffer_t *storage = message->query_storage;
+	unsigned int hash = dbindex_hash(key, keylen);
+	if (message->queries_length != _buffer_length(storage))
 	{
-		valuelen = dbentry_search(message->headers, key, value);
+		if (message->parameters_storage != NULL &&
+			_httpmessage_retireparameters(message) != ESUCCESS)
+			return EREJECT;
+		dbindex_reset(&message->queries);
+		dbindex_reset(&message->parameters);
+		_buffer_indexdb(storage, &message->queries, '=', '&');
+		message->queries_length = _buffer_length(storage);
+	}
+	int id = dbindex_find(&message->parameters, hash, key, keylen);
+	if (id > -1)
+		return dbindex_value(&message->parameters, id, value);
+
+	/// the last occurrence wins, the POST data overwrites the URI's query
+	id = dbindex_findlast(&message->queries, hash, key, keylen);
+	if (id < 0)
+		return EREJECT;
+	const dbfield_t *field = &message->queries.fields[id];
+	const char *raw = storage->data + field->value.offset;
+	size_t rawlen = field->value.length;
+	if (rawlen == 0 && (field->value.offset == 0 || raw[-1] != '='))
+	{
+		/// the parameter is present without value
+		raw = str_true;
+		rawlen = strlen(str_true);
 	}
-	if (valuelen == (size_t)EREJECT)
+
+	if (message->parameters_storage == NULL)
 	{
-		valuelen = httpserver_INFO2(httpclient_server(message->client), key, value);
+		/// allocated once for all, the values already returned must stay valid
+		size_t size = _buffer_length(storage) + message->queries.count * (strlen(str_true) + 2);
+		message->parameters_storage = _buffer_create(str_query, (size / _buffer_chunksize(-1)) + 2);
+		if (message->parameters_storage != NULL)
+			_buffer_extend(message->parameters_storage, size);
 	}
-	return valuelen;
+	buffer_t *parameters = message->parameters_storage;
+	if (parameters == NULL ||
+		_buffer_extend(parameters, field->key.length + rawlen + 2) != ESUCCESS)
+		return EREJECT;
+	int keyoffset = _buffer_append(parameters, storage->data + field->key.offset, field->key.length);
+	_buffer_append(parameters, "", 1);
+	char *decoded = parameters->offset;
+	size_t valuelen = _httpmessage_urldecode(decoded, raw, rawlen);
+	decoded[valuelen] = '\0';
+	parameters->length += valuelen + 1;
+	parameters->offset += valuelen + 1;
+	id = dbindex_add(&message->parameters, parameters, parameters->data + keyoffset, field->key.length, decoded, valuelen);
+	return dbindex_value(&message->parameters, id, value);
 }
 
 size_t httpmessage_parameter(http_message_t *message, const char *key, const char **value)
 {
-	if (message->queries == NULL && message->query_storage != NULL)
-	{
-		_buffer_filldb(message->query_storage, &message->queries, '=', '&');
-	}
-	ssize_t valuelen = 0;
-	if (message->queries != NULL)
-		valuelen = dbentry_search(message->queries, key, value);
+	*value = NULL;
+	if (message->query_storage == NULL)
+		return 0;
+	ssize_t valuelen = _httpmessage_decodeparameter(message, key, strlen(key), value);
 	if (valuelen == EREJECT)
 		return 0;
 	return (size_t)valuelen;
@@ -1709,13 +3479,31 @@ size_t httpmessage_parameter(http_message_t *message, const char *key, const cha
 
 size_t httpmessage_cookie(http_message_t *message, const char *key, const char **cookie)
 {
-	size_t length = 0;
-	dbentry_t *entry = dbentry_get(message->cookies, key);
-	if (entry && cookie)
+	if (message->cookie_storage == NULL)
 	{
-		*cookie = message->cookie_storage->data + entry->value.offset;
-		length = entry->value.length;
+		const char *value = NULL;
+		ssize_t valuelen = _httpmessage_headervalue(message, HEADER_COOKIE, &value);
+		if (valuelen <= 0)
+			return 0;
+		int nbchunks = ((valuelen + 1) / _buffer_chunksize(-1)) + 1;
+		message->cookie_storage = _buffer_create(str_cookie, nbchunks);
+		if (message->cookie_storage == NULL)
+			return 0;
+		_buffer_append(message->cookie_storage, value, valuelen);
+		_buffer_indexdb(message->cookie_storage, &message->cookies, '=', ';');
+		/// the storage is private, the values may be terminated in place
+		for (int i = 0; i < message->cookies.count; i++)
+		{
+			const dbfield_t *field = &message->cookies.fields[i];
+			message->cookie_storage->data[field->value.offset + field->value.length] = '\0';
+		}
 	}
+	const char *value = NULL;
+	ssize_t length = dbindex_search(&message->cookies, key, &value);
+	if (length == EREJECT)
+		return 0;
+	if (cookie)
+		*cookie = value;
 	return length;
 }
 
@@ -1738,7 +3526,7 @@ size_t httpmessage_SESSION2(http_message_t *message, const char *key, void **val
 	return length;
 }
 
-void _httpconnector_add(http_connector_list_t **first,
+http_connector_list_t *_httpconnector_add(http_connector_list_t **first,
 						http_connector_t func, void *funcarg,
 						int priority, const char *name)
 {
@@ -1746,11 +3534,13 @@ void _httpconnector_add(http_connector_list_t **first,
 
 	callback = vcalloc(1, sizeof(*callback));
 	if (callback == NULL)
-		return;
+		return NULL;
 	callback->func = func;
 	callback->arg = funcarg;
 	callback->name = name;
-	callback->priority = priority;
+	callback->priority = priority & ~CONNECTOR_BLOCKING;
+	callback->blocking = !!(priority & CONNECTOR_BLOCKING);
+	callback->route = -1;
 	if (*first == NULL)
 	{
 		*first = callback;
@@ -1787,4 +3577,47 @@ void _httpconnector_add(http_connector_list_t **first,
 			previous->next = callback;
 		}
 	}
+	return callback;
+}
+
+http_connector_snapshot_t *_httpconnector_snapshot(const http_connector_list_t *first)
+{
+	http_connector_snapshot_t *snapshot = vcalloc(1, sizeof(*snapshot));
+	if (snapshot == NULL)
+		return NULL;
+	snapshot->ref = 1;
+	/// the insertion gives the same order as the former copy into each client
+	for (const http_connector_list_t *callback = first; callback != NULL; callback = callback->next)
+	{
+		http_connector_list_t *copy = _httpconnector_add(&snapshot->first, callback->func, callback->arg, callback->priority, callback->name);
+		if (copy == NULL)
+			continue;
+		copy->prefix = callback->prefix;
+		copy->prefixlen = callback->prefixlen;
+		copy->methods = callback->methods;
+		copy->route = callback->route;
+		copy->blocking = callback->blocking;
+	}
+	return snapshot;
+}
+
+http_connector_snapshot_t *_httpconnector_acquire(http_connector_snapshot_t *snapshot)
+{
+	if (snapshot != NULL)
+		__atomic_add_fetch(&snapshot->ref, 1, __ATOMIC_RELAXED);
+	return snapshot;
+}
+
+void _httpconnector_release(http_connector_snapshot_t *snapshot)
+{
+	if (snapshot == NULL || __atomic_sub_fetch(&snapshot->ref, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	http_connector_list_t *callback = snapshot->first;
+	while (callback != NULL)
+	{
+		http_connector_list_t *next = callback->next;
+		vfree(callback);
+		callback = next;
+	}
+	vfree(snapshot);
 }
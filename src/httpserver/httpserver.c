@@ -96,17 +96,6 @@ char *httpserver_software = _httpserver_software;
 /***********************************************************************
  * http_server
  */
-static int _httpserver_setmod(http_server_t *server, http_client_t *client)
-{
-	int ret = ESUCCESS;
-
-	for (http_server_mod_t *mod = server->mod; mod; mod = mod->next)
-	{
-		ret = httpclient_addmodule(client, mod);
-	}
-	return ret;
-}
-
 static int _httpserver_prepare(http_server_t *server)
 {
 	int count = 0;
@@ -120,6 +109,12 @@ static int _httpserver_prepare(http_server_t *server)
 	{
 		if (httpclient_socket(client) > 0)
 		{
+			/// a suspended response is not ready to be sent
+			int pending = _httpclient_pending(client);
+			int sending = (client->request_queue != NULL) && (pending < 0);
+			/// the output refused by the socket waits its availability
+			if (_httpclient_pendingout(client) > 0)
+				sending = 1;
 			int status = client->ops->status(client->opsctx);
 			if (status == ESUCCESS)
 			{
@@ -132,7 +127,7 @@ static int _httpserver_prepare(http_server_t *server)
 				checksockets = 0;
 #ifdef USE_POLL
 				server->poll_set[server->numfds].revents = POLLIN;
-				if (client->request_queue)
+				if (sending)
 				{
 					server->poll_set[server->numfds].revents |= POLLOUT;
 				}
@@ -141,12 +136,12 @@ static int _httpserver_prepare(http_server_t *server)
 #ifdef USE_POLL
 			server->poll_set[server->numfds].fd = client->sock;
 			server->poll_set[server->numfds].events = POLLIN;
-			if (client->request_queue)
+			if (sending)
 			{
 				server->poll_set[server->numfds].events |= POLLOUT;
 			}
 #else
-			if (client->request_queue)
+			if (sending)
 			{
 				FD_SET(httpclient_socket(client), &server->fds[1]);
 			}
@@ -154,6 +149,17 @@ static int _httpserver_prepare(http_server_t *server)
 			FD_SET(httpclient_socket(client), &server->fds[2]);
 #endif
 			server->numfds++;
+			if (pending > 0)
+			{
+#ifdef USE_POLL
+				server->poll_set[server->numfds].fd = pending;
+				server->poll_set[server->numfds].events = POLLIN;
+				server->numfds++;
+#else
+				FD_SET(pending, &server->fds[0]);
+#endif
+				maxfd = (maxfd > pending)? maxfd:pending;
+			}
 
 			maxfd = (maxfd > httpclient_socket(client))? maxfd:httpclient_socket(client);
 			count++;
@@ -200,10 +206,34 @@ static http_client_t *_httpserver_removeclient(http_server_t *server, http_clien
 	return client2;
 }
 
+/**
+ * over the hard limit of memory, the client which uses the most of it
+ * answers its current request with 413 or 503 and is closed.
+ * The next ones are closed only if its end is not enough.
+ */
+static void _httpserver_shedclient(http_server_t *server)
+{
+	http_client_t *largest = NULL;
+	for (http_client_t *client = server->clients; client != NULL; client = client->next)
+	{
+		if (largest == NULL || httpclient_memory(client) > httpclient_memory(largest))
+			largest = client;
+	}
+	if (largest == NULL || (httpclient_state(largest, -1) & CLIENT_STOPPED))
+		return;
+	warn("server: memory limit reached, client %p closed (%lu bytes)", largest, httpclient_memory(largest));
+	_httpclient_shed(largest);
+#ifndef VTHREAD
+	_httpclient_run(largest);
+#endif
+}
+
 static int _httpserver_checkclients(http_server_t *server, fd_set *prfds, const fd_set *pwfds, const fd_set *pefds)
 {
 	int error = 0;
 	int ret = 0;
+	if (_buffer_overlimit(&server->memory))
+		_httpserver_shedclient(server);
 	http_client_t *client = server->clients;
 	while (client != NULL)
 	{
@@ -241,8 +271,13 @@ static int _httpserver_checkclients(http_server_t *server, fd_set *prfds, const
 			else
 				FD_CLR(httpclient_socket(client), prfds);
 		}
+		int pending = _httpclient_pending(client);
+		/// a throttled client runs only when the socket is ready to send
+		int throttled = httpclient_state(client, -1) & CLIENT_THROTTLED;
 		if (FD_ISSET(httpclient_socket(client), prfds) ||
-			client->request_queue != NULL)
+			FD_ISSET(httpclient_socket(client), pwfds) ||
+			(pending < 0 && client->request_queue != NULL && !throttled) ||
+			(pending > 0 && FD_ISSET(pending, prfds)))
 		{
 			ret = _httpclient_run(client);
 		}
@@ -343,6 +378,9 @@ static int _httpserver_select(http_server_t *server, int maxfd, fd_set *prfds, f
 	if (maxfd > 0)
 		//nbselect = ppoll(server->poll_set, server->numfds, ptimeout, NULL);
 		nbselect = poll(server->poll_set, server->numfds, WAIT_TIMER * 1000);
+	else
+		/// the events are already set by _httpserver_prepare
+		nbselect = server->numfds;
 
 	if (nbselect > 0)
 	{
@@ -425,15 +463,18 @@ static int _httpserver_run(http_server_t *server)
 		FD_ZERO(pwfds);
 		FD_ZERO(pefds);
 
-#ifndef VTHREAD
 		struct timespec timeout;
+#ifndef VTHREAD
 		if (server->config->keepalive)
+#else
+		/// the memory of the clients is checked without event
+		if (server->memory.limit > 0)
+#endif
 		{
 			timeout.tv_sec = WAIT_TIMER;
 			timeout.tv_nsec = 0;
 			ptimeout = &timeout;
 		}
-#endif
 
 		server->numfds = 0;
 		int lastfd = _httpserver_prepare(server);
@@ -452,7 +493,8 @@ static int _httpserver_run(http_server_t *server)
 			 * poll/select exit on timeout
 			 * Check if a client is still available
 			 */
-			int checkclients = 0;
+			int checkclients = _buffer_overlimit(&server->memory);
+#ifndef VTHREAD
 			for (http_client_t *client = server->clients; client != NULL; client = client->next)
 			{
 				client->timeout -= WAIT_TIMER * 100;
@@ -462,6 +504,7 @@ static int _httpserver_run(http_server_t *server)
 					break;
 				}
 			}
+#endif
 			if (checkclients)
 				_httpserver_checkclients(server, prfds, pwfds, pefds);
 		}
@@ -576,6 +619,9 @@ http_server_t *httpserver_create(http_server_config_t *config)
 		server->config = config;
 	else
 		server->config = &defaultconfig;
+	_buffer_limits(server->config->memorysoft);
+	server->memory.limit = server->config->memoryhard;
+	server->memory.roles = server->memoryroles;
 	_string_store(&server->name, httpserver_software, -1);
 	struct utsname uts = {0}; /// uts->nodename should be hostname
 	if (config->hostname)
@@ -617,10 +663,19 @@ http_server_t *httpserver_create(http_server_config_t *config)
 #ifdef USE_POLL
 	server->poll_set =
 #ifndef VTHREAD
-		vcalloc(1 + server->config->maxclients, sizeof(*server->poll_set));
+		/// each client may wait its socket and the end of a job
+		vcalloc(1 + 2 * server->config->maxclients, sizeof(*server->poll_set));
 #else
 		vcalloc(1, sizeof(*server->poll_set));
 #endif
+#endif
+#ifdef USE_PTHREAD
+	server->resolvers = _httpclient_createresolvers();
+#endif
+#ifdef HTTPSERVER_WORKERS
+	server->workers = threadpool_init(HTTPSERVER_WORKERS);
+	if (server->workers != NULL)
+		server->jobs = _httpconnector_createqueue(server->workers, HTTPSERVER_WORKERS);
 #endif
 
 	if (server->ops->start(server))
@@ -642,6 +697,8 @@ http_server_t *httpserver_dup(http_server_t *server, http_server_config_t *confi
 		return NULL;
 	vserver->config = config;
 	vserver->ops = server->ops;
+	vserver->memory.limit = config->memoryhard;
+	vserver->memory.roles = vserver->memoryroles;
 
 	for (const http_message_method_t *method = default_methods; method; method = method->next)
 	{
@@ -650,10 +707,73 @@ http_server_t *httpserver_dup(http_server_t *server, http_server_config_t *confi
 
 	vserver->protocol_ops = server->protocol_ops;
 	vserver->protocol = server->protocol;
+	/// the virtual servers are prepared with their server by httpserver_connect
+	vserver->next = server->next;
+	server->next = vserver;
 
 	return vserver;
 }
 
+static unsigned int _httpserver_methodindex(const uint64_t key[2])
+{
+	uint64_t hash = (key[0] ^ (key[1] * 31)) * 0x9E3779B97F4A7C15ULL;
+	return (unsigned int)(hash >> 32) & (METHODS_TABLESIZE - 1);
+}
+
+/**
+ * the table is rebuilt after each new method. It is filled by linear
+ * probing, the methods too long or out of space remain on the list only.
+ */
+static void _httpserver_compilemethods(http_server_t *server)
+{
+	memset(server->methodtable, 0, sizeof(server->methodtable));
+	for (const http_message_method_t *method = server->methods; method != NULL; method = method->next)
+	{
+		uint64_t key[2] = {0};
+		if (method->key.length > sizeof(key))
+			continue;
+		memcpy(key, method->key.data, method->key.length);
+		unsigned int index = _httpserver_methodindex(key);
+		for (int i = 0; i < METHODS_TABLESIZE; i++, index = (index + 1) & (METHODS_TABLESIZE - 1))
+		{
+			http_server_methodentry_t *entry = &server->methodtable[index];
+			if (entry->method == NULL)
+			{
+				entry->key[0] = key[0];
+				entry->key[1] = key[1];
+				entry->length = method->key.length;
+				entry->method = method;
+				break;
+			}
+		}
+	}
+}
+
+const http_message_method_t *_httpserver_method(const http_server_t *server, const char *key, size_t keylen)
+{
+	if (keylen <= sizeof(uint64_t) * 2)
+	{
+		uint64_t packed[2] = {0};
+		memcpy(packed, key, keylen);
+		unsigned int index = _httpserver_methodindex(packed);
+		for (int i = 0; i < METHODS_TABLESIZE; i++, index = (index + 1) & (METHODS_TABLESIZE - 1))
+		{
+			const http_server_methodentry_t *entry = &server->methodtable[index];
+			if (entry->method == NULL)
+				break;
+			if (entry->key[0] == packed[0] && entry->key[1] == packed[1] && entry->length == keylen)
+				return entry->method;
+		}
+	}
+	/// the case insensitive comparison remains for the other spellings
+	for (const http_message_method_t *method = server->methods; method != NULL; method = method->next)
+	{
+		if (!_string_cmp(&method->key, key, keylen))
+			return method;
+	}
+	return NULL;
+}
+
 void httpserver_addmethod(http_server_t *server, const char *key, size_t keylen, short properties)
 {
 	short id = -1;
@@ -661,7 +781,8 @@ void httpserver_addmethod(http_server_t *server, const char *key, size_t keylen,
 	http_message_method_t *method;
 	for (method = server->methods; method != NULL; method = method->next)
 	{
-		id = method->id;
+		if (method->id > id)
+			id = method->id;
 		if (!_string_cmp(&method->key, key, -1))
 		{
 			break;
@@ -684,6 +805,7 @@ void httpserver_addmethod(http_server_t *server, const char *key, size_t keylen,
 		else
 			_buffer_append(server->methods_storage, ",", 1);
 		_buffer_append(server->methods_storage, method->key.data, method->key.length);
+		_httpserver_compilemethods(server);
 	}
 	if (properties != method->properties)
 	{
@@ -715,11 +837,152 @@ void httpserver_addmod(http_server_t *server, http_getctx_t modf, http_freectx_t
 	server->mod = mod;
 }
 
+/**
+ * the clients share the connectors of the server, a new snapshot is built
+ * for each new connector, the previous one is kept by the older clients.
+ */
+static void _httpserver_snapshotconnectors(http_server_t *server)
+{
+	http_connector_snapshot_t *snapshot = _httpconnector_snapshot(server->callbacks);
+	if (snapshot == NULL)
+		return;
+	_httpconnector_release(server->connectors);
+	server->connectors = snapshot;
+}
+
 void httpserver_addconnector(http_server_t *server,
 						http_connector_t func, void *funcarg,
 						int priority, const char *name)
 {
 	_httpconnector_add(&server->callbacks, func, funcarg, priority, name);
+	_httpserver_snapshotconnectors(server);
+}
+
+static void _httpserver_freeroutes(http_server_route_t *node)
+{
+	http_server_route_t *child = node->child;
+	while (child != NULL)
+	{
+		http_server_route_t *next = child->next;
+		_httpserver_freeroutes(child);
+		vfree(child);
+		child = next;
+	}
+	node->child = NULL;
+	node->routes = 0;
+}
+
+static int _httpserver_insertroute(http_server_route_t *node, const char *prefix, size_t length, int route)
+{
+	while (length > 0)
+	{
+		http_server_route_t **link = &node->child;
+		while (*link != NULL && (*link)->label[0] != prefix[0])
+			link = &(*link)->next;
+		http_server_route_t *child = *link;
+		if (child == NULL)
+		{
+			child = vcalloc(1, sizeof(*child));
+			if (child == NULL)
+				return EREJECT;
+			child->label = prefix;
+			child->length = length;
+			*link = child;
+			node = child;
+			break;
+		}
+		size_t common = 1;
+		while (common < child->length && common < length && child->label[common] == prefix[common])
+			common++;
+		if (common < child->length)
+		{
+			/// split the edge on the last common character
+			http_server_route_t *split = vcalloc(1, sizeof(*split));
+			if (split == NULL)
+				return EREJECT;
+			split->label = child->label;
+			split->length = common;
+			split->child = child;
+			split->next = child->next;
+			child->label += common;
+			child->length -= common;
+			child->next = NULL;
+			*link = split;
+			child = split;
+		}
+		node = child;
+		prefix += common;
+		length -= common;
+	}
+	node->routes |= (uint64_t)1 << route;
+	return ESUCCESS;
+}
+
+/**
+ * the trie is built by httpserver_connect, after the configuration
+ * of the server and of its virtual servers.
+ */
+static void _httpserver_compileroutes(http_server_t *server)
+{
+	_httpserver_freeroutes(&server->routes);
+	for (http_connector_list_t *callback = server->callbacks; callback != NULL; callback = callback->next)
+	{
+		if (callback->route > -1 &&
+			_httpserver_insertroute(&server->routes, callback->prefix, callback->prefixlen, callback->route) != ESUCCESS)
+		{
+			err("server: route %s not available", callback->name);
+			callback->route = -1;
+		}
+	}
+}
+
+uint64_t _httpserver_route(const http_server_route_t *node, const char *uri, size_t length)
+{
+	uint64_t routes = 0;
+	while (node != NULL)
+	{
+		routes |= node->routes;
+		const http_server_route_t *child = node->child;
+		while (child != NULL && (length == 0 || child->label[0] != uri[0]))
+			child = child->next;
+		if (child == NULL || child->length > length || strncmp(child->label, uri, child->length))
+			break;
+		uri += child->length;
+		length -= child->length;
+		node = child;
+	}
+	return routes;
+}
+
+void httpserver_addroute(http_server_t *server, const char *methods, const char *prefix,
+						http_connector_t func, void *funcarg,
+						int priority, const char *name)
+{
+	http_connector_list_t *callback = _httpconnector_add(&server->callbacks, func, funcarg, priority, name);
+	if (callback == NULL)
+		return;
+	while (methods != NULL && *methods != '\0')
+	{
+		size_t length = strcspn(methods, ",");
+		const http_message_method_t *method = _httpserver_method(server, methods, length);
+		if (method != NULL && method->id < (sizeof(callback->methods) * 8))
+			callback->methods |= 1U << method->id;
+		else
+			warn("server: route %s with unknown method %.*s", name, (int)length, methods);
+		methods += length;
+		if (*methods == ',')
+			methods++;
+	}
+	if (prefix == NULL)
+		return;
+	callback->prefix = prefix;
+	callback->prefixlen = strlen(prefix);
+	/// the pattern "/prefix*" is the same as the prefix
+	if (callback->prefixlen > 0 && prefix[callback->prefixlen - 1] == '*')
+		callback->prefixlen--;
+	if (server->nbroutes < ROUTES_MAX)
+		callback->route = server->nbroutes++;
+	_httpserver_snapshotconnectors(server);
 }
 
 void httpserver_connect(http_server_t *server)
@@ -737,6 +1000,10 @@ void httpserver_connect(http_server_t *server)
 	rlim.rlim_cur = _maxclients * 2 + 5 + MAXWEBSOCKETS;
 	setrlimit(RLIMIT_NOFILE, &rlim);
 
+	/// the clients may be moved to the virtual servers
+	for (http_server_t *vserver = server; vserver != NULL; vserver = vserver->next)
+		_httpserver_compileroutes(vserver);
+
 #ifndef VTHREAD
 	_httpserver_connect(server);
 #else
@@ -771,11 +1038,9 @@ int httpserver_reloadclient(http_server_t *server, http_client_t *client)
 {
 	httpclient_freeconnectors(client);
 	httpclient_freemodules(client);
-	_httpserver_setmod(server, client);
-	for (http_connector_list_t *callback = server->callbacks; callback != NULL; callback = callback->next)
-	{
-		httpclient_addconnector(client, callback->func, callback->arg, callback->priority, callback->name);
-	}
+	httpclient_flag(client, 1, CLIENT_MODULES);
+	_httpclient_addconnectors(client, server);
+	_httpclient_startmodules(client, server);
 	return EREJECT;
 }
 
@@ -798,6 +1063,18 @@ void httpserver_destroy(http_server_t *server)
 #endif
 	http_client_t *client = server->clients;
 	_httpserver_closeclients(server);
+#ifdef HTTPSERVER_WORKERS
+	/// the clients already waited the end of their jobs
+	if (server->workers)
+		threadpool_destroy(server->workers);
+	if (server->jobs)
+		_httpconnector_destroyqueue(server->jobs);
+#endif
+#ifdef USE_PTHREAD
+	/// the clients are closed, the lookups are not used
+	if (server->resolvers)
+		_httpclient_destroyresolvers(server->resolvers);
+#endif
 	http_connector_list_t *callback = server->callbacks;
 	while (callback)
 	{
@@ -805,6 +1082,16 @@ void httpserver_destroy(http_server_t *server)
 		vfree(callback);
 		callback = next;
 	}
+	_httpserver_freeroutes(&server->routes);
+	_httpconnector_release(server->connectors);
+#ifdef HTTPCACHE
+	if (server->cache)
+		_httpcache_destroy(server->cache);
+#endif
+#ifdef HTTPENCODING
+	if (server->encoding)
+		_httpencoding_destroy(server->encoding);
+#endif
 	http_server_mod_t *mod = server->mod;
 	while (mod)
 	{
@@ -919,13 +1206,21 @@ size_t httpserver_INFO2(http_server_t *server, const char *key, const char **val
 	return valuelen;
 }
 
+size_t httpserver_memory(http_server_t *server, const char *role)
+{
+	return _buffer_memory((server != NULL)? &server->memory: NULL, role);
+}
+
 http_server_session_t *_httpserver_createsession(http_server_t *server, const http_client_t *client)
 {
 	http_server_session_t *session = NULL;
 	session = vcalloc(1, sizeof(*session));
 	if (session)
 	{
+		/// the session may live longer than the client
+		buffer_account_t *owner = _buffer_owner(&server->memory);
 		session->storage = _buffer_create(str_session, MAXCHUNKS_SESSION);
+		_buffer_owner(owner);
 		/**
 		 * the list should be managed with a lock.
 		 * This is the only list directly used by several threads
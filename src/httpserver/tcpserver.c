@@ -274,7 +274,7 @@ static int tcpclient_wait(void *ctl, int options)
 	sigset_t sigmask;
 	sigemptyset(&sigmask);
 	sigaddset(&sigmask, SIGCHLD);
-	int ttimeout = (ptimeout->tv_sec * 1000) + (ptimeout->tv_nsec / 100000000);
+	int ttimeout = (ptimeout->tv_sec * 1000) + (ptimeout->tv_nsec / 1000000);
 	//ret = ppoll(poll_set, numfds, ptimeout, NULL);
 	ret = poll(poll_set, numfds, ttimeout);
 	if (poll_set[0].revents & POLLIN)
@@ -605,22 +605,9 @@ static http_client_t *_tcpserver_createclient(http_server_t *server)
 
 	if (client != NULL)
 	{
-		char hoststr[NI_MAXHOST];
-
-		int rc;
-#ifdef HAVE_GETNAMEINFO
-		rc = getnameinfo((struct sockaddr *)&client->addr,
-			client->addr_size, hoststr, sizeof(hoststr), NULL, 0,
-			NI_NUMERICHOST | NI_NUMERICSERV);
-#else
-		struct hostent *entity;
-
-		entity = gethostbyaddr((void *)&client->addr, client->addr_size, server->type);
-		strncpy(hoststr, entity->h_name, NI_MAXHOST);
-		rc = 0;
-#endif
-		if (rc == 0)
-			warn("tcpserver: new connection %p (%d) from %s %d", client, client->sock, hoststr, server->config->port);
+		_httpclient_names(client);
+		if (client->remote_addr.length > 0)
+			warn("tcpserver: new connection %p (%d) from %s %d", client, client->sock, client->remote_addr.data, server->config->port);
 	}
 	return client;
 }
@@ -663,8 +650,8 @@ ssize_t tcpserver_getname(struct sockaddr_storage *addr, socklen_t addrlen, char
 				0, 0, NI_NUMERICHOST);
 	if (ret == 0)
 	{
-#ifdef USE_IPV6
 			length = strnlen(buffer, length);
+#ifdef USE_IPV6
 			/// IPv4-mapped address on IPv6
 			if (!strncmp(buffer, "::ffff:", 7))
 			{
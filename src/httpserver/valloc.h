@@ -44,4 +44,11 @@ inline char *vrealloc(char *b, size_t s)
 # define vrealloc(...) realloc(__VA_ARGS__)
 #endif
 
+/// the memory counters may be shared by several threads
+#ifdef USE_PTHREAD
+# define vaccount(counter, size) __atomic_add_fetch(counter, size, __ATOMIC_RELAXED)
+#else
+# define vaccount(counter, size) (*(counter) += (size))
+#endif
+
 #endif
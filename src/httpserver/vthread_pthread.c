@@ -88,7 +88,8 @@ int vthread_create(vthread_t *thread, vthread_attr_t *attr,
 	vthread->routine = start_routine;
 	vthread->arg = arg;
 
-	if (pthread_create(&(vthread->pthread), attr, start_routine, arg) < 0)
+	/// the routine is wrapped to follow the state of the thread
+	if (pthread_create(&(vthread->pthread), attr, _vthread_routine, vthread) < 0)
 		ret = EREJECT;
 
 #if defined(HAVE_PTHREAD_YIELD)
@@ -118,7 +119,8 @@ int vthread_join(vthread_t thread, void **value_ptr)
 
 int vthread_exist(vthread_t thread)
 {
-	return (thread->state == _VTHREAD_RUNNING);
+	/// the thread may not be scheduled yet, it exists until its end
+	return (thread->state != _VTHREAD_STOPPED);
 }
 
 void vthread_wait(vthread_t threads[], int nbthreads)
@@ -0,0 +1,460 @@
+/*****************************************************************************
+ * parsertest.c: test of the request parser with the data split anywhere
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "valloc.h"
+#include "vthread.h"
+#include "ouistiti/log.h"
+#include "ouistiti/httpserver.h"
+#include "_httpserver.h"
+#include "_httpmessage.h"
+#include "_buffer.h"
+
+/// the application gives the name of the upgrade
+const char str_upgrade[] = "upgrade";
+
+#define PARSERTEST_RESULTLEN 4096
+#define PARSERTEST_FUZZLOOPS 2000
+#define PARSERTEST_MAXPIECES 8
+
+typedef struct parsertest_sample_s parsertest_sample_t;
+struct parsertest_sample_s
+{
+	const char *name;
+	const char *request;
+	const char *uri; /**NULL for a rejected request*/
+	const char *content;
+};
+
+static const parsertest_sample_t samples[] =
+{
+	{
+		.name = "get",
+		.request = "GET /index.html HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n",
+		.uri = "/index.html",
+		.content = "",
+	},
+	{
+		.name = "query",
+		.request = "GET /search/result.html?name=value&empty=&last=%20x HTTP/1.1\r\n"
+			"Host: www.example.com\r\n"
+			"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+			"Accept-Language:en-US,en;q=0.9\r\n"
+			"Cookie: session=4f9c2b7e1d3a6f8e0b5c9d2a7e4f1b3c6d8e0a2b4c6d8e0f; theme=dark\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+		.uri = "/search/result.html",
+		.content = "",
+	},
+	{
+		.name = "encoded",
+		.request = "GET /documents/annual%20report/../summary%41.html HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"\r\n",
+		.uri = "/documents/summaryA.html",
+		.content = "",
+	},
+	{
+		.name = "http10",
+		.request = "HEAD /a/b/../c HTTP/1.0\n"
+			"User-Agent: test\n"
+			"\n",
+		.uri = "/a/c",
+		.content = "",
+	},
+	{
+		.name = "content",
+		.request = "POST /upload HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 156\r\n"
+			"\r\n"
+			"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789abcdefghijklmnopqrstuv",
+		.uri = "/upload",
+		.content = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			"0123456789abcdefghijklmnopqrstuv",
+	},
+	{
+		.name = "chunked",
+		.request = "POST /upload.txt HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Transfer-Encoding: gzip, chunked\r\n"
+			"\r\n"
+			"1a;name=value\r\n"
+			"abcdefghijklmnopqrstuvwxyz\r\n"
+			"A\r\n"
+			"0123456789\r\n"
+			"0\r\n"
+			"Trailer: value\r\n"
+			"\r\n",
+		.uri = "/upload.txt",
+		.content = "abcdefghijklmnopqrstuvwxyz0123456789",
+	},
+	{
+		.name = "form",
+		.request = "POST /form?first=1 HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Content-Type: application/x-www-form-urlencoded\r\n"
+			"Content-Length: 26\r\n"
+			"\r\n"
+			"second=2&third=three+words",
+		.uri = "/form",
+		.content = "first=1&second=2&third=three+words",
+	},
+	{
+		.name = "reject",
+		.request = "GET /index.html HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Transfer-Encoding: chunked\r\n"
+			"\r\n"
+			"zz\r\n",
+		.uri = NULL,
+		.content = NULL,
+	},
+	{
+		/// the body would be framed by Content-Length
+		.name = "reject gzip",
+		.request = "POST /upload HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Transfer-Encoding: gzip\r\n"
+			"Content-Length: 4\r\n"
+			"\r\n"
+			"abcd",
+		.uri = NULL,
+		.content = NULL,
+	},
+	{
+		.name = "reject chunked gzip",
+		.request = "POST /upload HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Transfer-Encoding: chunked, gzip\r\n"
+			"Content-Length: 4\r\n"
+			"\r\n"
+			"abcd",
+		.uri = NULL,
+		.content = NULL,
+	},
+	{
+		.name = "reject http10 chunked",
+		.request = "POST /upload HTTP/1.0\r\n"
+			"Transfer-Encoding: chunked\r\n"
+			"\r\n"
+			"4\r\n"
+			"abcd\r\n"
+			"0\r\n"
+			"\r\n",
+		.uri = NULL,
+		.content = NULL,
+	},
+	{
+		.name = NULL,
+	}
+};
+
+typedef struct parsertest_s parsertest_t;
+struct parsertest_s
+{
+	buffer_t *data;
+	http_message_t *message;
+	int ret;
+	char content[PARSERTEST_RESULTLEN];
+	size_t contentlen;
+};
+
+static void parsertest_start(parsertest_t *test)
+{
+	test->data = _buffer_create("parsertest", MAXCHUNKS_HEADER);
+	test->message = _httpmessage_create(NULL, NULL);
+	test->ret = EINCOMPLETE;
+	test->contentlen = 0;
+}
+
+static void parsertest_stop(parsertest_t *test)
+{
+	_httpmessage_destroy(test->message);
+	_buffer_destroy(test->data);
+}
+
+/**
+ * the content is read after each call like a connector does it
+ */
+static void parsertest_content(parsertest_t *test)
+{
+	http_message_t *message = test->message;
+	if (message->content == NULL || message->content_packet == 0)
+		return;
+	size_t length = message->content_packet;
+	if (test->contentlen + length >= PARSERTEST_RESULTLEN)
+		length = PARSERTEST_RESULTLEN - test->contentlen - 1;
+	memcpy(test->content + test->contentlen, _buffer_get(message->content, 0), length);
+	test->contentlen += length;
+	if (!_httpmessage_contentempty(message, 1))
+		message->content_length -= message->content_packet;
+	message->content_packet = 0;
+}
+
+/**
+ * the data is received like the client does it:
+ * the rest of the previous reception is kept before the new one.
+ */
+static void parsertest_feed(parsertest_t *test, const char *piece, size_t length)
+{
+	buffer_t *data = test->data;
+	if (test->ret != EINCOMPLETE && test->ret != ECONTINUE)
+		return;
+	_buffer_shrink(data);
+	_buffer_reset(data, _buffer_length(data));
+	if (_buffer_append(data, piece, length) < 0)
+	{
+		test->ret = EREJECT;
+		return;
+	}
+	data->offset = data->data;
+	do
+	{
+		test->ret = _httpmessage_parserequest(test->message, data);
+		parsertest_content(test);
+	} while (test->ret == ECONTINUE && !_buffer_empty(data));
+}
+
+/**
+ * the result contains all the elements that the modules may read
+ */
+static size_t parsertest_result(parsertest_t *test, char *result, size_t size)
+{
+	http_message_t *message = test->message;
+	/// the elements of a rejected request are not used
+	if (test->ret == EREJECT)
+		return snprintf(result, size, "%d %d\n", test->ret, message->result);
+	const char *method = (message->method != NULL)? _string_get(&message->method->key): "";
+	const char *uri = (message->uri != NULL)? _buffer_get(message->uri, 0): "";
+	const char *query = (message->query_storage != NULL)? _buffer_get(message->query_storage, 0): "";
+	int length = snprintf(result, size, "%d %d %s %s ? %s %d\n",
+			test->ret, message->result,
+			method, uri, query, message->version);
+	for (int i = 0; i < message->headers.count && length < size; i++)
+	{
+		const dbfield_t *field = &message->headers.fields[i];
+		length += snprintf(result + length, size - length, "%.*s: %.*s\n",
+				(int)field->key.length, _buffer_get(message->headers.storage, field->key.offset),
+				(int)field->value.length, _buffer_get(message->headers.storage, field->value.offset));
+	}
+	if (length < size)
+		length += snprintf(result + length, size - length, "\n%.*s", (int)test->contentlen, test->content);
+	return length;
+}
+
+/**
+ * the sample is cut at each position of the array "cuts"
+ */
+static size_t parsertest_run(const parsertest_sample_t *sample, const size_t *cuts, int ncuts, char *result, size_t size)
+{
+	parsertest_t test;
+	size_t length = strlen(sample->request);
+	size_t start = 0;
+
+	parsertest_start(&test);
+	for (int i = 0; i < ncuts; i++)
+	{
+		parsertest_feed(&test, sample->request + start, cuts[i] - start);
+		start = cuts[i];
+	}
+	parsertest_feed(&test, sample->request + start, length - start);
+	length = parsertest_result(&test, result, size);
+	parsertest_stop(&test);
+	return length;
+}
+
+static int parsertest_check(const parsertest_sample_t *sample, const char *expected, const size_t *cuts, int ncuts)
+{
+	char result[PARSERTEST_RESULTLEN];
+	parsertest_run(sample, cuts, ncuts, result, sizeof(result));
+	if (strcmp(result, expected))
+	{
+		fprintf(stderr, "parsertest: %s split at", sample->name);
+		for (int i = 0; i < ncuts; i++)
+			fprintf(stderr, " %lu", cuts[i]);
+		fprintf(stderr, "\nexpected:\n%s\nresult:\n%s\n", expected, result);
+		return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+/**
+ * the request in one part is the reference for all the splits
+ */
+static int parsertest_sample(const parsertest_sample_t *sample)
+{
+	char expected[PARSERTEST_RESULTLEN];
+	parsertest_t test;
+	int ret = ESUCCESS;
+
+	parsertest_start(&test);
+	parsertest_feed(&test, sample->request, strlen(sample->request));
+	parsertest_result(&test, expected, sizeof(expected));
+	if (sample->uri == NULL)
+	{
+		if (test.ret != EREJECT)
+		{
+			fprintf(stderr, "parsertest: %s not rejected\n", sample->name);
+			ret = EREJECT;
+		}
+	}
+	else if (test.ret != ESUCCESS || test.message->uri == NULL ||
+			strcmp(_buffer_get(test.message->uri, 0), sample->uri) ||
+			test.contentlen != strlen(sample->content) ||
+			memcmp(test.content, sample->content, test.contentlen))
+	{
+		fprintf(stderr, "parsertest: %s bad parsing\n%s\n", sample->name, expected);
+		ret = EREJECT;
+	}
+	parsertest_stop(&test);
+	if (ret != ESUCCESS)
+		return ret;
+
+	size_t length = strlen(sample->request);
+	size_t cuts[2];
+	/// every split in two parts
+	for (cuts[0] = 1; cuts[0] < length && ret == ESUCCESS; cuts[0]++)
+		ret = parsertest_check(sample, expected, cuts, 1);
+	/// every split in three parts
+	for (cuts[0] = 1; cuts[0] < length && ret == ESUCCESS; cuts[0]++)
+		for (cuts[1] = cuts[0] + 1; cuts[1] < length && ret == ESUCCESS; cuts[1]++)
+			ret = parsertest_check(sample, expected, cuts, 2);
+	/// byte per byte
+	if (ret == ESUCCESS)
+	{
+		size_t *bytes = malloc(length * sizeof(*bytes));
+		for (size_t i = 1; i < length; i++)
+			bytes[i - 1] = i;
+		ret = parsertest_check(sample, expected, bytes, length - 1);
+		free(bytes);
+	}
+	printf("%s: %s\n", sample->name, (ret == ESUCCESS)? "ok": "failed");
+	return ret;
+}
+
+static int parsertest_random(size_t length, size_t *cuts)
+{
+	int ncuts = rand() % PARSERTEST_MAXPIECES;
+	if (ncuts > length - 1)
+		ncuts = length - 1;
+	for (int i = 0; i < ncuts; i++)
+		cuts[i] = 1 + rand() % (length - 1);
+	/// sort and remove the duplicates
+	for (int i = 1; i < ncuts; i++)
+	{
+		size_t cut = cuts[i];
+		int j = i;
+		while (j > 0 && cuts[j - 1] > cut)
+		{
+			cuts[j] = cuts[j - 1];
+			j--;
+		}
+		cuts[j] = cut;
+	}
+	int n = 0;
+	for (int i = 0; i < ncuts; i++)
+		if (n == 0 || cuts[i] != cuts[n - 1])
+			cuts[n++] = cuts[i];
+	return n;
+}
+
+/**
+ * the samples are corrupted at random, the result may be a rejection,
+ * but it must not depend on the splits.
+ */
+static int parsertest_fuzz(unsigned int seed)
+{
+	static const char corruptions[] = " \t\r\n:;,?&=%/0aF\x7f";
+	int nbsamples = 0;
+	while (samples[nbsamples].name != NULL)
+		nbsamples++;
+
+	srand(seed);
+	for (int i = 0; i < PARSERTEST_FUZZLOOPS; i++)
+	{
+		const parsertest_sample_t *sample = &samples[rand() % nbsamples];
+		char request[PARSERTEST_RESULTLEN];
+		size_t length = strlen(sample->request);
+		memcpy(request, sample->request, length + 1);
+		int ncorruptions = rand() % 4;
+		for (int j = 0; j < ncorruptions; j++)
+		{
+			size_t position = rand() % length;
+			request[position] = corruptions[rand() % (sizeof(corruptions) - 1)];
+		}
+
+		parsertest_sample_t fuzzed = { .name = "fuzz", .request = request };
+		char expected[PARSERTEST_RESULTLEN];
+		parsertest_run(&fuzzed, NULL, 0, expected, sizeof(expected));
+
+		size_t cuts[PARSERTEST_MAXPIECES];
+		int ncuts = parsertest_random(length, cuts);
+		if (parsertest_check(&fuzzed, expected, cuts, ncuts) != ESUCCESS)
+		{
+			fprintf(stderr, "parsertest: seed %u loop %d request:\n%s\n", seed, i, request);
+			return EREJECT;
+		}
+	}
+	printf("fuzz: ok\n");
+	return ESUCCESS;
+}
+
+/// the ranges of the parser are checked with each scanner of the CPU
+static const char *scanners[] = {"scalar", "sse4.2", "avx2", NULL};
+
+int main(int argc, char * const *argv)
+{
+	unsigned int seed = 1;
+	int ret = 0;
+
+	if (argc > 1)
+		seed = strtoul(argv[1], NULL, 10);
+	for (int j = 0; scanners[j] != NULL; j++)
+	{
+		if (_buffer_scanselect(scanners[j]) != ESUCCESS)
+			continue;
+		printf("%s:\n", scanners[j]);
+		for (int i = 0; samples[i].name != NULL; i++)
+		{
+			if (parsertest_sample(&samples[i]) != ESUCCESS)
+				ret = -1;
+		}
+	}
+	if (parsertest_fuzz(seed) != ESUCCESS)
+		ret = -1;
+	return ret;
+}
@@ -0,0 +1,837 @@
+/*****************************************************************************
+ * servertest.c: test of the responses of the server on the loopback
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ouistiti/httpserver.h"
+
+/// the application gives the name of the upgrade
+const char str_upgrade[] = "upgrade";
+
+#define SERVERTEST_PORT 18480
+#define SERVERTEST_RESPONSELEN (64 * 1024)
+#define SERVERTEST_DOCUMENTLEN 100
+#define SERVERTEST_FILELEN 1000
+#define SERVERTEST_LARGELEN (1024 * 1024)
+#define SERVERTEST_SENDHIGH (16 * 1024)
+#define SERVERTEST_MAXMEMORY (256 * 1024)
+#define SERVERTEST_BLOCKINGTIME 100000
+#define SERVERTEST_BLOCKINGCLIENTS 8
+#define SERVERTEST_ETAG "\"v1\""
+#define SERVERTEST_COUNTETAG "\"c1\""
+#define SERVERTEST_MTIME 1700000000
+#define SERVERTEST_DATE "Tue, 14 Nov 2023 22:13:20 GMT"
+#define SERVERTEST_OLDDATE "Tue, 14 Nov 2023 22:13:19 GMT"
+
+/**
+ * the documents contain the alphabet from their beginning
+ */
+static void servertest_fill(char *data, size_t offset, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+		data[i] = 'a' + (offset + i) % 26;
+}
+
+static int servertest_check(const char *data, size_t offset, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		if (data[i] != 'a' + (offset + i) % 26)
+			return EREJECT;
+	}
+	return ESUCCESS;
+}
+
+/**
+ * the content is complete, the library answers to the conditions
+ * and cuts the ranges.
+ */
+static int document_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (strcmp(uri, "/document"))
+		return EREJECT;
+	if (httpmessage_validator(request, response, SERVERTEST_ETAG, -1, SERVERTEST_MTIME) == ESUCCESS)
+		return ESUCCESS;
+	char document[SERVERTEST_DOCUMENTLEN];
+	servertest_fill(document, 0, sizeof(document));
+	httpmessage_addcontent(response, "text/plain", document, sizeof(document));
+	return ESUCCESS;
+}
+
+typedef struct servertest_file_s servertest_file_t;
+struct servertest_file_s
+{
+	off_t offset;
+	size_t length;
+};
+
+/**
+ * the content is streamed part by part of each range
+ */
+static int file_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (strcmp(uri, "/file"))
+		return EREJECT;
+	servertest_file_t *file = httpmessage_private(response, NULL);
+	if (file == NULL)
+	{
+		if (httpmessage_validator(request, response, SERVERTEST_ETAG, -1, SERVERTEST_MTIME) == ESUCCESS)
+			return ESUCCESS;
+		httpmessage_addcontent(response, "text/plain", NULL, -1);
+		file = calloc(1, sizeof(*file));
+		if (file == NULL)
+			return EREJECT;
+		httpmessage_private(response, file);
+	}
+	if (file->length == 0)
+	{
+		int ret = httpmessage_range(request, response, SERVERTEST_FILELEN, &file->offset, &file->length);
+		if (ret != ECONTINUE)
+		{
+			free(file);
+			httpmessage_private(response, NULL);
+			return ESUCCESS;
+		}
+	}
+	char data[64];
+	size_t length = (file->length > sizeof(data))? sizeof(data): file->length;
+	servertest_fill(data, file->offset, length);
+	httpmessage_appendcontent(response, data, length);
+	file->offset += length;
+	file->length -= length;
+	return ECONTINUE;
+}
+
+/**
+ * the cached responses are sent again without the connector,
+ * the connector doesn't check the validators itself.
+ */
+static int count_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (strcmp(uri, "/count"))
+		return EREJECT;
+	static int count = 0;
+	char pid[16];
+	snprintf(pid, sizeof(pid), "%d", getpid());
+	httpmessage_addheader(response, "X-Pid", pid, -1);
+	httpmessage_addheader(response, "ETag", SERVERTEST_COUNTETAG, -1);
+	httpmessage_addheader(response, "Last-Modified", SERVERTEST_DATE, -1);
+	char content[16];
+	int length = snprintf(content, sizeof(content), "count %d", ++count);
+	httpmessage_addcontent(response, "text/plain", content, length);
+	return ESUCCESS;
+}
+
+/**
+ * the connector follows the send window, the memory of the client
+ * must stay bounded while the reader is slower.
+ */
+static int large_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (strcmp(uri, "/large"))
+		return EREJECT;
+	size_t *offset = httpmessage_private(response, NULL);
+	if (offset == NULL)
+	{
+		httpmessage_addcontent(response, "text/plain", NULL, SERVERTEST_LARGELEN);
+		offset = calloc(1, sizeof(*offset));
+		if (offset == NULL)
+			return EREJECT;
+		httpmessage_private(response, offset);
+	}
+	if (httpclient_memory(httpmessage_client(response)) > SERVERTEST_MAXMEMORY)
+	{
+		fprintf(stderr, "servertest: large: the client memory is over %d\n", SERVERTEST_MAXMEMORY);
+		free(offset);
+		httpmessage_private(response, NULL);
+		return EREJECT;
+	}
+	char data[4096];
+	size_t length = SERVERTEST_LARGELEN - *offset;
+	if (length > sizeof(data))
+		length = sizeof(data);
+	size_t window = httpmessage_sendwindow(response);
+	if (length > window)
+		length = window;
+	if (length > 0)
+	{
+		servertest_fill(data, *offset, length);
+		int ret = httpmessage_appendcontent(response, data, length);
+		if (ret < 0)
+			return EREJECT;
+		*offset += ret;
+	}
+	if (*offset < SERVERTEST_LARGELEN)
+		return ECONTINUE;
+	free(offset);
+	httpmessage_private(response, NULL);
+	return ESUCCESS;
+}
+
+#ifndef VTHREAD
+static pthread_t servertest_loop;
+
+/**
+ * the blocking connector runs on a worker, never on the thread of the loop
+ */
+static int blocking_connector(void *arg, http_message_t *request, http_message_t *response)
+{
+	const char *uri = httpmessage_REQUEST(request, "uri");
+	if (strcmp(uri, "/blocking"))
+		return EREJECT;
+	usleep(SERVERTEST_BLOCKINGTIME);
+	const char *thread = pthread_equal(pthread_self(), servertest_loop)? "loop": "worker";
+	httpmessage_addcontent(response, "text/plain", thread, -1);
+	return ESUCCESS;
+}
+#endif
+
+typedef struct servertest_response_s servertest_response_t;
+struct servertest_response_s
+{
+	char data[SERVERTEST_RESPONSELEN];
+	size_t length;
+	const char *content;
+	size_t contentlen;
+};
+
+/**
+ * the request is sent on a new connection and the response is read
+ * until the server closes it.
+ */
+static int servertest_request(int port, const char *request, servertest_response_t *response)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return EREJECT;
+	struct timeval timeout = { .tv_sec = 5 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		send(sock, request, strlen(request), MSG_NOSIGNAL) < 0)
+	{
+		close(sock);
+		return EREJECT;
+	}
+	response->length = 0;
+	ssize_t ret;
+	do
+	{
+		size_t size = SERVERTEST_RESPONSELEN - response->length - 1;
+		ret = recv(sock, response->data + response->length, size, 0);
+		if (ret > 0)
+			response->length += ret;
+	} while (ret > 0 && response->length < SERVERTEST_RESPONSELEN - 1);
+	close(sock);
+	response->data[response->length] = '\0';
+	response->content = strstr(response->data, "\r\n\r\n");
+	if (response->content == NULL)
+		return EREJECT;
+	response->content += 4;
+	response->contentlen = response->data + response->length - response->content;
+	return ESUCCESS;
+}
+
+/**
+ * the value of the header is returned without the end of line
+ */
+static size_t servertest_header(const servertest_response_t *response, const char *key, const char **value)
+{
+	size_t keylen = strlen(key);
+	const char *line = strstr(response->data, "\r\n");
+	while (line != NULL && line + 2 < response->content)
+	{
+		line += 2;
+		if (!strncasecmp(line, key, keylen) && line[keylen] == ':')
+		{
+			*value = line + keylen + 1;
+			while (**value == ' ')
+				(*value)++;
+			return strstr(*value, "\r\n") - *value;
+		}
+		line = strstr(line, "\r\n");
+	}
+	*value = NULL;
+	return 0;
+}
+
+typedef struct servertest_case_s servertest_case_t;
+struct servertest_case_s
+{
+	const char *name;
+	const char *request;
+	const char *status;
+	const char *header; /**"Key: value" expected into the response*/
+	size_t offset; /**offset of the content into the document*/
+	ssize_t contentlen; /**-1 when the content is not checked*/
+};
+
+#define SERVERTEST_GET(uri, headers) "GET " uri " HTTP/1.1\r\nHost: localhost\r\n" headers "Connection: close\r\n\r\n"
+
+static const servertest_case_t cases[] =
+{
+	{
+		.name = "document",
+		.request = SERVERTEST_GET("/document", ""),
+		.status = "HTTP/1.1 200 OK",
+		.header = "ETag: " SERVERTEST_ETAG,
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "http10",
+		.request = "GET /document HTTP/1.0\r\n\r\n",
+		.status = "HTTP/1.0 200 OK",
+		.header = "Last-Modified: " SERVERTEST_DATE,
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "method",
+		.request = "BREW /document HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+		.status = "HTTP/1.1 405 Method Not Allowed",
+		.contentlen = -1,
+	},
+	{
+		.name = "if-none-match",
+		.request = SERVERTEST_GET("/document", "If-None-Match: \"x\", W/" SERVERTEST_ETAG "\r\n"),
+		.status = "HTTP/1.1 304 Not Modified",
+		.header = "ETag: " SERVERTEST_ETAG,
+		.contentlen = 0,
+	},
+	{
+		.name = "if-none-match *",
+		.request = SERVERTEST_GET("/document", "If-None-Match: *\r\n"),
+		.status = "HTTP/1.1 304 Not Modified",
+		.contentlen = 0,
+	},
+	{
+		.name = "if-none-match miss",
+		.request = SERVERTEST_GET("/document", "If-None-Match: \"v2\"\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "if-modified-since",
+		.request = SERVERTEST_GET("/document", "If-Modified-Since: " SERVERTEST_DATE "\r\n"),
+		.status = "HTTP/1.1 304 Not Modified",
+		.contentlen = 0,
+	},
+	{
+		.name = "if-modified-since old",
+		.request = SERVERTEST_GET("/document", "If-Modified-Since: " SERVERTEST_OLDDATE "\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		/// If-None-Match is evaluated without If-Modified-Since
+		.name = "if-none-match precedence",
+		.request = SERVERTEST_GET("/document", "If-None-Match: \"v2\"\r\nIf-Modified-Since: " SERVERTEST_DATE "\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "range",
+		.request = SERVERTEST_GET("/document", "Range: bytes=2-5\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.header = "Content-Range: bytes 2-5/100",
+		.offset = 2,
+		.contentlen = 4,
+	},
+	{
+		.name = "range suffix",
+		.request = SERVERTEST_GET("/document", "Range: bytes=-3\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.header = "Content-Range: bytes 97-99/100",
+		.offset = 97,
+		.contentlen = 3,
+	},
+	{
+		.name = "range open",
+		.request = SERVERTEST_GET("/document", "Range: bytes=90-\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.header = "Content-Range: bytes 90-99/100",
+		.offset = 90,
+		.contentlen = 10,
+	},
+	{
+		.name = "range merged",
+		.request = SERVERTEST_GET("/document", "Range: bytes=0-3,2-6,7-8\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.header = "Content-Range: bytes 0-8/100",
+		.offset = 0,
+		.contentlen = 9,
+	},
+	{
+		.name = "range multipart",
+		.request = SERVERTEST_GET("/document", "Range: bytes=0-1,4-6\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.header = "Content-Type: multipart/byteranges",
+		.contentlen = -1,
+	},
+	{
+		.name = "range not satisfiable",
+		.request = SERVERTEST_GET("/document", "Range: bytes=100-200\r\n"),
+		.status = "HTTP/1.1 416 Range Not Satisfiable",
+		.header = "Content-Range: bytes */100",
+		.contentlen = -1,
+	},
+	{
+		.name = "range invalid",
+		.request = SERVERTEST_GET("/document", "Range: bytes=5-2\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "range unit",
+		.request = SERVERTEST_GET("/document", "Range: items=0-1\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "if-range",
+		.request = SERVERTEST_GET("/document", "Range: bytes=0-3\r\nIf-Range: " SERVERTEST_ETAG "\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.offset = 0,
+		.contentlen = 4,
+	},
+	{
+		.name = "if-range miss",
+		.request = SERVERTEST_GET("/document", "Range: bytes=0-3\r\nIf-Range: \"v0\"\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.contentlen = SERVERTEST_DOCUMENTLEN,
+	},
+	{
+		.name = "if-range date",
+		.request = SERVERTEST_GET("/document", "Range: bytes=0-3\r\nIf-Range: " SERVERTEST_DATE "\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.offset = 0,
+		.contentlen = 4,
+	},
+	{
+		.name = "file",
+		.request = "GET /file HTTP/1.0\r\n\r\n",
+		.status = "HTTP/1.0 200 OK",
+		.contentlen = SERVERTEST_FILELEN,
+	},
+	{
+		.name = "file range",
+		.request = "GET /file HTTP/1.0\r\nRange: bytes=100-899\r\n\r\n",
+		.status = "HTTP/1.0 206 Partial Content",
+		.header = "Content-Range: bytes 100-899/1000",
+		.offset = 100,
+		.contentlen = 800,
+	},
+	{
+		.name = "file not satisfiable",
+		.request = "GET /file HTTP/1.0\r\nRange: bytes=1000-\r\n\r\n",
+		.status = "HTTP/1.0 416 Range Not Satisfiable",
+		.contentlen = -1,
+	},
+	{
+		.name = "file not modified",
+		.request = "GET /file HTTP/1.0\r\nIf-None-Match: " SERVERTEST_ETAG "\r\nRange: bytes=0-1\r\n\r\n",
+		.status = "HTTP/1.0 304 Not Modified",
+		.contentlen = 0,
+	},
+	{
+		.name = NULL,
+	}
+};
+
+static int servertest_case(int port, const servertest_case_t *test)
+{
+	servertest_response_t *response = calloc(1, sizeof(*response));
+	if (response == NULL)
+		return EREJECT;
+	const char *error = NULL;
+	const char *value = NULL;
+	if (servertest_request(port, test->request, response) != ESUCCESS)
+		error = "no response";
+	else if (strncmp(response->data, test->status, strlen(test->status)) ||
+			strncmp(response->data + strlen(test->status), "\r\n", 2))
+		error = "bad status";
+	else if (test->header != NULL)
+	{
+		const char *separator = strchr(test->header, ':');
+		char key[64];
+		snprintf(key, sizeof(key), "%.*s", (int)(separator - test->header), test->header);
+		size_t length = servertest_header(response, key, &value);
+		if (value == NULL || length < strlen(separator + 2) ||
+			strncmp(value, separator + 2, strlen(separator + 2)))
+			error = "bad header";
+	}
+	if (error == NULL && test->contentlen >= 0 &&
+		(response->contentlen != test->contentlen ||
+		servertest_check(response->content, test->offset, test->contentlen) != ESUCCESS))
+		error = "bad content";
+	if (error != NULL)
+		fprintf(stderr, "servertest: %s: %s\n%s\n", test->name, error, response->data);
+	else
+		printf("%s: ok\n", test->name);
+	free(response);
+	return (error == NULL)? ESUCCESS: EREJECT;
+}
+
+#ifdef HTTPCACHE
+typedef struct servertest_cachecase_s servertest_cachecase_t;
+struct servertest_cachecase_s
+{
+	const char *name;
+	const char *request;
+	const char *status;
+	const char *content; /**the content of the stored response or of a new one*/
+};
+
+/**
+ * the connector runs only for the first request and the no-cache one,
+ * the validations and the ranges are answered from the stored response.
+ */
+static const servertest_cachecase_t cachecases[] =
+{
+	{
+		.name = "cache store",
+		.request = SERVERTEST_GET("/count", ""),
+		.status = "HTTP/1.1 200 OK",
+		.content = "count 1",
+	},
+	{
+		.name = "cache hit",
+		.request = SERVERTEST_GET("/count", ""),
+		.status = "HTTP/1.1 200 OK",
+		.content = "count 1",
+	},
+	{
+		.name = "cache if-none-match",
+		.request = SERVERTEST_GET("/count", "If-None-Match: " SERVERTEST_COUNTETAG "\r\n"),
+		.status = "HTTP/1.1 304 Not Modified",
+		.content = "",
+	},
+	{
+		.name = "cache if-none-match miss",
+		.request = SERVERTEST_GET("/count", "If-None-Match: \"c0\"\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.content = "count 1",
+	},
+	{
+		.name = "cache if-modified-since",
+		.request = SERVERTEST_GET("/count", "If-Modified-Since: " SERVERTEST_DATE "\r\n"),
+		.status = "HTTP/1.1 304 Not Modified",
+		.content = "",
+	},
+	{
+		.name = "cache range",
+		.request = SERVERTEST_GET("/count", "Range: bytes=1-4\r\n"),
+		.status = "HTTP/1.1 206 Partial Content",
+		.content = "ount",
+	},
+	{
+		.name = "cache if-range miss",
+		.request = SERVERTEST_GET("/count", "Range: bytes=1-4\r\nIf-Range: \"c0\"\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.content = "count 1",
+	},
+	{
+		.name = "cache no-cache",
+		.request = SERVERTEST_GET("/count", "Cache-Control: no-cache\r\n"),
+		.status = "HTTP/1.1 200 OK",
+		.content = "count 2",
+	},
+	{
+		.name = NULL,
+	}
+};
+
+static int servertest_cache(int port)
+{
+	servertest_response_t *response = calloc(1, sizeof(*response));
+	if (response == NULL)
+		return EREJECT;
+	int ret = ESUCCESS;
+	for (int i = 0; ret == ESUCCESS && cachecases[i].name != NULL; i++)
+	{
+		const servertest_cachecase_t *test = &cachecases[i];
+		const char *error = NULL;
+		const char *pid = NULL;
+		if (servertest_request(port, test->request, response) != ESUCCESS)
+			error = "no response";
+		else if (i == 0 && servertest_header(response, "X-Pid", &pid) >= 0 &&
+				(pid == NULL || atoi(pid) != getpid()))
+		{
+			/// the clients run into their own process with their own cache
+			printf("cache: skipped with the forked clients\n");
+			break;
+		}
+		else if (strncmp(response->data, test->status, strlen(test->status)) ||
+				strncmp(response->data + strlen(test->status), "\r\n", 2))
+			error = "bad status";
+		else if (response->contentlen != strlen(test->content) ||
+				memcmp(response->content, test->content, response->contentlen))
+			error = "bad content";
+		if (error != NULL)
+		{
+			fprintf(stderr, "servertest: %s: %s\n%s\n", test->name, error, response->data);
+			ret = EREJECT;
+		}
+		else
+			printf("%s: ok\n", test->name);
+	}
+	free(response);
+	return ret;
+}
+#endif
+
+static int servertest_backpressure(int port)
+{
+	static const char request[] = "GET /large HTTP/1.0\r\n\r\n";
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return EREJECT;
+	int rcvbuf = 4096;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	struct timeval timeout = { .tv_sec = 5 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		send(sock, request, sizeof(request) - 1, MSG_NOSIGNAL) < 0)
+	{
+		close(sock);
+		return EREJECT;
+	}
+	/// the reader is slower than the connector
+	char data[4096];
+	size_t header = 0;
+	char end[4] = {0};
+	size_t length = 0;
+	int ret = ESUCCESS;
+	ssize_t size;
+	while ((size = recv(sock, data, sizeof(data), 0)) > 0)
+	{
+		ssize_t i = 0;
+		while (header == 0 && i < size)
+		{
+			memmove(end, end + 1, 3);
+			end[3] = data[i++];
+			if (!memcmp(end, "\r\n\r\n", 4))
+				header = 1;
+		}
+		if (header && servertest_check(data + i, length, size - i) != ESUCCESS)
+			ret = EREJECT;
+		if (header)
+			length += size - i;
+		usleep(500);
+	}
+	close(sock);
+	if (ret != ESUCCESS || length != SERVERTEST_LARGELEN)
+	{
+		fprintf(stderr, "servertest: backpressure: %lu bytes received on %d\n", length, SERVERTEST_LARGELEN);
+		return EREJECT;
+	}
+	printf("backpressure: ok\n");
+	return ESUCCESS;
+}
+
+#ifndef VTHREAD
+/**
+ * more requests than workers are sent together,
+ * the calls wait a worker and none runs on the loop.
+ */
+static int servertest_blocking(int port)
+{
+	int socks[SERVERTEST_BLOCKINGCLIENTS];
+	int ret = ESUCCESS;
+	for (int i = 0; i < SERVERTEST_BLOCKINGCLIENTS; i++)
+	{
+		socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+		if (socks[i] < 0)
+		{
+			ret = EREJECT;
+			continue;
+		}
+		struct timeval timeout = { .tv_sec = 5 };
+		setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		/// the query makes each request different for the cache
+		char request[64];
+		int length = snprintf(request, sizeof(request), "GET /blocking?%d HTTP/1.0\r\n\r\n", i);
+		if (connect(socks[i], (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			send(socks[i], request, length, MSG_NOSIGNAL) < 0)
+			ret = EREJECT;
+	}
+	for (int i = 0; i < SERVERTEST_BLOCKINGCLIENTS; i++)
+	{
+		if (socks[i] < 0)
+			continue;
+		char data[1024];
+		size_t length = 0;
+		ssize_t size;
+		while (length < sizeof(data) - 1 &&
+			(size = recv(socks[i], data + length, sizeof(data) - 1 - length, 0)) > 0)
+			length += size;
+		data[length] = '\0';
+		close(socks[i]);
+		const char *content = strstr(data, "\r\n\r\n");
+		if (strncmp(data, "HTTP/1.0 200 OK\r\n", 17) || content == NULL || strcmp(content + 4, "worker"))
+		{
+			fprintf(stderr, "servertest: blocking: bad response %d\n%s\n", i, data);
+			ret = EREJECT;
+		}
+	}
+	if (ret == ESUCCESS)
+		printf("blocking: ok\n");
+	return ret;
+}
+#endif
+
+typedef struct servertest_run_s servertest_run_t;
+struct servertest_run_s
+{
+	int port;
+	int ret;
+	volatile int done;
+	pthread_t server;
+};
+
+/**
+ * the requests are sent from a thread,
+ * without thread the server runs the loop of the main thread.
+ */
+static void *servertest_run(void *arg)
+{
+	servertest_run_t *run = (servertest_run_t *)arg;
+	for (int i = 0; cases[i].name != NULL; i++)
+	{
+		if (servertest_case(run->port, &cases[i]) != ESUCCESS)
+			run->ret = -1;
+	}
+#ifdef HTTPCACHE
+	if (servertest_cache(run->port) != ESUCCESS)
+		run->ret = -1;
+#endif
+	if (servertest_backpressure(run->port) != ESUCCESS)
+		run->ret = -1;
+#ifndef VTHREAD
+	if (servertest_blocking(run->port) != ESUCCESS)
+		run->ret = -1;
+#endif
+#ifndef VTHREAD
+	/// the signal stops the select of the loop, it may arrive outside of it
+	while (!run->done)
+	{
+		pthread_kill(run->server, SIGUSR1);
+		usleep(100000);
+	}
+#endif
+	return NULL;
+}
+
+#ifndef VTHREAD
+static void servertest_wakeup(int signum)
+{
+}
+#endif
+
+int main(int argc, char * const *argv)
+{
+	http_server_config_t config = {
+		.addr = "127.0.0.1",
+		.port = SERVERTEST_PORT,
+		.maxclients = 10,
+		.chunksize = 4096,
+		.keepalive = 0,
+		.version = HTTP11,
+		.sendhigh = SERVERTEST_SENDHIGH,
+	};
+	servertest_run_t run = {0};
+
+	setbuf(stdout, NULL);
+	if (argc > 1)
+		config.port = atoi(argv[1]);
+	http_server_t *server = httpserver_create(&config);
+	if (server == NULL)
+		return -1;
+	httpserver_addconnector(server, document_connector, NULL, CONNECTOR_DOCUMENT, "document");
+	httpserver_addconnector(server, file_connector, NULL, CONNECTOR_DOCUMENT, "file");
+	httpserver_addconnector(server, count_connector, NULL, CONNECTOR_DOCUMENT, "count");
+	httpserver_addconnector(server, large_connector, NULL, CONNECTOR_DOCUMENT, "large");
+#ifndef VTHREAD
+	servertest_loop = pthread_self();
+	httpserver_addconnector(server, blocking_connector, NULL, CONNECTOR_DOCUMENT | CONNECTOR_BLOCKING, "blocking");
+#endif
+#ifdef HTTPCACHE
+	httpserver_addcache(server, 64 * 1024, 60, NULL);
+#endif
+#ifndef VTHREAD
+	struct sigaction action = {0};
+	action.sa_handler = servertest_wakeup;
+	sigaction(SIGUSR1, &action, NULL);
+#endif
+	httpserver_connect(server);
+
+	run.port = config.port;
+	run.server = pthread_self();
+	pthread_t client;
+	if (pthread_create(&client, NULL, servertest_run, &run) != 0)
+	{
+		httpserver_disconnect(server);
+		httpserver_destroy(server);
+		return -1;
+	}
+#ifndef VTHREAD
+	httpserver_run(server);
+	run.done = 1;
+#endif
+	pthread_join(client, NULL);
+
+	httpserver_disconnect(server);
+	httpserver_destroy(server);
+	return run.ret;
+}
@@ -41,6 +41,9 @@
 
 #include "ouistiti/httpserver.h"
 
+/// the application gives the name of the upgrade
+const char str_upgrade[] = "upgrade";
+
 int test_client = 0;
 
 #ifdef MBEDTLS
@@ -96,7 +99,7 @@ int main(int argc, char * const *argv)
 	http_server_t *server = httpserver_create(config);
 	if (server)
 	{
-		httpserver_addconnector(server, test_func, ptest_config);
+		httpserver_addconnector(server, test_func, ptest_config, CONNECTOR_DOCUMENT, "test");
 #ifdef MBEDTLS
 		mod_mbedtls_t mbedtlsconfig =
 		{
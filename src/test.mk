@@ -1,9 +1,33 @@
 bin-$(TEST)+=httptest
-httptest_CFLAGS+=-I../include/httpserver -DHTTPSERVER
+httptest_CFLAGS+=-I../include -DHTTPSERVER
 httptest_LDFLAGS+=-DHTTPSERVER -L. -Lhttpserver
 httptest_SOURCES+=test.c
-httptest_LIBRARY+=httpserver
+httptest_LIBS+=$(LIBHTTPSERVER_NAME:lib%=%)
 httptest_LIBRARY-$(MBEDTLS)+=mod_mbedtls
 httptest_LIBRARY-$(STATIC_FILE)+=mod_static_file
 
 httptest_CFLAGS-$(DEBUG)+=-g -DDEBUG
+
+# the benchmark uses the internal functions of the static library
+bin-$(TEST)+=httpbench
+httpbench_CFLAGS+=-I../include -Ihttpserver
+httpbench_LDFLAGS+=-L. -Lhttpserver
+httpbench_SOURCES+=bench.c
+httpbench_LIBS+=:$(LIBHTTPSERVER_NAME).a ouihash pthread
+httpbench_LIBS-$(HTTPENCODING)+=z
+
+# the parser receives the requests split at every byte
+bin-$(TEST)+=httpparsertest
+httpparsertest_CFLAGS+=-I../include -Ihttpserver
+httpparsertest_LDFLAGS+=-L. -Lhttpserver
+httpparsertest_SOURCES+=parsertest.c
+httpparsertest_LIBS+=:$(LIBHTTPSERVER_NAME).a ouihash pthread
+httpparsertest_LIBS-$(HTTPENCODING)+=z
+
+# the server answers on the loopback to the requests of the test
+bin-$(TEST)+=httpservertest
+httpservertest_CFLAGS+=-I../include
+httpservertest_LDFLAGS+=-L. -Lhttpserver
+httpservertest_SOURCES+=servertest.c
+httpservertest_LIBS+=:$(LIBHTTPSERVER_NAME).a ouihash pthread
+httpservertest_LIBS-$(HTTPENCODING)+=z